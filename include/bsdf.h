@@ -17,29 +17,101 @@
 #pragma once
 
 #include <vector.h>
+#include <spectrum.h>
+#include <random.h>
 
-class BSDF
+// lobes of a BSDF (see BSDF::lobes())
+enum BSDFLobes
+{
+    LOBE_NONE = 0,
+    LOBE_DELTA_REFLECTION = 1,   // singular reflection (evalSingular())
+    LOBE_DELTA_TRANSMISSION = 2, // singular transmission (evalSingular())
+    LOBE_SMOOTH = 4,             // non-singular lobes (eval())
+    LOBE_ALL = 7
+};
+
+// parameters of a material, set per query without constructing its objects (see BSDF::setParameters(),
+// NDF::setParameters() and MicrosurfacePalette): each BSDF and NDF reads the parameters that apply to it
+template <class Float>
+struct MaterialParametersT
+{
+    Float roughness_x = 0.5; // NDF roughness
+    Float roughness_y = 0.5;
+    Float gamma = 2.0; // Student-T shape
+    Float kd = 1.0;    // diffuse albedo
+
+    // conductor ior per channel (gray for a monochromatic conductor), real and imaginary parts
+    SpectrumT<Float> eta = SpectrumT<Float>(1.0);
+    SpectrumT<Float> k = SpectrumT<Float>(0.0);
+};
+
+typedef MaterialParametersT<double> MaterialParameters;
+
+// BSDF interface, templated on the precision tier (see vector.h)
+template <class Float>
+class BSDFT
 {
 public:
+    typedef Float Scalar;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
+
+    // the lobes that the BSDF may have (a combination of BSDFLobes): eval() is zero without LOBE_SMOOTH, and
+    // evalSingular() is zero without the delta lobes, so callers such as Microsurface can skip them
+    virtual unsigned lobes() const
+    {
+        return LOBE_ALL;
+    }
+
+    // set the parameters of the BSDF that appear in parameters (BSDFs without such parameters keep theirs)
+    // NB: this modifies the BSDF, which must not be queried by other threads meanwhile
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+    }
+
     // NB: this function takes an input weight and MODIFIES it
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &io_weight) const = 0;
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, Sampler &sampler) const = 0;
+    Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight) const
+    {
+        return sample(ior_i, ior_t, wi, io_weight, defaultSampler());
+    }
 
     // sample in a space oriented to normal wm
-    Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &io_weight, const Vector3 &wm) const
+    Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, const Vector3 &wm, Sampler &sampler) const
     {
         Vector3 w1(0, 0, 0);
         Vector3 w2(0, 0, 0);
         buildOrthonormalBasis(w1, w2, wm);
 
         Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
-        Vector3 wo_local = sample(ior_i, ior_t, wi_local, io_weight);
+        Vector3 wo_local = sample(ior_i, ior_t, wi_local, io_weight, sampler);
 
         return wo_local.x * w1 + wo_local.y * w2 + wo_local.z * wm;
     }
+    Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, const Vector3 &wm) const
+    {
+        return sample(ior_i, ior_t, wi, io_weight, wm, defaultSampler());
+    }
 
     // BRDF * cos(theta_o) evaluation
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const = 0;
-    double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
+    // (the sampler is only consumed by stochastic BSDFs, such as Microsurface)
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const = 0;
+    Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return eval(ior_i, ior_t, wi, wo, defaultSampler());
+    }
+
+    // eval() for many outgoing directions: out_value[j] = eval(wi, wo[j])
+    // stochastic BSDFs (Microsurface) share one random walk between all the directions: every value
+    // is unbiased, but values of the same call are correlated
+    virtual void evalMany(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 *wo, const size_t count,
+                          Float *out_value, Sampler &sampler) const
+    {
+        for (size_t j = 0; j < count; ++j)
+            out_value[j] = eval(ior_i, ior_t, wi, wo[j], sampler);
+    }
+
+    Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm, Sampler &sampler) const
     {
         Vector3 w1(0, 0, 0);
         Vector3 w2(0, 0, 0);
@@ -48,12 +120,36 @@ public:
         Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
         Vector3 wo_local(dot(wo, w1), dot(wo, w2), dot(wo, wm));
 
-        return eval(ior_i, ior_t, wi_local, wo_local);
+        return eval(ior_i, ior_t, wi_local, wo_local, sampler);
+    }
+    Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
+    {
+        return eval(ior_i, ior_t, wi, wo, wm, defaultSampler());
+    }
+
+    // density (per solid angle) of the directions returned by sample(), singular lobes excluded
+    // (stochastic BSDFs, such as Microsurface, return an unbiased estimate)
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const = 0;
+    Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return pdf(ior_i, ior_t, wi, wo, defaultSampler());
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const = 0;
+    Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm, Sampler &sampler) const
+    {
+        Vector3 w1(0, 0, 0);
+        Vector3 w2(0, 0, 0);
+        buildOrthonormalBasis(w1, w2, wm);
+
+        Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
+        Vector3 wo_local(dot(wo, w1), dot(wo, w2), dot(wo, wm));
+
+        return pdf(ior_i, ior_t, wi_local, wo_local, sampler);
+    }
+
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const = 0;
     // sample in a space oriented to normal wm
-    double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
+    Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
     {
         Vector3 w1(0, 0, 0);
         Vector3 w2(0, 0, 0);
@@ -64,4 +160,79 @@ public:
 
         return evalSingular(ior_i, ior_t, wi_local, wo_local);
     }
-};
\ No newline at end of file
+
+    // probability of sampling the singular lobes, in the units of evalSingular() (evalSingular() = pdfSingular() * sample weight)
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const = 0;
+    // in a space oriented to normal wm
+    Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
+    {
+        Vector3 w1(0, 0, 0);
+        Vector3 w2(0, 0, 0);
+        buildOrthonormalBasis(w1, w2, wm);
+
+        Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
+        Vector3 wo_local(dot(wo, w1), dot(wo, w2), dot(wo, wm));
+
+        return pdfSingular(ior_i, ior_t, wi_local, wo_local);
+    }
+
+    // per-channel versions of sample(), eval() and evalSingular() (see spectrum.h), for BSDFs whose values depend on the
+    // channel but whose sampled directions do not (the default versions are gray)
+    // sampleSpectrum() samples the direction of sample() with the same random numbers, and multiplies each channel of
+    // io_weight by its sample weight
+    virtual Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        Float weight = 1.0;
+        const Vector3 wo = sample(ior_i, ior_t, wi, weight, sampler);
+        io_weight *= weight;
+        return wo;
+    }
+    // sample in a space oriented to normal wm
+    Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, const Vector3 &wm, Sampler &sampler) const
+    {
+        Vector3 w1(0, 0, 0);
+        Vector3 w2(0, 0, 0);
+        buildOrthonormalBasis(w1, w2, wm);
+
+        Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
+        Vector3 wo_local = sampleSpectrum(ior_i, ior_t, wi_local, io_weight, sampler);
+
+        return wo_local.x * w1 + wo_local.y * w2 + wo_local.z * wm;
+    }
+
+    virtual Spectrum evalSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return Spectrum(eval(ior_i, ior_t, wi, wo, sampler));
+    }
+    // in a space oriented to normal wm
+    Spectrum evalSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm, Sampler &sampler) const
+    {
+        Vector3 w1(0, 0, 0);
+        Vector3 w2(0, 0, 0);
+        buildOrthonormalBasis(w1, w2, wm);
+
+        Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
+        Vector3 wo_local(dot(wo, w1), dot(wo, w2), dot(wo, wm));
+
+        return evalSpectrum(ior_i, ior_t, wi_local, wo_local, sampler);
+    }
+
+    virtual Spectrum evalSingularSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return Spectrum(evalSingular(ior_i, ior_t, wi, wo));
+    }
+    // in a space oriented to normal wm
+    Spectrum evalSingularSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm) const
+    {
+        Vector3 w1(0, 0, 0);
+        Vector3 w2(0, 0, 0);
+        buildOrthonormalBasis(w1, w2, wm);
+
+        Vector3 wi_local(dot(wi, w1), dot(wi, w2), dot(wi, wm));
+        Vector3 wo_local(dot(wo, w1), dot(wo, w2), dot(wo, wm));
+
+        return evalSingularSpectrum(ior_i, ior_t, wi_local, wo_local);
+    }
+};
+
+typedef BSDFT<double> BSDF;
@@ -18,16 +18,24 @@
 
 #include <vector.h>
 #include <math_functions.h>
+#include <random.h>
 #include <bsdf.h>
+#include <limits>
 
 //////////////////////////////////////////////////////////////////////////////////
 // NDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class NDF
+template <class Float>
+class NDFT
 {
 public:
-    NDF(const BSDF *bsdf)
+    typedef Float Scalar;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
+    typedef BSDFT<Float> BSDF;
+
+    NDFT(const BSDF *bsdf)
         : m_bsdf(bsdf)
     {
     }
@@ -38,40 +46,116 @@ public:
 
 public:
     // distribution of normals (NDF)
-    virtual double D(const Vector3 &wm) const = 0;
+    virtual Float D(const Vector3 &wm) const = 0;
     // distribution of visible normals (vNDF)
-    virtual double D_wi(const Vector3 &wi, const Vector3 &wm) const {
+    virtual Float D_wi(const Vector3 &wi, const Vector3 &wm) const {
         // normalization coefficient
-        const double l_sigma = sigma(wi);
+        const Float l_sigma = sigma(wi);
         if (l_sigma == 0)
             return 0;
-        const double c = 1.0 / l_sigma;
+        const Float c = 1.0 / l_sigma;
 
-        return c * std::max(0.0, dot(wi, wm)) * D(wm);
+        return c * std::max(Float(0), dot(wi, wm)) * D(wm);
     }
 
     // only used for ShapeInvariant NDF - and included in NullNDF for debugging purposes
-    virtual Vector3 sampleD_wi(const Vector3 &wi) const = 0;
+    virtual Vector3 sampleD_wi(const Vector3 &wi, Sampler &sampler) const = 0;
+    Vector3 sampleD_wi(const Vector3 &wi) const
+    {
+        return sampleD_wi(wi, defaultSampler());
+    }
 
 public:
     // cross section (projected area) sigma_t when moving in direction wi
-    virtual double sigma(const Vector3 &wi) const = 0;
+    virtual Float sigma(const Vector3 &wi) const = 0;
+
+    // true if sampleHeight() samples exponential free paths with cross section sigma(), and visible normals of D_wi()
+    // that all carry m_bsdf: single scattering then has a closed form (see Microsurface::singleScatteringShadowing())
+    virtual bool uniformMicrosurface() const
+    {
+        return false;
+    }
+
+    // largest roughness (alpha) of the distribution, infinite if unknown: Microsurface treats NDFs with a roughness
+    // below its m_smooth_roughness as flat (see MicrosurfaceOperator::smoothLimit())
+    virtual Float roughness() const
+    {
+        return std::numeric_limits<Float>::infinity();
+    }
+
+    // set the parameters of the NDF that appear in parameters (roughness, shape; NDFs without such parameters keep
+    // theirs), e.g. per query for spatially varying materials (see MicrosurfacePalette); the facet BSDF m_bsdf has
+    // its own BSDF::setParameters()
+    // NB: this modifies the NDF, which must not be queried by other threads meanwhile
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+    }
 
     // sample a free-path length along direction wr from starting height hr
     // if a collision occurs before escape, return the normal (out_wm) and BSDF (out_bsdf) of the sampled facet
-    virtual double sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                                Vector3 &out_wm, const BSDF *&out_bsdf) const = 0;
+    virtual Float sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                                Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const = 0;
+    Float sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                        Vector3 &out_wm, const BSDF *&out_bsdf) const
+    {
+        return sampleHeight(wr, hr, outside, out_wm, out_bsdf, defaultSampler());
+    }
+
+    // phase function of the singular lobes of the facet BSDF, with the facet normal marginalized over the visible normals
+    // out_pdf (optional): the density with which sampling a visible normal and the facet BSDF scatters wi to wo
+    // through these lobes (pdfSingular() of the facet BSDF instead of evalSingular())
+    Float evalPhaseFunctionSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const bool wi_outside, const bool wo_outside,
+                                     Float *out_pdf = 0) const
+    {
+        return evalPhaseFunctionSingular(m_bsdf, ior_i, ior_t, wi, wo, wi_outside, wo_outside, out_pdf);
+    }
 
-    virtual double evalPhaseFunctionSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo, const bool wi_outside, const bool wo_outside) const {
-        const double etaRatio = ior_t / ior_i;
-        double eta = wi_outside ? etaRatio : 1.0 / etaRatio;
+    // evalPhaseFunctionSingular() with the facet BSDF (m_bsdf) given with its static type (see MicrosurfaceOperator)
+    template <class FacetBSDF>
+    Float evalPhaseFunctionSingular(const FacetBSDF *bsdf, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                                     const bool wi_outside, const bool wo_outside, Float *out_pdf = 0) const
+    {
+        return phaseFunctionSingular<Float>(bsdf, ior_i, ior_t, wi, wo, wi_outside, wo_outside, out_pdf);
+    }
+
+    // evalPhaseFunctionSingular() per channel (see BSDF::evalSingularSpectrum())
+    template <class FacetBSDF>
+    Spectrum evalPhaseFunctionSingularSpectrum(const FacetBSDF *bsdf, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                                               const bool wi_outside, const bool wo_outside, Float *out_pdf = 0) const
+    {
+        return phaseFunctionSingular<Spectrum>(bsdf, ior_i, ior_t, wi, wo, wi_outside, wo_outside, out_pdf);
+    }
+
+private:
+    // the singular lobes of the facet BSDF, monochromatic (Value = Float) or per channel (Value = Spectrum)
+    template <class FacetBSDF>
+    static Float singularLobes(const FacetBSDF *bsdf, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm, const Float *)
+    {
+        return bsdf->evalSingular(ior_i, ior_t, wi, wo, wm);
+    }
+
+    template <class FacetBSDF>
+    static Spectrum singularLobes(const FacetBSDF *bsdf, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Vector3 &wm, const Spectrum *)
+    {
+        return bsdf->evalSingularSpectrum(ior_i, ior_t, wi, wo, wm);
+    }
+
+    template <class Value, class FacetBSDF>
+    Value phaseFunctionSingular(const FacetBSDF *bsdf, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                                const bool wi_outside, const bool wo_outside, Float *out_pdf) const {
+        const Value *value_type = 0;
+        const Float etaRatio = ior_t / ior_i;
+        Float eta = wi_outside ? etaRatio : 1.0 / etaRatio;
 
         if (wi_outside == wo_outside) // reflection
         {
             // half vector
             const Vector3 wh = normalize(wi + wo);
             // value
-            const double value = (wi_outside) ? (0.25 * D_wi(wi, wh) / dot(wi, wh) * m_bsdf->evalSingular(1.0, eta, wi, wo, wh)) : (0.25 * D_wi(-wi, -wh) / dot(-wi, -wh) * m_bsdf->evalSingular(1.0, eta, -wi, -wo, -wh));
+            const Float jacobian = (wi_outside) ? (0.25 * D_wi(wi, wh) / dot(wi, wh)) : (0.25 * D_wi(-wi, -wh) / dot(-wi, -wh));
+            const Value value = (wi_outside) ? (jacobian * singularLobes(bsdf, 1.0, eta, wi, wo, wh, value_type)) : (jacobian * singularLobes(bsdf, 1.0, eta, -wi, -wo, -wh, value_type));
+            if (out_pdf)
+                *out_pdf = (wi_outside) ? (jacobian * bsdf->pdfSingular(1.0, eta, wi, wo, wh)) : (jacobian * bsdf->pdfSingular(1.0, eta, -wi, -wo, -wh));
             return value;
         }
         else // transmission
@@ -79,36 +163,63 @@ public:
             Vector3 wh = -normalize(wi + wo * eta);
             wh *= (wi_outside) ? (sign(wh.z)) : (-sign(wh.z));
 
+            if (out_pdf)
+                *out_pdf = 0.0;
+
             if (dot(wh, wi) < 0)
-                return 0;
+                return Value(0.0);
 
-            float value;
+            Value value;
             if (wi_outside)
             {
-                value = m_bsdf->evalSingular(1.0, eta, wi, wo, wh) *
-                    D_wi(wi, wh) * std::max(0.0, -dot(wo, wh)) *
+                const Float d_wi = D_wi(wi, wh);
+                value = singularLobes(bsdf, 1.0, eta, wi, wo, wh, value_type) *
+                    d_wi * std::max(Float(0), -dot(wo, wh)) *
                     1.0 / pow(dot(wi, wh) + eta * dot(wo, wh), 2.0);
+                if (out_pdf)
+                    *out_pdf = bsdf->pdfSingular(1.0, eta, wi, wo, wh) *
+                        d_wi * std::max(Float(0), -dot(wo, wh)) *
+                        1.0 / pow(dot(wi, wh) + eta * dot(wo, wh), 2.0);
             }
             else
             {
-                value = m_bsdf->evalSingular(wi_outside ? eta : 1.0, wi_outside ? 1.0 : eta, -wi, -wo, -wh) *
-                    D_wi(-wi, -wh) * std::max(0.0, -dot(-wo, -wh)) *
+                const Float d_wi = D_wi(-wi, -wh);
+                value = singularLobes(bsdf, wi_outside ? eta : 1.0, wi_outside ? 1.0 : eta, -wi, -wo, -wh, value_type) *
+                    d_wi * std::max(Float(0), -dot(-wo, -wh)) *
                     1.0 / pow(dot(-wi, -wh) + eta * dot(-wo, -wh), 2.0);
+                if (out_pdf)
+                    *out_pdf = bsdf->pdfSingular(wi_outside ? eta : 1.0, wi_outside ? 1.0 : eta, -wi, -wo, -wh) *
+                        d_wi * std::max(Float(0), -dot(-wo, -wh)) *
+                        1.0 / pow(dot(-wi, -wh) + eta * dot(-wo, -wh), 2.0);
             }
 
             return value;
         }
     }
 
+public:
     // transmittance from a depth h0 in the half space along a ray with direction wi
-    virtual double G_1(const Vector3 &wi, const double h0) const {
+    virtual Float G_1(const Vector3 &wi, const Float h0) const {
         if (wi.z <= 0.0)
             return 0.0;
 
         if (h0 >= 0.0)
             return 1.0;
 
-        const double a = sigma(-wi);
-        return exp(h0 / wi.z * a); // exponential transmittance
+        return G_1(wi, h0, sigma(-wi));
     }
-};
\ No newline at end of file
+
+    // G_1 with a precomputed cross section sigma_t = sigma(-wi), for callers that shadow the same direction many times
+    static Float G_1(const Vector3 &wi, const Float h0, const Float sigma_t)
+    {
+        if (wi.z <= 0.0)
+            return 0.0;
+
+        if (h0 >= 0.0)
+            return 1.0;
+
+        return exp(h0 / wi.z * sigma_t); // exponential transmittance
+    }
+};
+
+typedef NDFT<double> NDF;
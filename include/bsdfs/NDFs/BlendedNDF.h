@@ -26,73 +26,99 @@
 // BlendedNDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class BlendedNDF : public NDF
+template <class Float>
+class BlendedNDFT final : public NDFT<Float>
 {
 public:
-    BlendedNDF(const NDF *ndf1, const NDF *ndf2, const double w1) // mix between NDFs ndf1 and ndf2 where ndf1 has a weight of w1 in the mixture
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NDFT<Float> NDF;
+
+    using NDF::m_bsdf;
+
+    BlendedNDFT(const NDF *ndf1, const NDF *ndf2, const Float w1) // mix between NDFs ndf1 and ndf2 where ndf1 has a weight of w1 in the mixture
         : NDF(ndf1->m_bsdf), m_w1(w1), m_ndf1(ndf1), m_ndf2(ndf2){};
-    double m_w1;
+    Float m_w1;
     const NDF *m_ndf1;
     const NDF *m_ndf2;
 
 public:
     // distribution of normals (NDF)
-    virtual double D(const Vector3 &wm) const;
+    virtual Float D(const Vector3 &wm) const;
     // sample the VNDF - for debugging purposes
-    virtual Vector3 sampleD_wi(const Vector3 &wi) const;
+    using NDF::sampleD_wi;
+    virtual Vector3 sampleD_wi(const Vector3 &wi, Sampler &sampler) const;
 
 public:
     // cross section
-    virtual double sigma(const Vector3 &wi) const;
+    virtual Float sigma(const Vector3 &wi) const;
+
+    // roughest of the two NDFs
+    virtual Float roughness() const;
 
     // sample a free-path length along direction wr from starting height hr
     // if a collision occurs before escape, return the normal (out_wm) and BSDF (out_bsdf) of the sampled facet
-    virtual double sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                                Vector3 &out_wm, const BSDF *&out_bsdf) const;
+    using NDF::sampleHeight;
+    virtual Float sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                                Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const;
 };
 
-double BlendedNDF::D(const Vector3 &wm) const
+template <class Float>
+Float BlendedNDFT<Float>::D(const Vector3 &wm) const
 {
     return m_w1 * m_ndf1->D(wm) + (1.0 - m_w1) * m_ndf2->D(wm);
 }
 
-double BlendedNDF::sigma(const Vector3 &wi) const
+template <class Float>
+Float BlendedNDFT<Float>::sigma(const Vector3 &wi) const
 {
     return m_w1 * m_ndf1->sigma(wi) + (1.0 - m_w1) * m_ndf2->sigma(wi);
 }
 
-double BlendedNDF::sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                                Vector3 &out_wm, const BSDF *&out_bsdf) const
+template <class Float>
+Float BlendedNDFT<Float>::roughness() const
+{
+    return std::max(m_ndf1->roughness(), m_ndf2->roughness());
+}
+
+template <class Float>
+Float BlendedNDFT<Float>::sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                                Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const
 {
-    const double sigma_t = sigma(-wr);
+    const Float sigma_t = sigma(-wr);
 
     if (sigma_t < 0.00001)
         return (wr.z < 0.0) ? hr : 0.0;
 
-    const double dh = -log(RandomReal()) * wr.z / sigma_t;
+    sampler.startSlot(SLOT_FREE_PATH);
+    const Float dh = -log(Float(RandomReal(sampler))) * wr.z / sigma_t;
 
-    const double h = std::min(0.0, hr) + dh;
+    const Float h = std::min(Float(0), hr) + dh;
 
     if (h < 0.0)
     {
-        out_wm = sampleD_wi(-wr);
+        out_wm = sampleD_wi(-wr, sampler);
         out_bsdf = m_bsdf; // uniform microsurface
     }
 
     return h;
 }
 
-Vector3 BlendedNDF::sampleD_wi(const Vector3 &wi) const
+template <class Float>
+Vector3T<Float> BlendedNDFT<Float>::sampleD_wi(const Vector3 &wi, Sampler &sampler) const
 {
-    double sigma1 = m_ndf1->sigma(wi);
-    double sigma2 = m_ndf2->sigma(wi);
-    double p1 = m_w1 * sigma1 / (m_w1 * sigma1 + (1.0 - m_w1) * sigma2);
-    if (RandomReal() < p1)
+    Float sigma1 = m_ndf1->sigma(wi);
+    Float sigma2 = m_ndf2->sigma(wi);
+    Float p1 = m_w1 * sigma1 / (m_w1 * sigma1 + (1.0 - m_w1) * sigma2);
+    sampler.startSlot(SLOT_VNDF_EXTRA);
+    if (RandomReal(sampler) < p1)
     {
-        return m_ndf1->sampleD_wi(wi);
+        return m_ndf1->sampleD_wi(wi, sampler);
     }
     else
     {
-        return m_ndf2->sampleD_wi(wi);
+        return m_ndf2->sampleD_wi(wi, sampler);
     }
-}
\ No newline at end of file
+}
+
+typedef BlendedNDFT<double> BlendedNDF;
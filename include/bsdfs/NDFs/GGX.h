@@ -22,76 +22,90 @@
 // GGXNDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class GGXNDF : public ShapeInvariantNDF
+template <class Float>
+class GGXNDFT final : public ShapeInvariantNDFT<Float>
 {
 public:
-    GGXNDF(const BSDF *bsdf, const double roughness_x, const double roughness_y)
+    typedef Vector2T<Float> Vector2;
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef ShapeInvariantNDFT<Float> ShapeInvariantNDF;
+
+    using ShapeInvariantNDF::m_roughness_x;
+    using ShapeInvariantNDF::m_roughness_y;
+    using ShapeInvariantNDF::roughness_i;
+
+    GGXNDFT(const BSDF *bsdf, const Float roughness_x, const Float roughness_y)
         : ShapeInvariantNDF(bsdf, roughness_x, roughness_y)
     {
     }
 
     // distribution of slopes
-    virtual double P22(const double slope_x, const double slope_y) const {
-        const double tmp = 1.0 + slope_x * slope_x / (m_roughness_x * m_roughness_x) + slope_y * slope_y / (m_roughness_y * m_roughness_y);
+    virtual Float P22(const Float slope_x, const Float slope_y) const {
+        const Float tmp = 1.0 + slope_x * slope_x / (m_roughness_x * m_roughness_x) + slope_y * slope_y / (m_roughness_y * m_roughness_y);
         return 1.0 / (M_PI * m_roughness_x * m_roughness_y) / (tmp * tmp);
     }
 
     // cross section
-    virtual double sigma(const Vector3 &wi) const {
+    virtual Float sigma(const Vector3 &wi) const {
         if (wi.z > 0.9999)
             return 1.0;
         if (wi.z < -0.9999)
             return 0.0;
 
-        const double theta_i = acos(wi.z);
-        const double sin_theta_i = sin(theta_i);
-        const double roughnessi = roughness_i(wi);
+        const Float theta_i = acos(wi.z);
+        const Float sin_theta_i = sin(theta_i);
+        const Float roughnessi = roughness_i(wi);
 
         return 0.5 * (wi.z + sqrt(wi.z * wi.z + sin_theta_i * sin_theta_i * roughnessi * roughnessi));
     }
 
     // sample the distribution of visible slopes with roughness=1.0
-    virtual Vector2 sampleP22_11(const double theta_i) const{
+    virtual Vector2 sampleP22_11(const Float theta_i, Sampler &sampler) const{
         Vector2 slope;
 
-        const double U = RandomReal();
-        const double U_2 = RandomReal();
+        const Float U = RandomReal(sampler);
+        const Float U_2 = RandomReal(sampler);
 
         if (theta_i < 0.0001)
         {
-            const double r = sqrt(U / (1 - U));
-            const double phi = 2 * Pi * U_2;
+            const Float r = sqrt(U / (1 - U));
+            const Float phi = Float(2 * Pi) * U_2;
             slope.x = r * cos(phi);
             slope.y = r * sin(phi);
             return slope;
         }
 
         // constant
-        const double sin_theta_i = sin(theta_i);
-        const double cos_theta_i = cos(theta_i);
-        const double tan_theta_i = sin_theta_i / cos_theta_i;
+        const Float sin_theta_i = sin(theta_i);
+        const Float cos_theta_i = cos(theta_i);
+        const Float tan_theta_i = sin_theta_i / cos_theta_i;
 
         // slope associated to theta_i
-        const double slope_i = cos_theta_i / sin_theta_i;
+        const Float slope_i = cos_theta_i / sin_theta_i;
 
         // projected area
-        const double sigma = 0.5 * (cos_theta_i + 1);
+        const Float sigma = 0.5 * (cos_theta_i + 1);
         if (sigma < 0.0001f || sigma != sigma)
             return Vector2(0, 0);
 
         // normalization coefficient
-        const double c = 1.0 / sigma;
+        const Float c = 1.0 / sigma;
 
-        const double A = 2 * U / cos_theta_i / c - 1;
-        const double B = tan_theta_i;
-        const double tmp = 1 / (A * A - 1);
+        const Float A = 2 * U / cos_theta_i / c - 1;
+        const Float B = tan_theta_i;
+        const Float tmp = 1 / (A * A - 1);
 
-        const double D = sqrt(std::max(0.0, B * B * tmp * tmp - (A * A - B * B) * tmp));
-        const double slope_x_1 = B * tmp - D;
-        const double slope_x_2 = B * tmp + D;
+        const Float D = sqrt(std::max(Float(0), B * B * tmp * tmp - (A * A - B * B) * tmp));
+        const Float slope_x_1 = B * tmp - D;
+        const Float slope_x_2 = B * tmp + D;
         slope.x = (A < 0.0 || slope_x_2 > 1.0 / tan_theta_i) ? slope_x_1 : slope_x_2;
-        slope.y = sqrt(-1 - slope.x * slope.x + (1 + slope.x * slope.x) / pow(1 - U_2, 2.0 / 3.0)) * sin(2 * Pi * RandomReal());
+        sampler.startSlot(SLOT_VNDF_EXTRA);
+        const Float U_3 = RandomReal(sampler);
+        slope.y = sqrt(-1 - slope.x * slope.x + (1 + slope.x * slope.x) / pow(1 - U_2, Float(2.0 / 3.0))) * sin(Float(2 * Pi) * U_3);
 
         return slope;
     }
-};
\ No newline at end of file
+};
+
+typedef GGXNDFT<double> GGXNDF;
@@ -26,28 +26,38 @@
 // General NDF implementation using null scattering
 //////////////////////////////////////////////////////////////////////////////////
 
-class NullNDF : public NDF
+template <class Float>
+class NullNDFT : public NDFT<Float>
 {
 public:
-    NullNDF(const BSDF *bsdf, const double majorant)
+    typedef Vector2T<Float> Vector2;
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NDFT<Float> NDF;
+
+    using NDF::m_bsdf;
+
+    NullNDFT(const BSDF *bsdf, const Float majorant)
         : NDF(bsdf), m_majorant(majorant){};
-    double m_majorant;
+    Float m_majorant;
 
 public:
     // distribution of normals (NDF)
-    virtual double D(const Vector3 &wm) const = 0;
-    virtual double D_wi(const Vector3 &wi, const Vector3 &wm) const;
+    virtual Float D(const Vector3 &wm) const = 0;
+    virtual Float D_wi(const Vector3 &wi, const Vector3 &wm) const;
     // sample the VNDF - for debugging purposes
-    virtual Vector3 sampleD_wi(const Vector3 &wi) const;
+    using NDF::sampleD_wi;
+    virtual Vector3 sampleD_wi(const Vector3 &wi, Sampler &sampler) const;
 
 public:
     // cross section
-    virtual double sigma(const Vector3 &wi) const;
+    virtual Float sigma(const Vector3 &wi) const;
 
     // sample a free-path length along direction wr from starting height hr
     // if a collision occurs before escape, return the normal (out_wm) and BSDF (out_bsdf) of the sampled facet
-    virtual double sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                                Vector3 &out_wm, const BSDF *&out_bsdf) const;
+    using NDF::sampleHeight;
+    virtual Float sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                                Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const;
 };
 
 // projected Area (or sigma_t) for singular NDF with all microfacets having cosine un
@@ -71,13 +81,14 @@ double diracSigma(const double u, const double un)
     return result;
 }
 
-double NullNDF::sigma(const Vector3 &wi) const
+template <class Float>
+Float NullNDFT<Float>::sigma(const Vector3 &wi) const
 {
     // quadrature integration over D(wm) using the Dirac NDF sigma() Green's function:
-    double result = 0.0;
+    Float result = 0.0;
     for (int i = 0; i < 100; ++i)
     {
-        const double u = Gauss100xs[i] * 2 - 1; // rescale abscissas into [-1,1] from [0,1]
+        const Float u = Gauss100xs[i] * 2 - 1; // rescale abscissas into [-1,1] from [0,1]
         Vector3 wm(sqrt(1.0 - u * u), 0, u);
         result += Gauss100ws[i] * D(wm) * diracSigma(wi.z, u);
     }
@@ -85,78 +96,89 @@ double NullNDF::sigma(const Vector3 &wi) const
     return result * 2 / Pi / m_majorant; // adjust for 2x change of interval length
 }
 
-double NullNDF::D_wi(const Vector3 &wi, const Vector3 &wm) const
+template <class Float>
+Float NullNDFT<Float>::D_wi(const Vector3 &wi, const Vector3 &wm) const
 {
 
     // normalization coefficient
-    const double l_sigma = sigma(wi);
+    const Float l_sigma = sigma(wi);
     if (l_sigma == 0)
         return 0;
-    const double c = 1.0 / l_sigma;
-    return c * std::max(0.0, dot(wi, wm)) * D(wm) / Pi / m_majorant;
+    const Float c = 1.0 / l_sigma;
+    return c * std::max(Float(0), dot(wi, wm)) * D(wm) / Pi / m_majorant;
 }
 
-double NullNDF::sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                             Vector3 &out_wm, const BSDF *&out_bsdf) const
+template <class Float>
+Float NullNDFT<Float>::sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                             Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const
 {
-    double dh = -log(RandomReal()) * wr.z;
-    double h = std::min(0.0, hr) + dh;
+    sampler.startSlot(SLOT_FREE_PATH);
+    Float dh = -log(Float(RandomReal(sampler))) * wr.z;
+    Float h = std::min(Float(0), hr) + dh;
     out_bsdf = 0;
 
     while (h <= 0.0)
     {
-        const double u = -wr.z;
-        Vector2 diskOffset = diskSample2D(0.999999);
+        const Float u = -wr.z;
+        sampler.startSlot(SLOT_VNDF);
+        Vector2 diskOffset = Vector2(diskSample2D(0.999999, sampler));
 
         // microfacet normal / sphere position - pre rotation
         Vector3 mPR(diskOffset.x, diskOffset.y, sqrt(1.0 - diskOffset.x * diskOffset.x - diskOffset.y * diskOffset.y));
         // rotate to the same cos(theta)
         Vector3 mPR2(mPR.x * u + sqrt(1.0 - u * u) * mPR.z, mPR.y, u * mPR.z - mPR.x * sqrt(1.0 - u * u));
         // rotate to match azimuth
-        const double phi = atan2(-wr.x, -wr.y);
-        const double cosphi = cos(phi);
-        const double sinphi = sin(phi);
+        const Float phi = atan2(-wr.x, -wr.y);
+        const Float cosphi = cos(phi);
+        const Float sinphi = sin(phi);
         // this is where we strike the unit sphere of the microsurface NDFs - this is then the microfacet normal
         Vector3 microspherePos(-cosphi * mPR2.y + sinphi * mPR2.x, sinphi * mPR2.y + cosphi * mPR2.x, mPR2.z);
 
         // null scattering unless there is enough density for this microfacet normal - cosine factor is already accounted
         // for in the disk sampling above
-        if (RandomReal() < D(microspherePos) / m_majorant)
+        sampler.startSlot(SLOT_VNDF_EXTRA);
+        if (RandomReal(sampler) < D(microspherePos) / m_majorant)
         {
             out_wm = microspherePos;
             assert(dot(wr, out_wm) <= 0.0);
             out_bsdf = m_bsdf;
             return h;
         }
-        h += -log(RandomReal()) * wr.z;
+        sampler.startSlot(SLOT_FREE_PATH);
+        h += -log(Float(RandomReal(sampler))) * wr.z;
     }
 
     return h;
 }
 
-Vector3 NullNDF::sampleD_wi(const Vector3 &wi) const
+template <class Float>
+Vector3T<Float> NullNDFT<Float>::sampleD_wi(const Vector3 &wi, Sampler &sampler) const
 {
     while (true)
     {
-        const double u = wi.z;
-        Vector2 diskOffset = diskSample2D(0.999999);
+        const Float u = wi.z;
+        sampler.startSlot(SLOT_VNDF);
+        Vector2 diskOffset = Vector2(diskSample2D(0.999999, sampler));
 
         // microfacet normal / sphere position - pre rotation
         Vector3 mPR(diskOffset.x, diskOffset.y, sqrt(1.0 - diskOffset.x * diskOffset.x - diskOffset.y * diskOffset.y));
         // rotate to the same cos(theta)
         Vector3 mPR2(mPR.x * u + sqrt(1.0 - u * u) * mPR.z, mPR.y, u * mPR.z - mPR.x * sqrt(1.0 - u * u));
         // rotate to match azimuth
-        const double phi = atan2(wi.x, wi.y);
-        const double cosphi = cos(phi);
-        const double sinphi = sin(phi);
+        const Float phi = atan2(wi.x, wi.y);
+        const Float cosphi = cos(phi);
+        const Float sinphi = sin(phi);
         // this is where we strike the unit sphere of the microsurface NDFs - this is then the microfacet normal
         Vector3 microspherePos(-cosphi * mPR2.y + sinphi * mPR2.x, sinphi * mPR2.y + cosphi * mPR2.x, mPR2.z);
 
         // null scattering unless there is enough density for this microfacet normal - cosine factor is already accounted
         // for in the disk sampling above
-        if (RandomReal() < D(microspherePos) / m_majorant)
+        sampler.startSlot(SLOT_VNDF_EXTRA);
+        if (RandomReal(sampler) < D(microspherePos) / m_majorant)
         {
             return microspherePos;
         }
     }
-}
\ No newline at end of file
+}
+
+typedef NullNDFT<double> NullNDF;
@@ -20,24 +20,44 @@
 
 // null-collision student-T NDF
 
-class NullStudentTNDF : public NullNDF
+template <class Float>
+class NullStudentTNDFT final : public NullNDFT<Float>
 {
 public:
-    NullStudentTNDF(BSDF *bsdf, double roughness, double gamma, double majorant)
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NullNDFT<Float> NullNDF;
+
+    NullStudentTNDFT(BSDF *bsdf, Float roughness, Float gamma, Float majorant)
         : NullNDF(bsdf, majorant), m_roughness(roughness), m_gamma(gamma){};
 
-    double m_gamma, m_roughness;
+    Float m_gamma, m_roughness;
+
+    virtual Float roughness() const
+    {
+        return m_roughness;
+    }
+
+    // roughness (roughness_x) and gamma, with the tightest majorant (D at the normal)
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        m_roughness = parameters.roughness_x;
+        m_gamma = parameters.gamma;
+        this->m_majorant = 1.0 / (Pi * m_roughness * m_roughness);
+    }
 
-    virtual double D(const Vector3 &wm) const
+    virtual Float D(const Vector3 &wm) const
     {
-        const double u = wm.z;
+        const Float u = wm.z;
         if (u > 0.0 && u <= 1.0)
         {
             return 1 / (Pi * Power(u, 4) * Power(m_roughness, 2) * Power(1 + (1 - Power(u, 2)) / (Power(u, 2) * Power(m_roughness, 2) * (-1 + m_gamma)), m_gamma));
         }
-        elseß
+        else
         {
             return 0.0;
         }
     };
-};
\ No newline at end of file
+};
+
+typedef NullStudentTNDFT<double> NullStudentTNDF;
@@ -20,18 +20,36 @@
 
 // null-collision von-Mises Fischer (spherical Gaussian/vMF) NDF
 
-class NullvMFNDF : public NullNDF
+template <class Float>
+class NullvMFNDFT final : public NullNDFT<Float>
 {
 public:
-    NullvMFNDF(BSDF *bsdf, double roughness)
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NullNDFT<Float> NullNDF;
+
+    NullvMFNDFT(BSDF *bsdf, Float roughness)
         : NullNDF(bsdf, 1), m_roughness(roughness){};
 
-    double m_roughness;
+    Float m_roughness;
+
+    virtual Float roughness() const
+    {
+        return m_roughness;
+    }
+
+    // roughness (roughness_x)
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        m_roughness = parameters.roughness_x;
+    }
 
-    virtual double D(const Vector3 &wm) const
+    virtual Float D(const Vector3 &wm) const
     {
         // vMF matched to Beckmann roughness, normalized to 1.0 at normal incidence
-        const double u = wm.z;
+        const Float u = wm.z;
         return exp((2.0 * (-1.0 + u)) / pow(m_roughness, 2));
     };
 };
+
+typedef NullvMFNDFT<double> NullvMFNDF;
@@ -26,54 +26,73 @@
 // Shape Invariant NDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class ShapeInvariantNDF : public NDF
+template <class Float>
+class ShapeInvariantNDFT : public NDFT<Float>
 {
 public:
-    ShapeInvariantNDF(const BSDF *bsdf, const double roughness_x, const double roughness_y)
+    typedef Vector2T<Float> Vector2;
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NDFT<Float> NDF;
+
+    using NDF::m_bsdf;
+
+    ShapeInvariantNDFT(const BSDF *bsdf, const Float roughness_x, const Float roughness_y)
         : NDF(bsdf), m_roughness_x(roughness_x), m_roughness_y(roughness_y)
     {
     }
 
+    using NDF::sampleD_wi;
+    using NDF::sampleHeight;
+
 public:
     // roughness
-    double m_roughness_x, m_roughness_y;
+    Float m_roughness_x, m_roughness_y;
     // projected roughness in wi
-    double roughness_i(const Vector3 &wi) const {
-        const double invSinTheta2 = 1.0 / (1.0 - wi.z * wi.z);
-        const double cosPhi2 = wi.x * wi.x * invSinTheta2;
-        const double sinPhi2 = wi.y * wi.y * invSinTheta2;
+    Float roughness_i(const Vector3 &wi) const {
+        const Float invSinTheta2 = 1.0 / (1.0 - wi.z * wi.z);
+        const Float cosPhi2 = wi.x * wi.x * invSinTheta2;
+        const Float sinPhi2 = wi.y * wi.y * invSinTheta2;
         return sqrt(cosPhi2 * m_roughness_x * m_roughness_x + sinPhi2 * m_roughness_y * m_roughness_y);
     }
 
 public:
     // distribution of normals (NDF)
-    virtual double D(const Vector3 &wm) const {
+    virtual Float D(const Vector3 &wm) const {
         if (wm.z <= 0.0)
             return 0.0;
 
         // slope of wm
-        const double slope_x = -wm.x / wm.z;
-        const double slope_y = -wm.y / wm.z;
+        const Float slope_x = -wm.x / wm.z;
+        const Float slope_y = -wm.y / wm.z;
 
         return P22(slope_x, slope_y) / (wm.z * wm.z * wm.z * wm.z);
     }
 
     // sample the VNDF
-    virtual Vector3 sampleD_wi(const Vector3 &wi) const {
+    virtual Vector3 sampleD_wi(const Vector3 &wi, Sampler &sampler) const {
+        return sampleD_wi(wi, m_roughness_x, m_roughness_y, *this, sampler);
+    }
+
+    // sample the VNDF with roughnesses roughness_x and roughness_y, and the visible slopes with roughness=1.0 of
+    // slopes (sampleP22_11()), e.g. of another shape-invariant NDF
+    template <class SlopeNDF>
+    static Vector3 sampleD_wi(const Vector3 &wi, const Float roughness_x, const Float roughness_y, const SlopeNDF &slopes, Sampler &sampler) {
 
         // stretch to match configuration with roughness=1.0
-        const Vector3 wi_11 = normalize(Vector3(m_roughness_x * wi.x, m_roughness_y * wi.y, wi.z));
+        const Vector3 wi_11 = normalize(Vector3(roughness_x * wi.x, roughness_y * wi.y, wi.z));
 
         // sample visible slope with roughness=1.0
-        Vector2 slope_11 = sampleP22_11(acos(wi_11.z));
+        sampler.startSlot(SLOT_VNDF);
+        Vector2 slope_11 = slopes.sampleP22_11(acos(wi_11.z), sampler);
 
         // align with view direction
-        const double phi = atan2(wi_11.y, wi_11.x);
+        const Float phi = atan2(wi_11.y, wi_11.x);
         Vector2 slope(cos(phi) * slope_11.x - sin(phi) * slope_11.y, sin(phi) * slope_11.x + cos(phi) * slope_11.y);
 
         // stretch back
-        slope.x *= m_roughness_x;
-        slope.y *= m_roughness_y;
+        slope.x *= roughness_x;
+        slope.y *= roughness_y;
 
         // if numerical instability
         if ((slope.x != slope.x) || !IsFiniteNumber(slope.x))
@@ -90,31 +109,50 @@ public:
 
 public:
     // distribution of slopes
-    virtual double P22(const double slope_x, const double slope_y) const = 0;
+    virtual Float P22(const Float slope_x, const Float slope_y) const = 0;
     // cross section
-    virtual double sigma(const Vector3 &wi) const = 0;
+    virtual Float sigma(const Vector3 &wi) const = 0;
     // sample the distribution of visible slopes with roughness=1.0
-    virtual Vector2 sampleP22_11(const double theta_i) const = 0;
+    virtual Vector2 sampleP22_11(const Float theta_i, Sampler &sampler) const = 0;
+
+    virtual bool uniformMicrosurface() const
+    {
+        return true;
+    }
+
+    virtual Float roughness() const
+    {
+        return std::max(m_roughness_x, m_roughness_y);
+    }
+
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        m_roughness_x = parameters.roughness_x;
+        m_roughness_y = parameters.roughness_y;
+    }
 
     // sample a free-path length along direction wr from starting height hr
     // if a collision occurs before escape, return the normal (out_wm) and BSDF (out_bsdf) of the sampled facet
-    virtual double sampleHeight(const Vector3 &wr, const double hr, const bool outside,
-                                Vector3 &out_wm, const BSDF *&out_bsdf) const {
-        const double sigma_t = sigma(-wr);
+    virtual Float sampleHeight(const Vector3 &wr, const Float hr, const bool outside,
+                                Vector3 &out_wm, const BSDF *&out_bsdf, Sampler &sampler) const {
+        const Float sigma_t = sigma(-wr);
 
         if (sigma_t < 0.00001)
             return (wr.z < 0.0) ? hr : 0.0;
 
-        const double dh = -log(RandomReal()) * wr.z / sigma_t;
+        sampler.startSlot(SLOT_FREE_PATH);
+        const Float dh = -log(Float(RandomReal(sampler))) * wr.z / sigma_t;
 
-        const double h = std::min(0.0, hr) + dh;
+        const Float h = std::min(Float(0), hr) + dh;
 
         if (h < 0.0)
         {
-            out_wm = sampleD_wi(-wr);
+            out_wm = sampleD_wi(-wr, sampler);
             out_bsdf = m_bsdf; // uniform microsurface
         }
 
         return h;
     }
 };
+
+typedef ShapeInvariantNDFT<double> ShapeInvariantNDF;
@@ -22,68 +22,79 @@
 // BeckmannNDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class BeckmannNDF : public ShapeInvariantNDF
+template <class Float>
+class BeckmannNDFT final : public ShapeInvariantNDFT<Float>
 {
 public:
-    BeckmannNDF(const BSDF *bsdf, const double roughness_x, const double roughness_y)
+    typedef Vector2T<Float> Vector2;
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef ShapeInvariantNDFT<Float> ShapeInvariantNDF;
+
+    using ShapeInvariantNDF::m_roughness_x;
+    using ShapeInvariantNDF::m_roughness_y;
+    using ShapeInvariantNDF::roughness_i;
+
+    BeckmannNDFT(const BSDF *bsdf, const Float roughness_x, const Float roughness_y)
         : ShapeInvariantNDF(bsdf, roughness_x, roughness_y)
     {
     }
 
     // distribution of slopes
-    virtual double P22(const double slope_x, const double slope_y) const {
+    virtual Float P22(const Float slope_x, const Float slope_y) const {
         return 1.0 / (M_PI * m_roughness_x * m_roughness_y) * exp(-slope_x * slope_x / (m_roughness_x * m_roughness_x) - slope_y * slope_y / (m_roughness_y * m_roughness_y));
     }
 
     // cross section
-    virtual double sigma(const Vector3 &wi) const {
+    virtual Float sigma(const Vector3 &wi) const {
         if (wi.z > 0.9999)
             return 1.0;
         if (wi.z < -0.9999)
             return 0.0;
 
-        const double roughnessi = roughness_i(wi);
-        const double theta_i = acos(wi.z);
-        const double sin_theta_i = sin(theta_i);
-        const double a = 1.0 / tan(theta_i) / roughnessi;
+        const Float roughnessi = roughness_i(wi);
+        const Float theta_i = acos(wi.z);
+        const Float sin_theta_i = sin(theta_i);
+        const Float a = 1.0 / tan(theta_i) / roughnessi;
 
         return 0.5 * (erf(a) + 1.0) * wi.z + INV_2_SQRT_M_PI * roughnessi * sin(theta_i) * exp(-a * a);
     }
 
     // sample the distribution of visible slopes with roughness=1.0
-    virtual Vector2 sampleP22_11(const double theta_i) const {
+    virtual Vector2 sampleP22_11(const Float theta_i, Sampler &sampler) const {
+        using std::abs;
         Vector2 slope;
 
-        const double U = RandomReal();
-        const double U_2 = RandomReal();
+        const Float U = RandomReal(sampler);
+        const Float U_2 = RandomReal(sampler);
 
         if (theta_i < 0.00001)
         {
-            const double r = sqrt(-log(U));
-            const double phi = 2 * Pi * U_2;
+            const Float r = sqrt(-log(U));
+            const Float phi = Float(2 * Pi) * U_2;
             slope.x = r * cos(phi);
             slope.y = r * sin(phi);
             return slope;
         }
 
         // constant
-        const double sin_theta_i = sin(theta_i);
-        const double cos_theta_i = cos(theta_i);
+        const Float sin_theta_i = sin(theta_i);
+        const Float cos_theta_i = cos(theta_i);
 
         // slope associated to theta_i
-        const double slope_i = cos_theta_i / sin_theta_i;
+        const Float slope_i = cos_theta_i / sin_theta_i;
 
         // projected area
-        const double a = cos_theta_i / sin_theta_i;
-        const double sigma = 0.5 * (erf(a) + 1.0) * cos_theta_i + INV_2_SQRT_M_PI * sin_theta_i * exp(-a * a);
+        const Float a = cos_theta_i / sin_theta_i;
+        const Float sigma = 0.5 * (erf(a) + 1.0) * cos_theta_i + INV_2_SQRT_M_PI * sin_theta_i * exp(-a * a);
 
         // VNDF normalization factor
-        const double c = 1.0 / sigma;
+        const Float c = 1.0 / sigma;
 
         // search
-        double erf_min = -0.9999;
-        double erf_max = std::max(erf_min, erf(slope_i));
-        double erf_current = 0.5 * (erf_min + erf_max);
+        Float erf_min = -0.9999;
+        Float erf_max = std::max(erf_min, erf(slope_i));
+        Float erf_current = 0.5 * (erf_min + erf_max);
 
         while (erf_max - erf_min > 0.000001)
         {
@@ -91,14 +102,14 @@ public:
                 erf_current = 0.5 * (erf_min + erf_max);
 
             // evaluate slope
-            const double slope = erfinv(erf_current);
+            const Float slope = erfinv(erf_current);
 
             // CDF
-            const double CDF = (slope >= slope_i) ? 1.0 : c * (INV_2_SQRT_M_PI * sin_theta_i * exp(-slope * slope) + cos_theta_i * (0.5 + 0.5 * erf(slope)));
-            const double diff = CDF - U;
+            const Float CDF = (slope >= slope_i) ? 1.0 : c * (INV_2_SQRT_M_PI * sin_theta_i * exp(-slope * slope) + cos_theta_i * (0.5 + 0.5 * erf(slope)));
+            const Float diff = CDF - U;
 
             // test estimate
-            if (std::abs(diff) < 0.000001)
+            if (abs(diff) < 0.000001)
                 break;
 
             // update bounds
@@ -116,34 +127,35 @@ public:
             }
 
             // update estimate
-            const double derivative = 0.5 * c * cos_theta_i - 0.5 * c * sin_theta_i * slope;
+            const Float derivative = 0.5 * c * cos_theta_i - 0.5 * c * sin_theta_i * slope;
             erf_current -= diff / derivative;
         }
 
         slope.x = erfinv(std::min(erf_max, std::max(erf_min, erf_current)));
         slope.y = erfinv(2.0 * U_2 - 1.0);
 
-        const double u = cos_theta_i;
+        const Float u = cos_theta_i;
 
         if (u < 0.0)
         {
-            const double m = u / sqrt(1.0 - u * u);
-            double xx;
-            if (RandomReal() < powf(-u, 1.3))
+            sampler.startSlot(SLOT_VNDF_EXTRA);
+            const Float m = u / sqrt(1.0 - u * u);
+            Float xx;
+            if (RandomReal(sampler) < pow(-u, Float(1.3)))
             {
-                xx = RandomReal() * RandomReal();
+                xx = RandomReal(sampler) * RandomReal(sampler);
             }
             else
             {
-                xx = 1.0 - erf(sqrt(-log(RandomReal())));
+                xx = 1.0 - erf(sqrt(-log(RandomReal(sampler))));
             }
             slope.x = erfinv(-1.0 + xx * (1.0 + erf(m)));
         }
 
         if (u < -0.9)
         {
-            const double m = u / sqrt(1.0 - u * u);
-            const double x = RandomReal() * pow(RandomReal(), -u);
+            const Float m = u / sqrt(1.0 - u * u);
+            const Float x = RandomReal(sampler) * pow(RandomReal(sampler), -u);
             slope.x = -(sqrt(2 * Power(m, 2) + log(8) - 2 * log((x - 2 * pow(m, 2) * x) / pow(m, 3)) -
                 log(2 * pow(m, 2) + log(8) - 2 * log((x - 2 * pow(m, 2) * x) / pow(m, 3)))) /
                 sqrt(2));
@@ -151,4 +163,6 @@ public:
 
         return slope;
     }
-};
\ No newline at end of file
+};
+
+typedef BeckmannNDFT<double> BeckmannNDF;
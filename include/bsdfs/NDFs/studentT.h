@@ -22,21 +22,49 @@
 // StudentTNDF
 //////////////////////////////////////////////////////////////////////////////////
 
-class StudentTNDF : public ShapeInvariantNDF
+template <class Float>
+class StudentTNDFT final : public ShapeInvariantNDFT<Float>
 {
 public:
-    double m_gamma; // shape parameter
-    StudentTNDF(const BSDF *bsdf, const double roughness_x, const double roughness_y, const double gamma)
-        : ShapeInvariantNDF(bsdf, roughness_x, roughness_y), m_gamma(gamma){};
+    typedef Vector2T<Float> Vector2;
+    typedef Vector3T<Float> Vector3;
+    typedef BSDFT<Float> BSDF;
+    typedef NDFT<Float> NDF;
+    typedef ShapeInvariantNDFT<Float> ShapeInvariantNDF;
+
+    using ShapeInvariantNDF::m_roughness_x;
+    using ShapeInvariantNDF::m_roughness_y;
+    using ShapeInvariantNDF::roughness_i;
+
+    Float m_gamma; // shape parameter
+    StudentTNDFT(const BSDF *bsdf, const Float roughness_x, const Float roughness_y, const Float gamma)
+        : ShapeInvariantNDF(bsdf, roughness_x, roughness_y), m_gamma(gamma), m_gamma_1(double(gamma - 1.0)), m_gamma_15(double(gamma - 1.5)),
+          m_beckmann(0, 1.0, 1.0){};
+
+    // gamma variate samplers for the shapes used by vNDF sampling (gamma - 1 and gamma - 1.5)
+    GammaSampler m_gamma_1, m_gamma_15;
+
+    // Beckmann NDF whose visible slopes sampleD_wi() superposes
+    BeckmannNDFT<Float> m_beckmann;
+
+    // roughness and gamma
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        ShapeInvariantNDF::setParameters(parameters);
+        m_gamma = parameters.gamma;
+        m_gamma_1 = GammaSampler(double(m_gamma - 1.0));
+        m_gamma_15 = GammaSampler(double(m_gamma - 1.5));
+    }
 
     // distribution of slopes
-    virtual double P22(const double slope_x, const double slope_y) const;
+    virtual Float P22(const Float slope_x, const Float slope_y) const;
     // cross section
-    virtual double sigma(const Vector3 &wi) const;
+    virtual Float sigma(const Vector3 &wi) const;
     // sample the distribution of visible slopes with roughness=1.0
-    virtual Vector2 sampleP22_11(const double theta_i) const;
+    virtual Vector2 sampleP22_11(const Float theta_i, Sampler &sampler) const;
 
-    virtual Vector3 sampleD_wi(const Vector3 &wi) const;
+    using NDF::sampleD_wi;
+    virtual Vector3 sampleD_wi(const Vector3 &wi, Sampler &sampler) const;
 };
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -62,7 +90,8 @@ double p_term2(const double u, const double x)
 }
 
 // Beckmann superposition sampling of Student-T: sample angle-dependent Beckmann roughness
-double sample_m_prime(const double u, const double gamma)
+// gamma_1 and gamma_15 sample Gamma variates of shape gamma - 1 and gamma - 1.5
+double sample_m_prime(const double u, const double gamma, const GammaSampler &gamma_1, const GammaSampler &gamma_15, Sampler &sampler)
 {
     if (u < 0.0)
     {
@@ -82,12 +111,12 @@ double sample_m_prime(const double u, const double gamma)
 
         const double b = m1 * mygamma(a) / mygamma(a + 1 / c);
 
-        return pow(RandomGamma(a), 1.0 / c) * b;
+        return pow(RandomGamma(a, sampler), 1.0 / c) * b;
     }
 
     assert(gamma > 2.0);
 
-    double xi1 = RandomReal();
+    double xi1 = RandomReal(sampler);
     const double p1 = p_term1(u, gamma);
     const double p2 = p_term2(u, gamma);
 
@@ -96,45 +125,48 @@ double sample_m_prime(const double u, const double gamma)
     if (xi1 < p1)
     {
         // term 1
-        return RandomGamma(-1.5 + gamma) * gamma_width;
+        return gamma_15.sample(sampler) * gamma_width;
     }
     else
     {
         if (xi1 < p1 + p2)
         {
             // term 2
-            return RandomGamma(gamma - 1.0);
+            return gamma_1.sample(sampler);
         }
         else
         {
             // term 3
-            double m = RandomGamma(gamma - 1.0);
-            while (RandomReal() > erf(u * Sqrt(-(m / ((-1 + gamma) * (-1 + Power(u, 2)))))))
+            double m = gamma_1.sample(sampler);
+            while (RandomReal(sampler) > erf(u * Sqrt(-(m / ((-1 + gamma) * (-1 + Power(u, 2)))))))
             {
-                m = RandomGamma(gamma - 1.0);
+                m = gamma_1.sample(sampler);
             }
             return m;
         }
     }
 }
 
-// auxiliary functions for approximating sigma/Lambda:
-double auxF(const double u, const double g)
+// auxiliary functions for approximating sigma/Lambda (in double, or in the dual numbers of a derivative tier)
+template <class Real>
+Real auxF(const Real u, const Real g)
 {
     return atan(2.00141 - 1.6253863790572571 * g) * sin(0.993127 *
                                                         (-1.00658 + u - (0.0209307 * (-2.63062 + g) * u) / (2.19417 + g)) * tan(u));
 }
 
-double auxF2(const double x, const double g)
+template <class Real>
+Real auxF2(const Real x, const Real g)
 {
-    return 1 + 1 / erf(auxF(x / Sqrt(1 + Power(x, 2)), g) / (1 - x / Sqrt(1 + Power(x, 2))));
+    return 1 + 1 / erf(auxF(Real(x / Sqrt(1 + Power(x, 2))), g) / (1 - x / Sqrt(1 + Power(x, 2))));
 }
 
 //////////////////////////////////////////////////////////////////////////////////
 // implementation
 //////////////////////////////////////////////////////////////////////////////////
 
-double StudentTNDF::P22(const double p, const double q) const
+template <class Float>
+Float StudentTNDFT<Float>::P22(const Float p, const Float q) const
 {
     return pow((-1 + m_gamma) /
                    (-1 + pow(p, 2) / pow(m_roughness_x, 2) +
@@ -144,40 +176,46 @@ double StudentTNDF::P22(const double p, const double q) const
 }
 
 // use an approximation of the cross section to avoid having to use 2F1
-double StudentTNDF::sigma(const Vector3 &wi) const
+template <class Float>
+Float StudentTNDFT<Float>::sigma(const Vector3 &wi) const
 {
     if (wi.z > 0.9999)
         return 1.0;
     if (wi.z < -0.9999)
         return 0.0;
 
-    const double roughnessi = roughness_i(wi);
-    const double theta_i = acos(wi.z);
-    const double x = 1.0 / tan(theta_i) / roughnessi;
+    const Float roughnessi = roughness_i(wi);
+    const Float theta_i = acos(wi.z);
+    const Float x = 1.0 / tan(theta_i) / roughnessi;
 
-    const double u = wi.z;
+    const Float u = wi.z;
+    typedef decltype(x * 1.0) Real; // the approximation is evaluated in double for the float tier
 
     if (u > 0.0)
     {
-        return 0.5 * u * auxF2(x, m_gamma);
+        return 0.5 * u * auxF2<Real>(x, m_gamma);
     }
     else
     {
-        return -0.5 * u * auxF2(-x, m_gamma) + u;
+        return -0.5 * u * auxF2<Real>(-x, m_gamma) + u;
     }
 }
 
-Vector2 StudentTNDF::sampleP22_11(const double theta_i) const
+template <class Float>
+Vector2T<Float> StudentTNDFT<Float>::sampleP22_11(const Float theta_i, Sampler &sampler) const
 {
     assert(false); // handled by sampleD_wi()
     return Vector2(0, 0);
 }
 
 // vNDF sampling using Beckmann superpositions
-Vector3 StudentTNDF::sampleD_wi(const Vector3 &wi) const
+template <class Float>
+Vector3T<Float> StudentTNDFT<Float>::sampleD_wi(const Vector3 &wi, Sampler &sampler) const
 {
-    const double m_prime = sample_m_prime(wi.z, m_gamma);
-    const double beck_rough = 1.0 / sqrt(m_prime / (m_gamma - 1.0));
-    BeckmannNDF beck(0, beck_rough * m_roughness_x, beck_rough * m_roughness_y);
-    return beck.sampleD_wi(wi);
-}
\ No newline at end of file
+    sampler.startSlot(SLOT_VNDF_EXTRA);
+    const Float m_prime = sample_m_prime(double(wi.z), double(m_gamma), m_gamma_1, m_gamma_15, sampler);
+    const Float beck_rough = 1.0 / sqrt(m_prime / (m_gamma - 1.0));
+    return ShapeInvariantNDF::sampleD_wi(wi, beck_rough * m_roughness_x, beck_rough * m_roughness_y, m_beckmann, sampler);
+}
+
+typedef StudentTNDFT<double> StudentTNDF;
@@ -20,34 +20,87 @@
 #include <random.h>
 
 // smooth mirror
-class BlendBSDF : public BSDF
+template <class Float>
+class BlendBSDFT final : public BSDFT<Float>
 {
 public:
+    typedef BSDFT<Float> BSDF;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
+
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+    using BSDF::sampleSpectrum;
+    using BSDF::evalSpectrum;
+    using BSDF::evalSingularSpectrum;
+
     const BSDF *m_bsdfA;
     const BSDF *m_bsdfB;
-    const double m_mix_A;
+    const Float m_mix_A;
+
+    BlendBSDFT(const BSDF *bsdfA, const BSDF *bsdfB, Float mix_A) : m_bsdfA(bsdfA), m_bsdfB(bsdfB), m_mix_A(mix_A){};
+
+    virtual unsigned lobes() const
+    {
+        return m_bsdfA->lobes() | m_bsdfB->lobes();
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &weight, Sampler &sampler) const
+    {
+        if (RandomReal(sampler) < m_mix_A)
+        {
+            return m_bsdfA->sample(ior_i, ior_t, wi, weight, sampler);
+        }
+        else
+        {
+            return m_bsdfB->sample(ior_i, ior_t, wi, weight, sampler);
+        }
+    }
 
-    BlendBSDF(const BSDF *bsdfA, const BSDF *bsdfB, double mix_A) : m_bsdfA(bsdfA), m_bsdfB(bsdfB), m_mix_A(mix_A){};
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return m_mix_A * m_bsdfA->eval(ior_i, ior_t, wi, wo, sampler) + (Float(1) - m_mix_A) * m_bsdfB->eval(ior_i, ior_t, wi, wo, sampler);
+    }
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &weight) const
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
-        if (RandomReal() < m_mix_A)
+        return m_mix_A * m_bsdfA->evalSingular(ior_i, ior_t, wi, wo) + (Float(1) - m_mix_A) * m_bsdfB->evalSingular(ior_i, ior_t, wi, wo);
+    }
+
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return m_mix_A * m_bsdfA->pdf(ior_i, ior_t, wi, wo, sampler) + (Float(1) - m_mix_A) * m_bsdfB->pdf(ior_i, ior_t, wi, wo, sampler);
+    }
+
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return m_mix_A * m_bsdfA->pdfSingular(ior_i, ior_t, wi, wo) + (Float(1) - m_mix_A) * m_bsdfB->pdfSingular(ior_i, ior_t, wi, wo);
+    }
+
+    virtual Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        if (RandomReal(sampler) < m_mix_A)
         {
-            return m_bsdfA->sample(ior_i, ior_t, wi, weight);
+            return m_bsdfA->sampleSpectrum(ior_i, ior_t, wi, io_weight, sampler);
         }
         else
         {
-            return m_bsdfB->sample(ior_i, ior_t, wi, weight);
+            return m_bsdfB->sampleSpectrum(ior_i, ior_t, wi, io_weight, sampler);
         }
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Spectrum evalSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
     {
-        return m_mix_A * m_bsdfA->eval(ior_i, ior_t, wi, wo) + (1.0 - m_mix_A) * m_bsdfB->eval(ior_i, ior_t, wi, wo);
+        return m_bsdfA->evalSpectrum(ior_i, ior_t, wi, wo, sampler) * m_mix_A + m_bsdfB->evalSpectrum(ior_i, ior_t, wi, wo, sampler) * (Float(1) - m_mix_A);
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Spectrum evalSingularSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
-        return m_mix_A * m_bsdfA->evalSingular(ior_i, ior_t, wi, wo) + (1.0 - m_mix_A) * m_bsdfB->evalSingular(ior_i, ior_t, wi, wo);
+        return m_bsdfA->evalSingularSpectrum(ior_i, ior_t, wi, wo) * m_mix_A + m_bsdfB->evalSingularSpectrum(ior_i, ior_t, wi, wo) * (Float(1) - m_mix_A);
     }
-};
\ No newline at end of file
+};
+
+typedef BlendBSDFT<double> BlendBSDF;
@@ -20,29 +20,113 @@
 #include <fresnel.h>
 
 // smooth conductor
-class ConductorBRDF : public BSDF
+template <class Float>
+class ConductorBRDFT final : public BSDFT<Float>
 {
 public:
-    double m_eta; // real part of ior
-    double m_k;   // imaginary part of ior
+    typedef BSDFT<Float> BSDF;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
 
-    ConductorBRDF(const double eta, const double k) : m_eta(eta), m_k(k){};
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+    using BSDF::sampleSpectrum;
+    using BSDF::evalSingularSpectrum;
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &weight) const
+    Float m_eta; // real part of ior
+    Float m_k;   // imaginary part of ior
+
+    // per-channel iors of a colored conductor (m_colored), whose monochromatic functions (sample(), evalSingular())
+    // return the average of the channels
+    Spectrum m_eta_channels;
+    Spectrum m_k_channels;
+    bool m_colored;
+
+    ConductorBRDFT(const Float eta, const Float k) : m_eta(eta), m_k(k), m_eta_channels(eta), m_k_channels(k), m_colored(false){};
+
+    ConductorBRDFT(const Spectrum &eta, const Spectrum &k)
+    {
+        setIors(eta, k);
+    }
+
+    // eta and k, per channel
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        setIors(parameters.eta, parameters.k);
+    }
+
+    void setIors(const Spectrum &eta, const Spectrum &k)
+    {
+        m_eta_channels = eta;
+        m_k_channels = k;
+        m_colored = !eta.isGray() || !k.isGray();
+        m_eta = m_colored ? eta.average() : eta[0];
+        m_k = m_colored ? k.average() : k[0];
+    }
+
+    // Fresnel reflectance, per channel and averaged over the channels
+    Spectrum reflectanceSpectrum(const Float cos_theta, const Float ior_i) const
+    {
+        if (!m_colored)
+            return Spectrum(ConductorR(cos_theta, ior_i, m_eta, m_k));
+
+        Spectrum result;
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+            result[c] = ConductorR(cos_theta, ior_i, m_eta_channels[c], m_k_channels[c]);
+        return result;
+    }
+
+    Float reflectance(const Float cos_theta, const Float ior_i) const
+    {
+        return m_colored ? reflectanceSpectrum(cos_theta, ior_i).average() : ConductorR(cos_theta, ior_i, m_eta, m_k);
+    }
+
+    virtual unsigned lobes() const
+    {
+        return LOBE_DELTA_REFLECTION;
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &weight, Sampler &sampler) const
     {
         // NB: ior_t is ignored, since this comes from the conductor properties directly on creation
-        const double FR = ConductorR(wi.z, ior_i, m_eta, m_k);
+        const Float FR = reflectance(wi.z, ior_i);
         weight *= FR;
         return reflect(wi, Vector3(0, 0, 1));
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        io_weight *= reflectanceSpectrum(wi.z, ior_i);
+        return reflect(wi, Vector3(0, 0, 1));
+    }
+
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return 0.0;
+    }
+
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return reflectance(wi.z, ior_i);
+    }
+
+    virtual Spectrum evalSingularSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return reflectanceSpectrum(wi.z, ior_i);
+    }
+
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
     {
         return 0.0;
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
-        return ConductorR(wi.z, ior_i, m_eta, m_k);
+        return 1.0;
     }
-};
\ No newline at end of file
+};
+
+typedef ConductorBRDFT<double> ConductorBRDF;
@@ -21,15 +21,30 @@
 #include <random.h>
 
 // smooth dielectric
-class DielectricBSDF : public BSDF
+template <class Float>
+class DielectricBSDFT final : public BSDFT<Float>
 {
 public:
-    DielectricBSDF(){};
+    typedef BSDFT<Float> BSDF;
+    typedef Vector3T<Float> Vector3;
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &weight) const
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+
+    DielectricBSDFT(){};
+
+    virtual unsigned lobes() const
     {
-        const double FR = DielectricR(wi.z, ior_t / ior_i);
-        if (RandomReal() <= FR)
+        return LOBE_DELTA_REFLECTION | LOBE_DELTA_TRANSMISSION;
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &weight, Sampler &sampler) const
+    {
+        const Float FR = DielectricR(wi.z, ior_t / ior_i);
+        if (RandomReal(sampler) <= FR)
         {
             return reflect(wi, Vector3(0, 0, 1));
         }
@@ -39,21 +54,34 @@ public:
         }
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
     {
         return 0.0;
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
-        double eta = ior_t / ior_i;
+        Float eta = ior_t / ior_i;
         if (wo.z >= 0.0)
         {
             return DielectricR(wi.z, eta);
         }
         else
         {
-            return (1.0 - DielectricR(wi.z, eta)) * eta * eta;
+            return (Float(1) - DielectricR(wi.z, eta)) * eta * eta;
         }
     }
-};
\ No newline at end of file
+
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return 0.0;
+    }
+
+    // sample() picks reflection with probability FR and leaves the weight unchanged
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return evalSingular(ior_i, ior_t, wi, wo);
+    }
+};
+
+typedef DielectricBSDFT<double> DielectricBSDF;
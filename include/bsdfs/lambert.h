@@ -19,26 +19,82 @@
 #include <bsdf.h>
 #include <random.h>
 
-class LambertBRDF : public BSDF
+template <class Float>
+class LambertBRDFT final : public BSDFT<Float>
 {
 public:
-    double m_kd; // diffuse color
+    typedef BSDFT<Float> BSDF;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
 
-    LambertBRDF(const double kd) : m_kd(kd){};
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+    using BSDF::sampleSpectrum;
+    using BSDF::evalSpectrum;
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &weight) const
+    Float m_kd;             // diffuse albedo (average of the channels of a colored Lambert, m_colored)
+    Spectrum m_kd_channels; // diffuse color
+    bool m_colored;
+
+    LambertBRDFT(const Float kd) : m_kd(kd), m_kd_channels(kd), m_colored(false){};
+
+    LambertBRDFT(const Spectrum &kd) : m_kd(kd.isGray() ? kd[0] : kd.average()), m_kd_channels(kd), m_colored(!kd.isGray()){};
+
+    // kd (monochromatic)
+    virtual void setParameters(const MaterialParametersT<Float> &parameters)
+    {
+        m_kd = parameters.kd;
+        m_kd_channels = Spectrum(m_kd);
+        m_colored = false;
+    }
+
+    virtual unsigned lobes() const
+    {
+        return LOBE_SMOOTH;
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &weight, Sampler &sampler) const
     {
         weight *= m_kd;
-        return lambertDir();
+        return Vector3(lambertDir(sampler));
+    }
+
+    virtual Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        io_weight *= m_colored ? m_kd_channels : Spectrum(m_kd);
+        return Vector3(lambertDir(sampler));
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
     {
-        return (wi.z > 0.0 && wo.z > 0.0) ? (wo.z * m_kd / Pi) : 0.0;
+        return (wi.z > 0.0 && wo.z > 0.0) ? (wo.z * m_kd / Float(Pi)) : 0.0;
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Spectrum evalSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        if (!m_colored)
+            return Spectrum(eval(ior_i, ior_t, wi, wo, sampler));
+
+        return (wi.z > 0.0 && wo.z > 0.0) ? (m_kd_channels * wo.z / Float(Pi)) : Spectrum(0.0);
+    }
+
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return 0.0;
+    }
+
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return (wi.z > 0.0 && wo.z > 0.0) ? (wo.z / Float(Pi)) : 0.0;
+    }
+
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
         return 0.0;
     }
-};
\ No newline at end of file
+};
+
+typedef LambertBRDFT<double> LambertBRDF;
@@ -18,136 +18,2179 @@
 
 #include <bsdfs/NDF.h>
 #include <bsdf.h>
+#include <dual.h>
 #include <random.h>
 
-#define MAX_WALK_LENGTH 10
+#include <chrono>
+#include <type_traits>
+#include <vector>
 
-class Microsurface : public BSDF
+// safety bound on the number of collisions of a walk: walks end by escaping or by Russian roulette (RoulettePolicy)
+#define MAX_WALK_LENGTH 256
+
+// default roughness below which a Microsurface is treated as flat (see MicrosurfaceOperator::m_smooth_roughness)
+#define SMOOTH_ROUGHNESS 1e-3
+
+//////////////////////////////////////////////////////////////////////////////////
+// Russian roulette
+//////////////////////////////////////////////////////////////////////////////////
+
+// survival policy of the Russian roulette of Microsurface walks: at each collision, before next event estimation
+// and scattering, a walk survives with probability survivalProbability() and its weight is divided by that
+// probability, so that walks of low throughput end early without biasing sample(), eval() or pdf()
+// - throughput: product of the facet sample weights of the walk so far, divided by its survival probabilities so far
+//   (without the input weight of sample(), so that sample and eval walks play the same roulette)
+// - collision_count: number of collisions scattered so far
+class RoulettePolicy
+{
+public:
+    virtual ~RoulettePolicy() {}
+
+    virtual double survivalProbability(const double throughput, const size_t collision_count) const = 0;
+};
+
+// no roulette: walks end by escaping or at the maximum walk length, which then truncates the estimates
+// (the behavior of the original implementation, with a maximum walk length of 10)
+class NoRoulette : public RoulettePolicy
+{
+public:
+    virtual double survivalProbability(const double throughput, const size_t collision_count) const
+    {
+        return 1.0;
+    }
+};
+
+// survival proportional to the throughput below a threshold: surviving walks continue with the threshold as throughput
+// after long_collisions collisions, walks survive with probability at most long_survival, so that walks whose
+// throughput does not decrease (dielectric, mirror, white Lambert) also end: by default, walks run as with the maximum
+// walk length of 10 of the original implementation, and the few longer walks last 1 / (1 - 0.8) = 5 more collisions on
+// average instead of running to MAX_WALK_LENGTH
+class ThroughputRoulette : public RoulettePolicy
+{
+public:
+    ThroughputRoulette(const double threshold = 0.1, const size_t min_collisions = 2, const size_t long_collisions = 10,
+                       const double long_survival = 0.8)
+        : m_threshold(threshold), m_min_collisions(min_collisions), m_long_collisions(long_collisions), m_long_survival(long_survival)
+    {
+    }
+
+    double m_threshold;
+    size_t m_min_collisions; // no roulette before this many collisions
+    size_t m_long_collisions;
+    double m_long_survival;
+
+    virtual double survivalProbability(const double throughput, const size_t collision_count) const
+    {
+        if (collision_count < m_min_collisions)
+            return 1.0;
+
+        const double survival = (throughput >= m_threshold) ? 1.0 : throughput / m_threshold;
+        return (collision_count >= m_long_collisions) ? std::min(survival, m_long_survival) : survival;
+    }
+};
+
+// constant survival probability after min_collisions collisions: bounds the expected walk length of facets whose
+// throughput does not decrease (dielectric, mirror, white Lambert)
+class ConstantRoulette : public RoulettePolicy
+{
+public:
+    ConstantRoulette(const double survival, const size_t min_collisions)
+        : m_survival(survival), m_min_collisions(min_collisions)
+    {
+    }
+
+    double m_survival;
+    size_t m_min_collisions;
+
+    virtual double survivalProbability(const double throughput, const size_t collision_count) const
+    {
+        return (collision_count < m_min_collisions) ? 1.0 : m_survival;
+    }
+};
+
+inline const RoulettePolicy *defaultRoulette()
+{
+    static const ThroughputRoulette roulette;
+    return &roulette;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Tail estimator
+//////////////////////////////////////////////////////////////////////////////////
+
+// number of bins of cos(theta) of the tail lobe, over [-1, 1]
+#define TAIL_BINS 32
+
+// options of the tail estimator of a Microsurface (disabled by default)
+struct MicrosurfaceTailOptions
+{
+    bool enabled = false;
+    size_t walks = 100000; // walks gathering the statistics at construction
+    double ior_i = 1.0;    // iors of the gathering walks (dielectric facets)
+    double ior_t = 1.0;
+    uint64_t seed = 1;
+};
+
+// statistics of the scattering orders above the maximum walk length K of a Microsurface, gathered once at
+// construction from untruncated sample walks (no roulette, cosine-distributed incident directions)
+// walks that reach K collisions add these higher orders from their state after K collisions instead of dropping them:
+// - the energy that eventually escapes, per unit throughput of the walk after K collisions, on each side of the
+//   microsurface (index 0 outside, 1 inside)
+// - the distribution of its escape directions (the tail lobe), tabulated over cos(theta) with a uniform azimuth:
+//   high scattering orders have mostly forgotten the incident direction
+// the compensated results are biased (an average tail replaces the tail of each walk), but keep the energy of the
+// untruncated walks on average over the incident directions
+struct MicrosurfaceTail
+{
+    bool enabled = false;
+
+    double eval_albedo[2] = {0.0, 0.0};         // per unit throughput of the walks after K collisions
+    double sample_albedo[2] = {0.0, 0.0};       // per unit throughput of the walks that collide again after K collisions
+    double collide_probability[2] = {0.0, 0.0}; // probability that a walk collides again after K collisions
+    double cdf[2][TAIL_BINS] = {};              // cumulative distribution of the bins of the tail lobe
+
+    static int bin(const double z)
+    {
+        return std::min(std::max(int((z + 1.0) * 0.5 * TAIL_BINS), 0), TAIL_BINS - 1);
+    }
+
+    // density per solid angle of the tail lobe on a side
+    template <class Float>
+    double density(const int side, const Vector3T<Float> &wo) const
+    {
+        const int b = bin(double(wo.z));
+        const double p = cdf[side][b] - ((b > 0) ? cdf[side][b - 1] : 0.0);
+        return p * TAIL_BINS / (4.0 * M_PI);
+    }
+
+    // sample the tail lobe of a side with three uniform numbers
+    Vector3 sample(const int side, const double u1, const double u2, const double u3) const
+    {
+        int b = 0;
+        while ((b < TAIL_BINS - 1) && !(u1 < cdf[side][b]))
+            b++;
+
+        const double z = std::min(std::max(-1.0 + (b + u2) * 2.0 / TAIL_BINS, -1.0), 1.0);
+        const double r = sqrt(std::max(0.0, 1.0 - z * z));
+        const double phi = 2.0 * M_PI * u3;
+        return Vector3(r * cos(phi), r * sin(phi), z);
+    }
+};
+
+// a batch of queries for Microsurface::evalBatch()/sampleBatch()
+// all arrays are caller-owned and hold 'count' elements; optional arrays may be null
+template <class Float>
+struct MicrosurfaceBatchT
+{
+    size_t count = 0;
+
+    Vector3Arrays<const Float> wi;
+    Vector3Arrays<const Float> wo; // eval only
+
+    // iors, either per query or shared by the whole batch
+    const Float *iors_i = 0;
+    const Float *iors_t = 0;
+    Float ior_i = 1.0;
+    Float ior_t = 1.0;
+
+    // optional input weights (throughput) that scale the result of each query
+    const Float *weights = 0;
+
+    // batches with a palette (see MicrosurfacePalette): material of each query, null for material i at query i
+    const uint32_t *materials = 0;
+
+    // query i runs as sampler.startQuery(first_query + i), so a batch can be split into sub-batches
+    // (across threads or processes) and reproduce the same results with a counter-based sampler
+    uint64_t first_query = 0;
+};
+
+typedef MicrosurfaceBatchT<double> MicrosurfaceBatch;
+
+// parameters of the materials of a batch (see Microsurface::evalBatch(batch, palette, ...)) as a structure of arrays,
+// each parameter either per material or shared by all materials (anisotropic roughness: give both arrays, the same
+// array for isotropic textures; conductor iors: monochromatic or per channel)
+template <class Float>
+struct MicrosurfacePaletteT
+{
+    const Float *roughnesses_x = 0;
+    const Float *roughnesses_y = 0;
+    const Float *gammas = 0;
+    const Float *etas = 0;
+    const Float *ks = 0;
+    const SpectrumT<Float> *eta_channels = 0;
+    const SpectrumT<Float> *k_channels = 0;
+    const Float *kds = 0;
+
+    // parameters without an array
+    MaterialParametersT<Float> shared;
+
+    MaterialParametersT<Float> get(const size_t material) const
+    {
+        MaterialParametersT<Float> parameters = shared;
+        if (roughnesses_x)
+            parameters.roughness_x = roughnesses_x[material];
+        if (roughnesses_y)
+            parameters.roughness_y = roughnesses_y[material];
+        if (gammas)
+            parameters.gamma = gammas[material];
+        if (etas)
+            parameters.eta = SpectrumT<Float>(etas[material]);
+        if (ks)
+            parameters.k = SpectrumT<Float>(ks[material]);
+        if (eta_channels)
+            parameters.eta = eta_channels[material];
+        if (k_channels)
+            parameters.k = k_channels[material];
+        if (kds)
+            parameters.kd = kds[material];
+        return parameters;
+    }
+};
+
+typedef MicrosurfacePaletteT<double> MicrosurfacePalette;
+
+// eval() walks recorded by Microsurface::evalRecord(), for re-evaluation at other parameters of the NDF (roughness,
+// shape, see Microsurface::evalRecorded()): per collision, the ray that reached it, the height and facet normal sampled
+// there, the weight of the walk, and the densities of these samples at the parameters of the recording
+template <class Float>
+struct MicrosurfaceRecordingT
+{
+    typedef Vector3T<Float> Vector3;
+
+    struct Collision
+    {
+        Vector3 wr = Vector3(0, 0, 1); // direction of the ray that reached the collision, in the frame of its side
+        Float h_start = 0.0;           // height the free path started from (at most 0)
+        Float hr = 0.0;                // height of the collision
+        bool outside = true;           // side of the collision
+        Vector3 wm = Vector3(0, 0, 1); // facet normal
+        Float weight = 1.0;            // weight of the walk at the collision (facet weights, roulette)
+        Float free_path_density = 0.0; // density of hr, given wr and h_start
+        Float normal_density = 0.0;    // density of wm, given wr (visible normals)
+    };
+
+    struct Walk
+    {
+        Float ior_i = 1.0;
+        Float ior_t = 1.0;
+        Vector3 wo = Vector3(0, 0, 1);
+        size_t first_collision = 0; // collisions[first_collision, first_collision + collision_count)
+        size_t collision_count = 0;
+
+        // walks that escaped after their last collision: the ray that left, and the probability that it left
+        bool escaped = false;
+        Vector3 escape_wr = Vector3(0, 0, 1);
+        Float escape_h_start = 0.0;
+        Float escape_probability = 1.0;
+    };
+
+    std::vector<Walk> walks;
+    std::vector<Collision> collisions;
+
+    void clear()
+    {
+        walks.clear();
+        collisions.clear();
+    }
+};
+
+typedef MicrosurfaceRecordingT<double> MicrosurfaceRecording;
+
+// parameters that Microsurface::evalDerivatives() can differentiate with respect to
+enum MicrosurfaceDerivative
+{
+    DERIVATIVE_ROUGHNESS_X = 0,
+    DERIVATIVE_ROUGHNESS_Y,
+    DERIVATIVE_GAMMA, // Student-T shape
+    DERIVATIVE_IOR,   // ior_t of the query (dielectric facets)
+    DERIVATIVE_ETA,   // conductor ior
+    DERIVATIVE_K,
+    DERIVATIVE_COUNT
+};
+
+// value as a dual number of the DualT<N> tier of Microsurface::evalDerivatives() whose partial i is the derivative with
+// respect to derivatives[i]: parameter d, or a constant if d is not among derivatives
+template <int N>
+inline DualT<N> derivativeParameter(const double value, const MicrosurfaceDerivative d, const MicrosurfaceDerivative (&derivatives)[N])
+{
+    DualT<N> result(value);
+    for (int i = 0; i < N; ++i)
+        result.d[i] = (derivatives[i] == d) ? 1.0 : 0.0;
+    return result;
+}
+
+// parameters as dual numbers (derivativeParameter()), for NDF::setParameters() and BSDF::setParameters() in the
+// DualT<N> tier (the diffuse albedo has no derivative; those of eta and k shift all the channels)
+// every operation of the walk carries the N partials, so derivatives should only list the parameters of the material,
+// e.g. {DERIVATIVE_ROUGHNESS_X, DERIVATIVE_ROUGHNESS_Y} for a GGX dielectric at a fixed ior
+template <int N>
+inline MaterialParametersT<DualT<N>> derivativeParameters(const MaterialParameters &parameters, const MicrosurfaceDerivative (&derivatives)[N])
+{
+    MaterialParametersT<DualT<N>> result;
+    result.roughness_x = derivativeParameter(parameters.roughness_x, DERIVATIVE_ROUGHNESS_X, derivatives);
+    result.roughness_y = derivativeParameter(parameters.roughness_y, DERIVATIVE_ROUGHNESS_Y, derivatives);
+    result.gamma = derivativeParameter(parameters.gamma, DERIVATIVE_GAMMA, derivatives);
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+    {
+        result.eta[c] = derivativeParameter(parameters.eta[c], DERIVATIVE_ETA, derivatives);
+        result.k[c] = derivativeParameter(parameters.k[c], DERIVATIVE_K, derivatives);
+    }
+    result.kd = parameters.kd;
+    return result;
+}
+
+// effective sample size of count walks weighted by ratios (e.g. the out_ratio of Microsurface::evalRecorded() for the
+// walks of a recording): (sum of the ratios)^2 / (sum of their squares), at most count; a small fraction of count means
+// that a few walks carry the estimate, i.e. that the parameters are too far from those of the recording for reuse
+template <class Float>
+inline Float effectiveSampleSize(const Float *ratios, const size_t count)
+{
+    Float sum = 0.0;
+    Float sum2 = 0.0;
+    for (size_t n = 0; n < count; ++n)
+    {
+        sum += ratios[n];
+        sum2 += ratios[n] * ratios[n];
+    }
+    return (sum2 > 0.0) ? sum * sum / sum2 : 0.0;
+}
+
+// stopping rule of Microsurface::evalAdaptive(): walks run until the standard error of the mean reaches
+// relative_error * |mean| or absolute_error, or until the budget of walks or seconds runs out
+struct MicrosurfaceAdaptiveOptions
+{
+    double relative_error = 0.01;
+    double absolute_error = 0.0;
+    size_t min_walks = 256; // before the first test of the error (more for heavy-tailed values)
+    size_t max_walks = size_t(1) << 20;
+    double max_seconds = 0.0; // no time budget if zero
+
+    // walk n of the estimate runs as sampler.startQuery(first_query + n), control walk n (see
+    // MicrosurfaceAdaptiveRun) as sampler.startQuery(first_query + max_walks + n)
+    uint64_t first_query = 0;
+};
+
+// mean of the walks of an adaptive estimate, its standard error and the number of walks
+struct MicrosurfaceEstimate
+{
+    double mean = 0.0;
+    double error = 0.0;
+    size_t walks = 0;
+    double m2 = 0.0; // sum of squared deviations from the mean (Welford)
+
+    void add(const double value)
+    {
+        walks++;
+        const double delta = value - mean;
+        mean += delta / double(walks);
+        m2 += delta * (value - mean);
+        error = (walks > 1) ? sqrt(m2 / double(walks - 1) / double(walks)) : 0.0;
+    }
+
+    // number of walks that the mean of the same estimator needs to reach the error target of options, predicted from
+    // the variance of these walks
+    size_t walksNeeded(const MicrosurfaceAdaptiveOptions &options) const
+    {
+        if (walks < options.min_walks)
+            return options.min_walks;
+
+        // all walks returned the same value (e.g. single scattering in closed form, and no walk scattered twice):
+        // contributions of probability up to 3 / walks may still be unseen (rule of three)
+        if (m2 == 0.0)
+            return (options.relative_error > 0.0) ? std::min(std::max(size_t(ceil(3.0 / options.relative_error)), options.min_walks), options.max_walks) : options.max_walks;
+
+        const double target = std::max(options.relative_error * std::abs(mean), options.absolute_error);
+        const double needed = (target > 0.0) ? m2 / double(walks - 1) / (target * target) : double(options.max_walks);
+        return std::min(std::max(size_t(std::min(ceil(needed), double(options.max_walks))), options.min_walks), options.max_walks);
+    }
+};
+
+// the rounds of walks of an adaptive estimate
+// the stopping rule looks at control walks, which are not part of the estimate: stopping on the walks of the
+// estimate biases it low when rare walks carry much of the value (the estimates that stop early are those that
+// missed them, e.g. -6% for a grazing reflection of a rough dielectric at 2% relative error)
+// there is one control walk for every four walks of the estimate (at least min_walks)
+struct MicrosurfaceAdaptiveRun
+{
+    MicrosurfaceAdaptiveRun(const MicrosurfaceAdaptiveOptions &in_options)
+        : options(in_options), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    MicrosurfaceAdaptiveOptions options;
+    std::chrono::steady_clock::time_point start;
+    MicrosurfaceEstimate estimate, control;
+
+    // the next round of walks: out_count walks from query out_first_query, for the control if out_control
+    // returns false when done
+    bool next(uint64_t &out_first_query, size_t &out_count, bool &out_control) const
+    {
+        if ((options.max_seconds > 0.0) && (estimate.walks > 0) &&
+            (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= options.max_seconds))
+            return false;
+
+        const size_t control_walks = std::max(options.min_walks, estimate.walks / 4);
+        if (control.walks < control_walks)
+        {
+            out_control = true;
+            out_first_query = options.first_query + options.max_walks + control.walks;
+            out_count = control_walks - control.walks;
+            return true;
+        }
+
+        // at most double the walks of the estimate per round, so that an early variance estimate cannot overshoot
+        const size_t needed = control.walksNeeded(options);
+        if (estimate.walks >= needed)
+            return false;
+
+        out_control = false;
+        out_first_query = options.first_query + estimate.walks;
+        out_count = std::min(needed - estimate.walks, std::max(estimate.walks, options.min_walks));
+        return true;
+    }
+
+    void add(const bool control_walk, const double value)
+    {
+        (control_walk ? control : estimate).add(value);
+    }
+};
+
+// state of one random walk through a Microsurface, advanced one collision at a time by Microsurface::step()
+// (Microsurface::sample() and eval() loop over step(); WalkScheduler interleaves many walks)
+// (the status of a walk does not depend on the precision tier of its microsurface)
+struct MicrosurfaceWalkStatus
+{
+    enum Status
+    {
+        WALK_ACTIVE,    // still inside the microsurface
+        WALK_ESCAPED,   // left the microsurface (or the tail estimator), wr/outside hold the exit direction
+        WALK_TRUNCATED, // reached the maximum number of collisions
+        WALK_ABSORBED,  // ended by Russian roulette
+        WALK_FAILED     // NaN (should not happen, just in case)
+    };
+};
+
+template <class Float>
+struct MicrosurfaceWalkT : public MicrosurfaceWalkStatus
+{
+    typedef Vector3T<Float> Vector3;
+
+    Status status = WALK_ACTIVE;
+
+    // iors on the two sides of the microsurface
+    Float ior_i = 1.0;
+    Float ior_t = 1.0;
+
+    // ray
+    Vector3 wr = Vector3(0, 0, 1); // direction of the ray
+    Float hr = 0.0;               // height of the ray
+    bool outside = true;           // side of the microsurface
+    Float weight = 1.0;           // throughput
+    Float throughput = 1.0;       // throughput without the input weight, for the roulette
+    size_t collision_count = 0;
+    uint64_t walk_domain = 0; // sampler dimension domain
+
+    // current collision (valid after collide() returned true)
+    Vector3 wm = Vector3(0, 0, 1); // microfacet normal
+    const BSDFT<Float> *facet_bsdf = 0;
+
+    // next event estimation towards wo (eval walks, and sample walks started by startSampleAndEvalWalk())
+    bool evaluating = false; // eval walk: ends after m_max_walk_length collisions
+    bool estimating = false;
+    Vector3 wo = Vector3(0, 0, 1);
+    Float sigma_wo = 0.0; // cross section shadowing the upward-facing version of wo
+    Float sum = 0.0;
+    Float *orders = 0;     // optional: sum split by scattering order (Microsurface::evalOrders())
+    size_t order_count = 0; // orders[k - 1] gathers collision k, orders[order_count - 1] all higher orders too
+
+    // densities of the walk (optional, Microsurface::pdf() and sampleMIS())
+    bool tracking_pdf = false;         // pdf: sum over the collisions of the densities of scattering towards wo and escaping
+    bool tracking_scatter_pdf = false; // scatter_pdf: density with which the last collision scattered the ray to its
+                                       // direction and let it escape
+    Float pdf = 0.0;
+    Float scatter_pdf = 0.0;
+    Float light_pdf = -1.0; // evalMIS(): density of the light sampling technique towards wo
+
+    // per-channel throughput and estimate (Microsurface::sampleSpectrum() and evalSpectrum()): weight, throughput and
+    // sum stay the channel average of the walk for the roulette
+    bool spectral = false;
+    SpectrumT<Float> spectral_weight = SpectrumT<Float>(1.0);
+    SpectrumT<Float> spectral_sum = SpectrumT<Float>(0.0);
+
+    // dispersive walks (Microsurface::sampleDispersive() and evalDispersive(), spectral): the walk follows the ior of
+    // the hero channel (ior_t = iors_t[hero]), spectral_weight holds the value of the walk for each channel over its
+    // density for the hero, and hero_ratios the density of the walk for each channel over its density for the hero
+    bool dispersive = false;
+    int hero = 0;
+    SpectrumT<Float> iors_t = SpectrumT<Float>(1.0);
+    SpectrumT<Float> hero_ratios = SpectrumT<Float>(1.0);
+};
+
+typedef MicrosurfaceWalkT<double> MicrosurfaceWalk;
+
+// the Microsurface operator: turns an NDF, and the BSDF on its facets, into a rough BSDF
+// NDFType and FacetBSDF are the static types of the NDF and of the facet BSDF: Microsurface (NDF, BSDF) calls them
+// through virtual functions; with concrete final types, e.g. MicrosurfaceOperator<GGXNDF, ConductorBRDF>, the compiler
+// can inline the NDF and facet calls of the whole walk (FacetBSDF other than BSDF requires a uniform microsurface,
+// whose facets all carry the BSDF of the NDF)
+// NB: the walk is dominated by transcendental functions, so the specialized walk runs at about the speed of
+//     Microsurface (see test/benchmarks/bench_static.cpp)
+template <class NDFType, class FacetBSDF>
+class MicrosurfaceOperator : public BSDFT<typename NDFType::Scalar>
 {
 public:
+    // precision tier of the NDF (see vector.h)
+    typedef typename NDFType::Scalar Float;
+    typedef Vector3T<Float> Vector3;
+    typedef SpectrumT<Float> Spectrum;
+    typedef BSDFT<Float> BSDF;
+    typedef NDFT<Float> NDF;
+    typedef MicrosurfaceWalkT<Float> MicrosurfaceWalk;
+    typedef MicrosurfaceBatchT<Float> MicrosurfaceBatch;
+    typedef MicrosurfacePaletteT<Float> MicrosurfacePalette;
+    typedef MaterialParametersT<Float> MaterialParameters;
+    typedef MicrosurfaceRecordingT<Float> MicrosurfaceRecording;
+
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+    using BSDF::sampleSpectrum;
+    using BSDF::evalSpectrum;
+    using BSDF::evalSingularSpectrum;
+
     size_t m_max_walk_length = MAX_WALK_LENGTH;
-    const NDF *m_ndf;
+    const NDFType *m_ndf;
+    const RoulettePolicy *m_roulette;
+    MicrosurfaceTail m_tail;
+
+    // closed-form single scattering through the singular lobes of the facet BSDF (uniform microsurfaces only, see
+    // singleScatteringShadowing()): the walk only estimates the higher orders of these lobes
+    bool m_analytic_single_scattering;
+
+    // lobes of the facet BSDF (see BSDF::lobes()): next event estimation skips the lobes that the facets do not have
+    unsigned m_facet_lobes;
+
+    // smooth limit: a microsurface whose NDF roughness() is at most m_smooth_roughness scatters as its facet BSDF
+    // about the macro normal, without a random walk (see smoothLimit()); 0 keeps the walk for all but flat NDFs
+    Float m_smooth_roughness = SMOOTH_ROUGHNESS;
+
+    // with tail.enabled, walks that reach max_walk_length collisions add the higher scattering orders from statistics
+    // gathered here (see MicrosurfaceTail), e.g. to run 3 or 4 collisions at near-converged energy
+    MicrosurfaceOperator(NDFType *ndf, size_t max_walk_length = MAX_WALK_LENGTH, const RoulettePolicy *roulette = defaultRoulette(),
+                         const MicrosurfaceTailOptions &tail = MicrosurfaceTailOptions())
+        : m_max_walk_length(max_walk_length), m_ndf(ndf), m_roulette(roulette), m_analytic_single_scattering(ndf->uniformMicrosurface()),
+          m_facet_lobes(ndf->m_bsdf->lobes())
+    {
+        assert((std::is_same<FacetBSDF, BSDF>::value) || (ndf->uniformMicrosurface() && dynamic_cast<const FacetBSDF *>(ndf->m_bsdf)));
+
+        if (tail.enabled)
+            gatherTail(ndf, tail);
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, Sampler &sampler) const {
+        MicrosurfaceWalk walk;
+        startSampleWalk(walk, ior_i, ior_t, wi, io_weight, sampler);
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return sampleResult(walk, io_weight);
+    }
+
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const {
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return evalResult(walk);
+    }
+
+    // sample() and eval() per channel, for facet BSDFs with colored values (see BSDF::sampleSpectrum()): one walk
+    // carries all the channels, since the directions of the walk do not depend on them
+    // the roulette sees the channel average of the throughput (each channel stays unbiased)
+    virtual Vector3 sampleSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleWalk(walk, ior_i, ior_t, wi, io_weight.average(), sampler);
+        walk.spectral = true;
+        walk.spectral_weight = io_weight;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return sampleSpectrumResult(walk, io_weight);
+    }
+
+    virtual Spectrum evalSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+        walk.spectral = true;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return evalSpectrumResult(walk);
+    }
+
+    // sampleSpectrum() and evalSpectrum() for a dispersive facet BSDF (e.g. DielectricBSDF with an ior that depends on
+    // the wavelength): iors_t holds the ior of the transmitted side for each channel (one wavelength per channel)
+    // one walk follows the ior of a hero channel, picked at random; the other channels share its decisions, reweighted
+    // at each collision by their phase function over that of the hero (Fresnel terms for reflections, the Fresnel
+    // terms, visible normals and Jacobian of their own refraction for refractions), and spectral MIS over the choice
+    // of the hero (balance heuristic) divides each channel by the average density of the walk over the channels, so
+    // that channels whose refracted directions diverge from the hero keep a bounded, unbiased weight
+    // requires a uniform microsurface whose facet BSDF only has singular lobes (see BSDF::lobes())
+    Vector3 sampleDispersive(const Float ior_i, const Spectrum &iors_t, const Vector3 &wi, Spectrum &io_weight, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleWalk(walk, ior_i, iors_t[0], wi, io_weight.average(), sampler);
+        startDispersiveWalk(walk, iors_t, sampler);
+        walk.spectral_weight = io_weight;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return sampleSpectrumResult(walk, io_weight);
+    }
+
+    Spectrum evalDispersive(const Float ior_i, const Spectrum &iors_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, iors_t[0], wi, wo, sampler);
+        startDispersiveWalk(walk, iors_t, sampler);
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return evalSpectrumResult(walk);
+    }
+
+    // unbiased estimate of the density of the directions returned by sample() (the walk of one eval())
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        Float pdf = 0.0;
+        eval(ior_i, ior_t, wi, wo, pdf, sampler);
+        return pdf;
+    }
+
+    // eval() and an unbiased estimate of pdf(wi, wo) (out_pdf) from the same walk
+    Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Float &out_pdf, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+        walk.tracking_pdf = true;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        out_pdf = (walk.status == MicrosurfaceWalk::WALK_FAILED) ? 0.0 : walk.pdf;
+        return evalResult(walk);
+    }
+
+    // multiple importance sampling against a light sampling technique, one walk per sample:
+    // the weights are applied per collision of the walk, where the density of every technique is known exactly
+    // - sampleMIS(): sample() that also returns the density with which the last collision of the walk scattered towards
+    //   the returned direction and let it escape (out_pdf): weight the sample by out_pdf / (out_pdf + light_pdf(wo))
+    // - evalMIS(): eval() of a direction sampled by the light technique with density light_pdf, weighted per collision
+    //   by light_pdf / (light_pdf + density of that collision), so that the two estimates add up to eval()
+    // (balance heuristic; the singular and non-singular lobes of the facet BSDF are weighted separately)
+    Vector3 sampleMIS(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, Float &out_pdf, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleWalk(walk, ior_i, ior_t, wi, io_weight, sampler);
+        walk.tracking_scatter_pdf = true;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        out_pdf = (walk.status == MicrosurfaceWalk::WALK_ESCAPED) ? walk.scatter_pdf : 0.0;
+        return sampleResult(walk, io_weight);
+    }
+
+    Float evalMIS(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const Float light_pdf, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+        walk.light_pdf = light_pdf;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return evalResult(walk);
+    }
+
+    // sample() and eval() towards a second direction wl (e.g. towards a light) with one walk: the walk of sample() also
+    // runs the next event estimation of eval(wi, wl) at its first m_max_walk_length collisions, which see the same
+    // distribution of collisions as an eval() walk
+    // returns the sampled direction and io_weight as sample(), and out_value as eval(wi, wl) (both unbiased, correlated)
+    // out_pdf (optional): unbiased estimate of pdf(wi, wl), as eval(..., out_pdf, sampler)
+    Vector3 sampleAndEval(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, const Vector3 &wl,
+                          Float &out_value, Sampler &sampler, Float *out_pdf = 0) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleAndEvalWalk(walk, ior_i, ior_t, wi, wl, sampler);
+        walk.tracking_pdf = (out_pdf != 0);
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        return sampleAndEvalResult(walk, io_weight, out_value, out_pdf);
+    }
+
+    // sampleMIS() and evalMIS(wi, wl, light_pdf) with one walk, as sampleAndEval()
+    Vector3 sampleAndEvalMIS(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, Float &out_pdf,
+                             const Vector3 &wl, const Float light_pdf, Float &out_value, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleAndEvalWalk(walk, ior_i, ior_t, wi, wl, sampler);
+        walk.tracking_scatter_pdf = true;
+        walk.light_pdf = light_pdf;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        out_pdf = (walk.status == MicrosurfaceWalk::WALK_ESCAPED) ? walk.scatter_pdf : 0.0;
+        return sampleAndEvalResult(walk, io_weight, out_value, 0);
+    }
+
+    // eval() split by scattering order, from one walk: out_orders[k - 1] is the contribution of the k-th collision
+    // (single scattering first); out_orders[order_count - 1] also gathers all higher orders, and the tail estimator
+    // returns the value of eval(), the sum of the orders
+    Float evalOrders(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, const size_t order_count,
+                      Float *out_orders, Sampler &sampler) const
+    {
+        assert(order_count > 0);
+        for (size_t k = 0; k < order_count; ++k)
+            out_orders[k] = 0.0;
+
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+        walk.orders = out_orders;
+        walk.order_count = order_count;
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        if (walk.status == MicrosurfaceWalk::WALK_FAILED)
+        {
+            for (size_t k = 0; k < order_count; ++k)
+                out_orders[k] = 0.0;
+        }
+        return evalResult(walk);
+    }
+
+    // sample() that also returns the scattering order of the sample (out_order, its number of collisions: 0 if the
+    // weight is zero, m_max_walk_length + 1 for samples of the tail estimator)
+    Vector3 sampleOrder(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &io_weight, size_t &out_order, Sampler &sampler) const
+    {
+        MicrosurfaceWalk walk;
+        startSampleWalk(walk, ior_i, ior_t, wi, io_weight, sampler);
+
+        // random walk
+        while (step(walk, sampler))
+            ;
+
+        const Vector3 wo = sampleResult(walk, io_weight);
+        out_order = (io_weight == 0.0) ? 0 : walk.collision_count;
+        return wo;
+    }
+
+    // eval() as the sum of two walks that sample the same paths from either end (bidirectional): the walk of eval(wi, wo),
+    // which enters along -wi and connects each collision to wo, and the walk of eval(wo, wi), which enters along -wo and
+    // connects each collision to wi; by reciprocity, the reversed paths of the second walk contribute
+    //   eval(wi, wo) = eval(wo, wi) |wo.z| / wi.z (eta_o / eta_i)^2
+    // (eta_o: ior on the side of wo; eval() includes the cosine of wo)
+    // each connection is weighted by the balance heuristic over the densities of its path by the two walks (see
+    // bidirectionalWalk()); the closed-form single scattering of the singular lobes only comes from the first walk
+    // next event estimation towards a grazing direction has a high variance (the shadowing of the connection varies a lot
+    // with the height of the collision): the balance heuristic gives these paths to the walk that enters along it
+    // uniform microsurfaces without smooth limit or tail, with facet BSDFs of singular lobes only or of smooth lobes only;
+    // the walks of other NDFs do not sample the densities of sigma() and D_wi() (null collisions), and other facet BSDFs
+    // mix lobes with and without the facet normal of the collision: these run eval()
+    Float evalBidirectional(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        if ((wi.z <= 0) || (wo.z == 0))
+            return 0.0;
+
+        const bool mixed_lobes = (m_facet_lobes & LOBE_SMOOTH) && (m_facet_lobes & (LOBE_DELTA_REFLECTION | LOBE_DELTA_TRANSMISSION));
+        if (!m_ndf->uniformMicrosurface() || smoothLimit() || m_tail.enabled || mixed_lobes)
+            return eval(ior_i, ior_t, wi, wo, sampler);
+
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+        const Float forward = bidirectionalWalk(walk, wo, true, sampler);
+
+        MicrosurfaceWalk reverse_walk;
+        startReverseEvalWalk(reverse_walk, ior_i, ior_t, wi, wo, sampler);
+        const Float reverse = bidirectionalWalk(reverse_walk, wi, false, sampler);
+
+        using std::abs;
+        const Float eta_o = (wo.z > 0) ? ior_i : ior_t;
+        return forward + reverse * abs(wo.z) / wi.z * (eta_o * eta_o) / (ior_i * ior_i);
+    }
+
+
+    // eval() with as many walks as needed to reach the error target of options (see MicrosurfaceAdaptiveOptions):
+    // easy directions stop after a few walks, grazing or transmitted directions run more
+    // the walks run in rounds, the stopping rule is tested between rounds (see MicrosurfaceAdaptiveRun); to run directions
+    // in parallel, give each thread its own sampler (with a PhiloxSampler, the estimate does not depend on the thread)
+    MicrosurfaceEstimate evalAdaptive(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                                      const MicrosurfaceAdaptiveOptions &options, Sampler &sampler) const
+    {
+        MicrosurfaceAdaptiveRun run(options);
+        uint64_t first_query;
+        size_t count;
+        bool control;
+        while (run.next(first_query, count, control))
+        {
+            for (size_t n = 0; n < count; ++n)
+            {
+                sampler.startQuery(first_query + n);
+                run.add(control, double(eval(ior_i, ior_t, wi, wo, sampler)));
+            }
+        }
+        return run.estimate;
+    }
+
+    // eval() that also appends its walk to recording, for evalRecorded() at other parameters of the NDF (uniform
+    // microsurfaces, whose free paths and facet normals follow sigma() and D_wi(), without smooth limit or tail)
+    Float evalRecord(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, MicrosurfaceRecording &recording,
+                     Sampler &sampler) const
+    {
+        assert(m_ndf->uniformMicrosurface() && !smoothLimit() && !m_tail.enabled);
+
+        typename MicrosurfaceRecording::Walk recorded;
+        recorded.ior_i = ior_i;
+        recorded.ior_t = ior_t;
+        recorded.wo = wo;
+        recorded.first_collision = recording.collisions.size();
+
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+
+        // step(), recording each collision with the free path that reached it
+        Float h_start = 0.0;
+        while (true)
+        {
+            h_start = std::min(Float(0), walk.hr);
+            const Vector3 wr = walk.wr;
+            if (!collide(walk, sampler))
+                break;
+
+            typename MicrosurfaceRecording::Collision collision;
+            collision.wr = wr;
+            collision.h_start = h_start;
+            collision.hr = walk.hr;
+            collision.outside = walk.outside;
+            collision.wm = walk.wm;
+            collision.weight = walk.weight;
+            collision.free_path_density = freePathDensity(wr, h_start, walk.hr);
+            collision.normal_density = m_ndf->D_wi(-wr, walk.wm);
+            recording.collisions.push_back(collision);
+            recorded.collision_count++;
+
+            if (walk.collision_count < m_max_walk_length)
+                nextEventEstimation(walk, sampler);
+
+            if (!scatter(walk, sampler))
+                break;
+        }
+
+        if (walk.status == MicrosurfaceWalk::WALK_ESCAPED && recorded.collision_count > 0)
+        {
+            recorded.escaped = true;
+            recorded.escape_wr = walk.wr;
+            recorded.escape_h_start = h_start;
+            recorded.escape_probability = escapeProbability(walk.wr, h_start);
+        }
+        recording.walks.push_back(recorded);
+
+        return evalResult(walk);
+    }
+
+    // eval() of walk n of recording (see evalRecord(), by a microsurface with the same max_walk_length and facet BSDF,
+    // and an NDF of the same type) at the parameters of the NDF of this microsurface, without sampling a new walk:
+    // the next event estimation of each collision is weighted by the ratio of the densities, here and at the
+    // recording, of the free paths and facet normals that led to it (the facet normal of the collision too for the
+    // lobes that use it)
+    // out_ratio (optional): the ratio of the densities of the whole walk (see effectiveSampleSize())
+    Float evalRecorded(const MicrosurfaceRecording &recording, const size_t n, Sampler &sampler, Float *out_ratio = 0) const
+    {
+        assert(m_ndf->uniformMicrosurface() && !m_tail.enabled);
+
+        const typename MicrosurfaceRecording::Walk &recorded = recording.walks[n];
+        const Vector3 &wo = recorded.wo;
+        const Float sigma_wo = m_ndf->sigma((wo.z > 0) ? -wo : wo);
+
+        // the state of each collision, for nextEventLobes()
+        MicrosurfaceWalk walk;
+        walk.ior_i = recorded.ior_i;
+        walk.ior_t = recorded.ior_t;
+        walk.facet_bsdf = m_ndf->m_bsdf;
+        walk.evaluating = true;
+        walk.estimating = true;
+
+        Float sum = 0.0;
+        Float ratio = 1.0;
+        for (size_t k = 0; k < recorded.collision_count; ++k)
+        {
+            const typename MicrosurfaceRecording::Collision &collision = recording.collisions[recorded.first_collision + k];
+            const Float path_ratio = ratio * freePathDensity(collision.wr, collision.h_start, collision.hr) / collision.free_path_density;
+            const Float normal_ratio = m_ndf->D_wi(-collision.wr, collision.wm) / collision.normal_density;
+
+            if (k < m_max_walk_length)
+            {
+                walk.wr = collision.wr;
+                walk.hr = collision.hr;
+                walk.outside = collision.outside;
+                walk.wm = collision.wm;
+                walk.collision_count = k;
+
+                Float values[2];
+                nextEventLobes<Float>(walk, wo, sigma_wo, sampler, values, 0);
+
+                // the closed-form single scattering does not use the height of the first collision
+                const Float singular_ratio = (m_analytic_single_scattering && (k == 0)) ? ratio : path_ratio;
+                const Float I = collision.weight * (singular_ratio * values[0] + path_ratio * normal_ratio * values[1]);
+                if (IsFiniteNumber(I))
+                    sum += I;
+            }
+
+            ratio = path_ratio * normal_ratio;
+        }
+
+        if (recorded.escaped)
+            ratio *= escapeProbability(recorded.escape_wr, recorded.escape_h_start) / recorded.escape_probability;
+
+        if (out_ratio)
+            *out_ratio = ratio;
+        return sum;
+    }
+
+    // eval() and its derivatives with respect to the parameters of the NDF and of the facet BSDF, and to the iors, in one
+    // walk: in a DualT<N> tier (see derivativeParameters(); iors from derivativeParameter()), the value is that of eval()
+    // and the derivatives are those of its expectation
+    // the walk is sampled as by eval(), its heights and directions held fixed: each next event estimation adds its own
+    // derivative, and its value times the derivative of the log density of the free paths and facet scattering that led
+    // to it (likelihood ratio, as evalRecorded() at nearby parameters)
+    // uniform microsurfaces without smooth limit or tail, with facet BSDFs of singular lobes only (conductor,
+    // dielectric, mirror; marginalized over the facet normals, so that the iors may move the refracted directions) or
+    // of smooth lobes only (Lambert)
+    Float evalDerivatives(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        assert(m_ndf->uniformMicrosurface() && !smoothLimit() && !m_tail.enabled);
+        assert(!(m_facet_lobes & LOBE_SMOOTH) || !(m_facet_lobes & (LOBE_DELTA_REFLECTION | LOBE_DELTA_TRANSMISSION)));
+
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, wo, sampler);
+
+        Float sum = 0.0;
+        Float ratio = 1.0; // value 1, derivatives: those of the log density of the walk so far
+        while (true)
+        {
+            const Float h_start = detached(std::min(Float(0), walk.hr));
+            const Vector3 wr = detached(walk.wr);
+            const bool outside = walk.outside;
+            if (!collide(walk, sampler))
+                break;
+            walk.hr = detached(walk.hr);
+            walk.wm = detached(walk.wm);
+
+            const Float path_ratio = ratio * logDerivative(freePathDensity(wr, h_start, walk.hr));
+            if (walk.collision_count < m_max_walk_length)
+            {
+                Float values[2];
+                nextEventLobes<Float>(walk, wo, walk.sigma_wo, sampler, values, 0);
+
+                // the closed-form single scattering does not use the height of the first collision
+                const Float singular_ratio = (m_analytic_single_scattering && (walk.collision_count == 0)) ? ratio : path_ratio;
+                const Float smooth_ratio = (m_facet_lobes & LOBE_SMOOTH) ? path_ratio * logDerivative(m_ndf->D_wi(-wr, walk.wm)) : Float(0);
+                const Float I = detached(walk.weight) * (singular_ratio * values[0] + smooth_ratio * values[1]);
+                if (IsFiniteNumber(I))
+                    sum += I;
+            }
+
+            const MicrosurfaceWalk collision = walk;
+            if (!scatter(walk, sampler))
+                break;
+            walk.wr = detached(walk.wr);
+            walk.hr = detached(walk.hr);
+
+            // density of the scattered direction: marginalized over the facet normals for singular lobes, else with the
+            // facet normal of the collision
+            if (m_facet_lobes & LOBE_SMOOTH)
+            {
+                const Vector3 wo_facet = (walk.outside == outside) ? walk.wr : -walk.wr;
+                ratio = path_ratio * logDerivative(m_ndf->D_wi(-wr, collision.wm) *
+                                                   facetEval(collision, outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, wo_facet, sampler, &sum));
+            }
+            else
+                ratio = path_ratio * logDerivative(singularPhaseFunction(collision, outside ? -wr : wr, walk.outside ? walk.wr : -walk.wr,
+                                                                         outside, walk.outside, 0, &sum));
+        }
+
+        return (walk.status == MicrosurfaceWalk::WALK_FAILED) ? Float(0) : sum;
+    }
+
+    // eval() for many outgoing directions along one shared random walk: the walk (free paths, facet sampling)
+    // does not depend on wo, only the next event estimation at each collision does
+    virtual void evalMany(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 *wo, const size_t count,
+                          Float *out_value, Sampler &sampler) const
+    {
+        evalMany(ior_i, ior_t, wi, wo, count, out_value, 0, 0, sampler);
+    }
+
+    // evalMany() that also splits the value of each direction by scattering order, as evalOrders():
+    // out_orders[j * order_count + k - 1] is the contribution of the k-th collision to out_value[j]
+    void evalMany(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 *wo, const size_t count,
+                  Float *out_value, const size_t order_count, Float *out_orders, Sampler &sampler) const
+    {
+        for (size_t j = 0; j < count; ++j)
+            out_value[j] = 0.0;
+        for (size_t j = 0; j < count * order_count; ++j)
+            out_orders[j] = 0.0;
+
+        MicrosurfaceWalk walk;
+        startEvalWalk(walk, ior_i, ior_t, wi, sampler);
+        if (walk.status != MicrosurfaceWalk::WALK_ACTIVE)
+            return;
+
+        if (smoothLimit())
+        {
+            for (size_t j = 0; j < count; ++j)
+            {
+                out_value[j] = evalFlat(walk, wo[j], sampler);
+                if (out_orders)
+                    out_orders[j * order_count] = out_value[j];
+            }
+            return;
+        }
+
+        // the cross sections shadowing each wo are the same at every collision
+        std::vector<Float> sigma_wo(count);
+        for (size_t j = 0; j < count; ++j)
+            sigma_wo[j] = m_ndf->sigma((wo[j].z > 0) ? -wo[j] : wo[j]);
+
+        // random walk
+        while (collide(walk, sampler))
+        {
+            const size_t order = std::min(walk.collision_count, order_count - 1);
+            for (size_t j = 0; j < count; ++j)
+            {
+                const Float I = nextEventEstimation(walk, wo[j], sigma_wo[j], sampler);
+                out_value[j] += I;
+                if (out_orders)
+                    out_orders[j * order_count + order] += I;
+            }
+
+            if (!scatter(walk, sampler))
+                break;
+        }
+
+        if (walk.status == MicrosurfaceWalk::WALK_FAILED)
+        {
+            for (size_t j = 0; j < count; ++j)
+                out_value[j] = 0.0;
+            for (size_t j = 0; j < count * order_count; ++j)
+                out_orders[j] = 0.0;
+        }
+        else if (m_tail.enabled && (walk.status == MicrosurfaceWalk::WALK_TRUNCATED))
+        {
+            const size_t order = std::min(walk.collision_count, order_count - 1);
+            for (size_t j = 0; j < count; ++j)
+            {
+                const Float I = tailEstimation(walk, wo[j]);
+                out_value[j] += I;
+                if (out_orders)
+                    out_orders[j * order_count + order] += I;
+            }
+        }
+    }
+
+    // batched eval: out_value[i] = weight[i] * eval(wi[i], wo[i])
+    void evalBatch(const MicrosurfaceBatch &batch, Float *out_value, Sampler &sampler) const
+    {
+        for (size_t i = 0; i < batch.count; ++i)
+            out_value[i] = evalQuery(batch, i, sampler);
+    }
+
+    // batched sample: out_wo[i] and out_weight[i] = weight[i] * (sample weight)
+    void sampleBatch(const MicrosurfaceBatch &batch, const Vector3Arrays<Float> &out_wo, Float *out_weight, Sampler &sampler) const
+    {
+        for (size_t i = 0; i < batch.count; ++i)
+            out_weight[i] = sampleQuery(batch, i, out_wo, sampler);
+    }
+
+    // batches of spatially varying materials: query i first sets the parameters of material batch.materials[i] of the
+    // palette (material i without batch.materials) on ndf and facet, the NDF and facet BSDF of this microsurface
+    // (see NDF::setParameters() and BSDF::setParameters()), so that one microsurface runs all the materials without
+    // constructing objects; consecutive queries of the same material set it once (sort the batch by material)
+    // NB: the microsurface then serves one thread at a time (give each thread its own microsurface, NDF and facet);
+    //     the statistics of the tail estimator are not per material (microsurfaces with a tail are not supported)
+    void evalBatch(const MicrosurfaceBatch &batch, const MicrosurfacePalette &palette, NDFType &ndf, FacetBSDF &facet, Float *out_value,
+                   Sampler &sampler) const
+    {
+        assert((&ndf == m_ndf) && (&facet == flatFacet()) && !m_tail.enabled);
+
+        size_t material = size_t(-1);
+        for (size_t i = 0; i < batch.count; ++i)
+        {
+            setMaterial(batch, i, palette, ndf, facet, material);
+            out_value[i] = evalQuery(batch, i, sampler);
+        }
+    }
+
+    void sampleBatch(const MicrosurfaceBatch &batch, const MicrosurfacePalette &palette, NDFType &ndf, FacetBSDF &facet,
+                     const Vector3Arrays<Float> &out_wo, Float *out_weight, Sampler &sampler) const
+    {
+        assert((&ndf == m_ndf) && (&facet == flatFacet()) && !m_tail.enabled);
+
+        size_t material = size_t(-1);
+        for (size_t i = 0; i < batch.count; ++i)
+        {
+            setMaterial(batch, i, palette, ndf, facet, material);
+            out_weight[i] = sampleQuery(batch, i, out_wo, sampler);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // random walk, one collision at a time
+    //////////////////////////////////////////////////////////////////////////////////
+
+    // start a walk for sample() from direction wi with throughput weight
+    void startSampleWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Float weight, Sampler &sampler) const
+    {
+        startWalk(walk, ior_i, ior_t, wi, weight, sampler);
+    }
+
+    // start a walk for eval() from direction wi, with next event estimation towards wo
+    void startEvalWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        startEvalWalk(walk, ior_i, ior_t, wi, sampler);
+        walk.wo = wo;
+
+        // the cross section shadowing wo is the same at every collision: compute it once per query
+        if (walk.status == MicrosurfaceWalk::WALK_ACTIVE)
+            walk.sigma_wo = m_ndf->sigma((wo.z > 0) ? -wo : wo);
+    }
+
+    // start a walk with the length of an eval() walk, for next event estimation towards directions given
+    // to nextEventEstimation() by the caller (step() estimates towards walk.wo)
+    void startEvalWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, Sampler &sampler) const
+    {
+        startWalk(walk, ior_i, ior_t, wi, 1.0, sampler);
+        walk.evaluating = true;
+        walk.estimating = true;
+        walk.sum = 0.0;
+
+        if (m_max_walk_length == 0)
+            walk.status = MicrosurfaceWalk::WALK_TRUNCATED;
+    }
+
+    // start the walk of eval(wo, wi) by reciprocity: the walk enters from the side of wo, along -wo, with next event
+    // estimation towards wi (see evalBidirectional())
+    void startReverseEvalWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        startEvalWalk(walk, ior_i, ior_t, Vector3(0, 0, 1), wi, sampler);
+        if ((wi.z < 0) || (wo.z == 0))
+            walk.status = MicrosurfaceWalk::WALK_FAILED;
+
+        // the ray of the walk, in the frame of its side (negated inside)
+        walk.outside = (wo.z > 0);
+        walk.wr = walk.outside ? -wo : wo;
+    }
+
+    // start a walk for sample() that also estimates eval() towards wo (see sampleAndEval())
+    // the walk starts with a unit weight; the next event estimation ends with the eval() walk, after
+    // m_max_walk_length collisions
+    void startSampleAndEvalWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                                Sampler &sampler) const
+    {
+        startWalk(walk, ior_i, ior_t, wi, 1.0, sampler);
+        walk.estimating = true;
+        walk.sum = 0.0;
+        walk.wo = wo;
+
+        if (walk.status == MicrosurfaceWalk::WALK_ACTIVE)
+            walk.sigma_wo = m_ndf->sigma((wo.z > 0) ? -wo : wo);
+    }
+
+    // make a started walk dispersive (see sampleDispersive()): pick its hero channel
+    void startDispersiveWalk(MicrosurfaceWalk &walk, const Spectrum &iors_t, Sampler &sampler) const
+    {
+        assert(m_ndf->uniformMicrosurface() && !(m_facet_lobes & LOBE_SMOOTH));
+
+        sampler.startEvent(walk.walk_domain, 0);
+        sampler.startSlot(SLOT_WAVELENGTH);
+        walk.hero = std::min(int(RandomReal(sampler) * SPECTRUM_CHANNELS), SPECTRUM_CHANNELS - 1);
+
+        walk.spectral = true;
+        walk.dispersive = true;
+        walk.iors_t = iors_t;
+        walk.ior_t = iors_t[walk.hero];
+    }
+
+    // one collision: collide(), then nextEventEstimation() for eval walks, then scatter()
+    // returns true while the walk is active
+    bool step(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        if (!collide(walk, sampler))
+            return false;
+
+        if (walk.estimating && walk.collision_count < m_max_walk_length)
+            nextEventEstimation(walk, sampler);
+
+        return scatter(walk, sampler);
+    }
+
+    // sample the next height: false if the walk is over, escapes or does not survive the roulette, else the collision
+    // is in walk.wm/facet_bsdf
+    bool collide(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        if (walk.status != MicrosurfaceWalk::WALK_ACTIVE)
+            return false;
+
+        sampler.startEvent(walk.walk_domain, walk.collision_count);
+
+        // smooth limit: the only collision is with the flat surface, and the walk ends there
+        if (smoothLimit())
+        {
+            scatterFlat(walk, sampler);
+            return false;
+        }
+
+        // next height
+        walk.facet_bsdf = 0;
+        walk.hr = m_ndf->sampleHeight(walk.wr, walk.hr, walk.outside, walk.wm, walk.facet_bsdf, sampler);
+
+        // leave the microsurface?
+        if (walk.hr >= 0.0)
+        {
+            walk.status = MicrosurfaceWalk::WALK_ESCAPED;
+            return false;
+        }
+
+        assert(0 != walk.facet_bsdf);
+
+        // tail estimator: sample walks that collide again after m_max_walk_length collisions leave in a direction of
+        // the tail lobe (which replaces the facet sample of the collision)
+        if (m_tail.enabled && !walk.evaluating && (walk.collision_count >= m_max_walk_length))
+        {
+            leaveThroughTail(walk, sampler);
+            return false;
+        }
+
+        // Russian roulette
+        const Float survival = m_roulette->survivalProbability(double(walk.throughput), walk.collision_count);
+        if (survival < 1.0)
+        {
+            sampler.startSlot(SLOT_ROULETTE);
+            if (!(RandomReal(sampler) < survival))
+            {
+                walk.status = MicrosurfaceWalk::WALK_ABSORBED;
+                return false;
+            }
+            walk.weight /= survival;
+            walk.throughput /= survival;
+            if (walk.spectral)
+                walk.spectral_weight /= survival;
+        }
+
+        return true;
+    }
+
+    // add the contribution of the current collision towards walk.wo to walk.sum (and its density to walk.pdf)
+    void nextEventEstimation(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        if (walk.spectral)
+        {
+            accumulate(walk, nextEventEstimationSpectrum(walk, walk.wo, walk.sigma_wo, sampler));
+            return;
+        }
+
+        accumulate(walk, nextEventEstimation(walk, walk.wo, walk.sigma_wo, sampler, walk.light_pdf, walk.tracking_pdf ? &walk.pdf : 0));
+    }
+
+    // contribution of the current collision towards wo, given the cross section sigma_wo shadowing the
+    // upward-facing version of wo (zero if not finite)
+    // light_pdf >= 0: weight the contribution against light sampling (see evalMIS())
+    // io_pdf (optional): add the density with which the collision scatters towards wo and the ray escapes
+    Float nextEventEstimation(const MicrosurfaceWalk &walk, const Vector3 &wo, const Float sigma_wo, Sampler &sampler,
+                               const Float light_pdf = -1.0, Float *io_pdf = 0) const
+    {
+        const bool weighted = (light_pdf >= 0.0);
+        Float values[2];
+        Float pdfs[2];
+        nextEventLobes(walk, wo, sigma_wo, sampler, values, (io_pdf || weighted) ? pdfs : 0);
+
+        if (io_pdf && IsFiniteNumber(pdfs[0] + pdfs[1]))
+            *io_pdf += pdfs[0] + pdfs[1];
+
+        if (weighted)
+        {
+            values[0] *= balanceHeuristic(light_pdf, pdfs[0]);
+            values[1] *= balanceHeuristic(light_pdf, pdfs[1]);
+        }
+
+        const Float I = walk.weight * (values[0] + values[1]);
+
+        return IsFiniteNumber(I) ? I : 0.0;
+    }
+
+    // nextEventEstimation() per channel, with the spectral throughput of the walk (zero if not finite)
+    Spectrum nextEventEstimationSpectrum(const MicrosurfaceWalk &walk, const Vector3 &wo, const Float sigma_wo, Sampler &sampler) const
+    {
+        Spectrum values[2];
+        nextEventLobes(walk, wo, sigma_wo, sampler, values, 0);
 
-    Microsurface(NDF *ndf, size_t max_walk_length = MAX_WALK_LENGTH) 
-        : m_ndf(ndf), m_max_walk_length(max_walk_length)
+        const Spectrum I = spectralWeight(walk) * (values[0] + values[1]);
+
+        return IsFiniteNumber(I.average()) ? I : Spectrum(0.0);
+    }
+
+    // next event estimation of the current collision towards wo, split into the singular lobes of the facet BSDF
+    // (index 0, facet normal marginalized over the visible normals) and its other lobes (index 1, facet normal of
+    // the collision), without the walk weight
+    // out_values and out_pdfs (optional): the contributions (Value: Float, or Spectrum per channel), and the densities
+    // with which the collision scatters towards wo and the ray escapes
+    template <class Value>
+    void nextEventLobes(const MicrosurfaceWalk &walk, const Vector3 &wo, const Float sigma_wo, Sampler &sampler,
+                        Value *out_values, Float *out_pdfs) const
+    {
+        const Vector3 &wr = walk.wr;
+        const Float hr = walk.hr;
+        const bool outside = walk.outside;
+        const Float ior_i = walk.ior_i;
+        const Float ior_t = walk.ior_t;
+
+        Value values[2] = {Value(0.0), Value(0.0)};
+        Float pdfs[2] = {0.0, 0.0};
+
+        // the shadowing of wo only depends on the height of the collision on the side of wo
+        const bool wo_outside = (wo.z > 0);
+        const Float h_wo = (wo_outside == outside) ? hr : log(Float(1) - exp(hr));
+        const Float shadowing_wo = NDF::G_1(wo_outside ? wo : -wo, h_wo, sigma_wo);
+        assert(dot(-wr, walk.wm) >= 0.0); // assuming the facet always faces the ray
+
+        // singular lobes, skipped if the facet BSDF has no singular lobe towards the side of wo
+        if (m_facet_lobes & ((wo_outside == outside) ? LOBE_DELTA_REFLECTION : LOBE_DELTA_TRANSMISSION))
+        {
+            // the singular lobes marginalize the facet normal: at the first collision, their shadowing is also
+            // marginalized over the height of the collision
+            const bool single_scattering = m_analytic_single_scattering && (walk.collision_count == 0);
+            const Float shadowingSingular = single_scattering ? singleScatteringShadowing(-wr, wo, outside, sigma_wo) : shadowing_wo;
+
+            Float pdfSingular = 0.0;
+            const Value phaseFunctionSingular = singularPhaseFunction(walk, outside ? -wr : wr, wo, outside, wo_outside,
+                                                                      out_pdfs ? &pdfSingular : 0, values);
+            values[0] = phaseFunctionSingular * shadowingSingular;
+            pdfs[0] = pdfSingular * shadowingSingular;
+        }
+
+        // other lobes (facet normal of the collision), skipped if the facet BSDF has none
+        if (m_facet_lobes & LOBE_SMOOTH)
+        {
+            // apply the shadowing that aligns with what side we started on and whether the facet reflected or not
+            const bool facet_reflected = dot(wo, walk.wm) >= 0.0;
+            const Float shadowing = ((facet_reflected == outside) == wo_outside) ? shadowing_wo : 0.0;
+
+            if (out_values)
+                values[1] = facetEval(walk, outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, wo, sampler, values) * shadowing;
+            if (out_pdfs)
+                pdfs[1] = facet(walk)->pdf(outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, wo, walk.wm, sampler) * shadowing;
+        }
+
+        if (out_values)
+        {
+            out_values[0] = values[0];
+            out_values[1] = values[1];
+        }
+        if (out_pdfs)
+        {
+            out_pdfs[0] = pdfs[0];
+            out_pdfs[1] = pdfs[1];
+        }
+    }
+
+    // contribution of the scattering orders above m_max_walk_length towards wo, for a walk after m_max_walk_length
+    // collisions (see nextEventEstimation() for light_pdf and io_pdf)
+    Float tailEstimation(const MicrosurfaceWalk &walk, const Vector3 &wo, const Float light_pdf = -1.0, Float *io_pdf = 0) const
+    {
+        const int side = walk.outside ? 0 : 1;
+        const Float density = m_tail.density(side, wo);
+
+        // a sample walk in the same state collides again, then leaves through the tail lobe
+        const Float pdf = m_tail.collide_probability[side] * density;
+        if (io_pdf)
+            *io_pdf += pdf;
+
+        Float I = walk.weight * m_tail.eval_albedo[side] * density;
+        if (light_pdf >= 0.0)
+            I *= balanceHeuristic(light_pdf, pdf);
+
+        return IsFiniteNumber(I) ? I : 0.0;
+    }
+
+    // tailEstimation() per channel: the tail statistics are gray, scaled by the spectral throughput of the walk
+    Spectrum tailEstimationSpectrum(const MicrosurfaceWalk &walk, const Vector3 &wo) const
     {
+        const int side = walk.outside ? 0 : 1;
+        const Spectrum I = spectralWeight(walk) * Float(m_tail.eval_albedo[side] * m_tail.density(side, wo));
+
+        return IsFiniteNumber(I.average()) ? I : Spectrum(0.0);
     }
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &io_weight) const {
-        if (wi.z < 0)
+    // shadowing of wo from the first collision of a walk entering along wi (in the frame of the walk, from the side
+    // 'outside'), in expectation over the height of that collision (height-correlated shadowing): with exponential free
+    // paths, the heights are distributed as lambda_i exp(lambda_i h) (h < 0), with lambda = sigma / |cos theta|
+    // - reflection: G_1 = exp(lambda_o h), expectation lambda_i / (lambda_i + lambda_o)
+    // - transmission: G_1 = (1 - exp(h))^lambda_o, expectation lambda_i B(lambda_i, lambda_o + 1)
+    Float singleScatteringShadowing(const Vector3 &wi, const Vector3 &wo, const bool outside, const Float sigma_wo) const
+    {
+        if (wo.z == 0.0)
+            return 0.0;
+
+        using std::abs;
+        const Float lambda_i = m_ndf->sigma(wi) / wi.z;
+        const Float lambda_o = sigma_wo / abs(wo.z);
+        if ((wo.z > 0) == outside)
+            return lambda_i / (lambda_i + lambda_o);
+
+        return exp(lgamma(lambda_i + 1.0) + lgamma(lambda_o + 1.0) - lgamma(lambda_i + lambda_o + 1.0));
+    }
+
+    // sample the facet BSDF of the current collision for the next direction
+    // returns true while the walk is active
+    bool scatter(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        // sample walks tracking their density keep the collision for scatterPdf()
+        if (walk.tracking_scatter_pdf)
+        {
+            const MicrosurfaceWalk collision = walk;
+            if (!scatterFacet(walk, sampler))
+                return false;
+            walk.scatter_pdf = scatterPdf(collision, walk, sampler);
+        }
+        else if (!scatterFacet(walk, sampler))
+            return false;
+
+        // tail estimator: the higher scattering orders towards wo, from the state after m_max_walk_length collisions
+        if (m_tail.enabled && walk.estimating && (walk.collision_count == m_max_walk_length))
+        {
+            if (walk.spectral)
+                accumulate(walk, tailEstimationSpectrum(walk, walk.wo));
+            else
+                accumulate(walk, tailEstimation(walk, walk.wo, walk.light_pdf, walk.tracking_pdf ? &walk.pdf : 0));
+        }
+
+        // eval walks end after m_max_walk_length collisions, sample walks get one more collision to escape
+        if (walk.collision_count >= m_max_walk_length + (walk.evaluating ? 0 : 1))
+        {
+            walk.status = MicrosurfaceWalk::WALK_TRUNCATED;
+            return false;
+        }
+
+        return true;
+    }
+
+    // the next direction of scatter(), sampled by the facet BSDF of the current collision
+    // returns false if the walk failed
+    bool scatterFacet(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        const bool outside = walk.outside;
+
+        // next direction
+        const Vector3 wi_dispersive = outside ? -walk.wr : walk.wr;
+        walk.collision_count++;
+        sampler.startSlot(SLOT_FACET);
+        Float facet_weight = 1.0;
+        if (walk.spectral && !walk.dispersive)
+        {
+            Spectrum facet_weights(1.0);
+            walk.wr = facet(walk)->sampleSpectrum(outside ? walk.ior_i : walk.ior_t, outside ? walk.ior_t : walk.ior_i, -walk.wr, facet_weights, walk.wm, sampler);
+            walk.spectral_weight *= facet_weights;
+            facet_weight = facet_weights.average();
+        }
+        else
+            walk.wr = facet(walk)->sample(outside ? walk.ior_i : walk.ior_t, outside ? walk.ior_t : walk.ior_i, -walk.wr, facet_weight, walk.wm, sampler);
+        walk.weight *= facet_weight;
+        walk.throughput *= facet_weight;
+        if (dot(walk.wr, walk.wm) < 0.0)
+        {
+            walk.outside = !outside;
+            walk.wr = -walk.wr;
+            walk.hr = log(Float(1) - exp(walk.hr));
+        }
+
+        // if NaN (should not happen, just in case)
+        if ((walk.hr != walk.hr) || (walk.wr.z != walk.wr.z))
+        {
+            walk.status = MicrosurfaceWalk::WALK_FAILED;
+            return false;
+        }
+
+        if (walk.dispersive)
+            reweightChannels(walk, wi_dispersive, outside);
+
+        return true;
+    }
+
+    // result of a finished sample walk: outgoing direction, io_weight is set to the walk throughput
+    // (zero if the walk did not escape)
+    Vector3 sampleResult(const MicrosurfaceWalk &walk, Float &io_weight) const
+    {
+        if (walk.status != MicrosurfaceWalk::WALK_ESCAPED)
         {
-            io_weight = 0;
+            io_weight = 0.0;
             return Vector3(0, 0, 1);
         }
 
-        Vector3 wr = -wi;
-        double hr = 0.0;
-        bool outside = true;
+        io_weight = walk.weight;
+        return walk.outside ? walk.wr : -walk.wr;
+    }
 
-        // random walk
-        size_t collision_count = 0;
-        while (collision_count < m_max_walk_length + 1)
+    // result of a finished eval walk
+    Float evalResult(const MicrosurfaceWalk &walk) const
+    {
+        return (walk.status == MicrosurfaceWalk::WALK_FAILED) ? 0.0 : walk.sum;
+    }
+
+    // sampleResult() and evalResult() of a spectral walk
+    Vector3 sampleSpectrumResult(const MicrosurfaceWalk &walk, Spectrum &io_weight) const
+    {
+        if (walk.status != MicrosurfaceWalk::WALK_ESCAPED)
         {
-            // next height
-            Vector3 wm; // microfacet normal
-            const BSDF* microfacet_bsdf = 0;
-            hr = m_ndf->sampleHeight(wr, hr, outside, wm, microfacet_bsdf);
+            io_weight = Spectrum(0.0);
+            return Vector3(0, 0, 1);
+        }
+
+        io_weight = spectralWeight(walk);
+        if (!IsFiniteNumber(io_weight.average()))
+            io_weight = Spectrum(0.0);
+        return walk.outside ? walk.wr : -walk.wr;
+    }
+
+    Spectrum evalSpectrumResult(const MicrosurfaceWalk &walk) const
+    {
+        return (walk.status == MicrosurfaceWalk::WALK_FAILED) ? Spectrum(0.0) : walk.spectral_sum;
+    }
+
+    // result of a finished walk started by startSampleAndEvalWalk(): io_weight is multiplied by the walk throughput
+    // (zero if the walk did not escape), out_value and out_pdf (optional) are the estimates towards walk.wo
+    Vector3 sampleAndEvalResult(const MicrosurfaceWalk &walk, Float &io_weight, Float &out_value, Float *out_pdf) const
+    {
+        const bool failed = (walk.status == MicrosurfaceWalk::WALK_FAILED);
+        out_value = failed ? 0.0 : walk.sum;
+        if (out_pdf)
+            *out_pdf = failed ? 0.0 : walk.pdf;
+
+        Float weight = 0.0;
+        const Vector3 wo = sampleResult(walk, weight);
+        io_weight *= weight;
+        return wo;
+    }
+
+private:
+    // query i of a batch
+    Float evalQuery(const MicrosurfaceBatch &batch, const size_t i, Sampler &sampler) const
+    {
+        sampler.startQuery(batch.first_query + i);
+
+        const Float weight = batch.weights ? batch.weights[i] : 1.0;
+        const Float ior_i = batch.iors_i ? batch.iors_i[i] : batch.ior_i;
+        const Float ior_t = batch.iors_t ? batch.iors_t[i] : batch.ior_t;
+
+        return (weight == 0.0) ? 0.0 : weight * eval(ior_i, ior_t, batch.wi.get(i), batch.wo.get(i), sampler);
+    }
+
+    Float sampleQuery(const MicrosurfaceBatch &batch, const size_t i, const Vector3Arrays<Float> &out_wo, Sampler &sampler) const
+    {
+        sampler.startQuery(batch.first_query + i);
+
+        Float weight = batch.weights ? batch.weights[i] : 1.0;
+        const Float ior_i = batch.iors_i ? batch.iors_i[i] : batch.ior_i;
+        const Float ior_t = batch.iors_t ? batch.iors_t[i] : batch.ior_t;
+
+        out_wo.set(i, sample(ior_i, ior_t, batch.wi.get(i), weight, sampler));
+        return weight;
+    }
+
+    // set the material of query i of a batch, unless it is io_material (the material set last)
+    static void setMaterial(const MicrosurfaceBatch &batch, const size_t i, const MicrosurfacePalette &palette, NDFType &ndf,
+                            FacetBSDF &facet, size_t &io_material)
+    {
+        const size_t material = batch.materials ? batch.materials[i] : i;
+        if (material == io_material)
+            return;
+
+        const MaterialParameters parameters = palette.get(material);
+        ndf.setParameters(parameters);
+        facet.setParameters(parameters);
+        io_material = material;
+    }
+
+    // a value without its derivatives (dual tiers, see evalDerivatives()), e.g. a sampled height or direction
+    static Float detached(const Float x)
+    {
+        return Float(double(x));
+    }
+
+    static Vector3 detached(const Vector3 &v)
+    {
+        return Vector3(detached(v.x), detached(v.y), detached(v.z));
+    }
+
+    // 1, with the derivatives of log(density) (dual tiers), for densities of sampled values (no derivative if 0)
+    static Float logDerivative(const Float density)
+    {
+        return (double(density) != 0.0) ? density / detached(density) : Float(1);
+    }
+
+    // density of the free path of the ray wr from height h_start (at most 0) to a collision at height h: exponential free
+    // paths, with lambda = sigma / |cos theta| (see singleScatteringShadowing())
+    Float freePathDensity(const Vector3 &wr, const Float h_start, const Float h) const
+    {
+        using std::abs;
+        const Float lambda = m_ndf->sigma(-wr) / abs(wr.z);
+        return lambda * exp(-lambda * abs(h - h_start));
+    }
+
+    // probability that the upward ray wr from height h_start leaves the microsurface without collision
+    Float escapeProbability(const Vector3 &wr, const Float h_start) const
+    {
+        return exp(m_ndf->sigma(-wr) / wr.z * h_start);
+    }
+
+    // a collision of a walk of evalBidirectional(), as the two walks see it: index 0 for the walk that sampled it,
+    // index 1 for the other walk (which reaches it from the next collision, or enters along the direction of its
+    // connection after the last one)
+    struct BidirectionalCollision
+    {
+        Vector3 w[2];    // world frame, from the collision towards where each walk arrives from
+        bool outside[2]; // side of these rays
+        Float h[2];      // height of the collision on these sides
+        Float h_start;   // height the free path of the first walk started from
+        Vector3 wm;      // facet normal, world frame
+    };
+
+    // walk of evalBidirectional() started by startEvalWalk() or startReverseEvalWalk(), connecting each collision to
+    // w_end (world frame): the sum of the next event estimations, each weighted by the balance heuristic
+    //   density / (density + density_other)
+    // of the densities of the path of the connection by this walk and by the walk that enters along -w_end and
+    // connects to where this walk entered (the path reversed); first_walk: the walk of eval(wi, wo), which keeps the
+    // closed-form single scattering of the singular lobes (its path has no density)
+    Float bidirectionalWalk(MicrosurfaceWalk &walk, const Vector3 &w_end, const bool first_walk, Sampler &sampler) const
+    {
+        const bool singular = !(m_facet_lobes & LOBE_SMOOTH);
 
-            // leave the microsurface?
-            if (hr >= 0.0)
+        BidirectionalCollision previous;
+        Float sum = 0.0;
+        Float ratio = 1.0; // density_other / density of the path up to the previous collision
+        while (true)
+        {
+            const Float h_start = std::min(Float(0), walk.hr);
+            const Vector3 wr = walk.wr;
+            const bool outside = walk.outside;
+            if (!collide(walk, sampler))
                 break;
 
-            assert(0 != microfacet_bsdf);
+            BidirectionalCollision collision;
+            collision.w[0] = outside ? -wr : wr;
+            collision.outside[0] = outside;
+            collision.h[0] = walk.hr;
+            collision.h_start = h_start;
+            collision.wm = outside ? walk.wm : -walk.wm;
 
-            // next direction
-            collision_count++;
-            wr = microfacet_bsdf->sample(outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, io_weight, wm);
-            if (dot(wr, wm) < 0.0)
-            {
-                outside = !outside;
-                wr = -wr;
-                hr = log(1.0 - exp(hr));
-            }
+            // the other walk reaches the previous collision from this one
+            if (walk.collision_count > 0)
+                ratio *= bidirectionalRatio(previous, &collision, walk.collision_count == 1, false, walk, sampler);
 
-            // if NaN (should not happen, just in case)
-            if ((hr != hr) || (wr.z != wr.z))
+            const bool single_scattering = singular && m_analytic_single_scattering && (walk.collision_count == 0);
+            if ((walk.collision_count < m_max_walk_length) && (first_walk || !single_scattering))
             {
-                io_weight = 0.0;
-                return Vector3(0, 0, 1);
+                // the other walk enters along -w_end
+                collision.w[1] = w_end;
+                collision.outside[1] = (w_end.z > 0);
+                collision.h[1] = (collision.outside[1] == outside) ? walk.hr : log(Float(1) - exp(walk.hr));
+                const Float ratio_end = single_scattering ? Float(0) : ratio * bidirectionalRatio(collision, 0, walk.collision_count == 0, true, walk, sampler);
+
+                Float values[2];
+                nextEventLobes<Float>(walk, w_end, walk.sigma_wo, sampler, values, 0);
+                const Float I = walk.weight * (values[0] + values[1]) / (1 + ratio_end);
+                if (IsFiniteNumber(I))
+                    sum += I;
             }
+
+            if (!scatter(walk, sampler))
+                break;
+
+            collision.w[1] = walk.outside ? walk.wr : -walk.wr;
+            collision.outside[1] = walk.outside;
+            collision.h[1] = walk.hr;
+            previous = collision;
         }
 
-        if (hr < 0.0)
+        return (walk.status == MicrosurfaceWalk::WALK_FAILED) ? Float(0) : sum;
+    }
+
+    // density_other / density of a collision of evalBidirectional() (see bidirectionalWalk()): the free path that
+    // reached it, its facet normal (smooth lobes), and the direction it scattered to, unless it is the first collision
+    // of the walk (the other walk connects there) or the last one (this walk connects there)
+    // next: the next collision of the walk, 0 for the last collision
+    Float bidirectionalRatio(const BidirectionalCollision &collision, const BidirectionalCollision *next, const bool first,
+                             const bool last, const MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        // the rays that reach the collision, in the frame of their side (negated inside)
+        const Vector3 wr = collision.outside[0] ? -collision.w[0] : collision.w[0];
+        const Vector3 wr_other = collision.outside[1] ? -collision.w[1] : collision.w[1];
+
+        // the other walk samples the height on its side: after a crossing, h[1] = log(1 - exp(h[0]))
+        Float density = freePathDensity(wr, collision.h_start, collision.h[0]);
+        Float density_other = freePathDensity(wr_other, next ? next->h[0] : Float(0), collision.h[1]);
+        if (collision.outside[1] != collision.outside[0])
+            density_other *= exp(collision.h[0]) / (Float(1) - exp(collision.h[0]));
+
+        if (m_facet_lobes & LOBE_SMOOTH)
         {
-            io_weight = 0.0;
+            density *= m_ndf->D_wi(-wr, collision.outside[0] ? collision.wm : -collision.wm);
+            density_other *= m_ndf->D_wi(-wr_other, collision.outside[1] ? collision.wm : -collision.wm);
         }
 
-        return outside ? wr : -wr;
+        if (!last)
+            density *= bidirectionalScatterDensity(collision, 0, walk, sampler);
+        if (!first)
+            density_other *= bidirectionalScatterDensity(collision, 1, walk, sampler);
+
+        return density_other / density;
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const {
-        if (wi.z < 0)
-            return 0;
+    // density with which a collision of evalBidirectional() scatters the ray arriving from collision.w[in] towards
+    // collision.w[1 - in]: marginalized over the facet normals for singular lobes, else with the facet normal
+    Float bidirectionalScatterDensity(const BidirectionalCollision &collision, const int in, const MicrosurfaceWalk &walk,
+                                      Sampler &sampler) const
+    {
+        const Vector3 &wi = collision.w[in];
+        const Vector3 &wo = collision.w[1 - in];
+        const bool outside = collision.outside[in];
 
-        Vector3 wr = -wi; // direction of the ray
-        double hr = 0.0;  // height of the ray
-        bool outside = true;
-        double sum = 0;
-        double weight = 1.0;
+        if (!(m_facet_lobes & LOBE_SMOOTH))
+        {
+            Float pdf = 0.0;
+            m_ndf->evalPhaseFunctionSingular(flatFacet(), walk.ior_i, walk.ior_t, wi, wo, outside, collision.outside[1 - in], &pdf);
+            return pdf;
+        }
 
-        // random walk
-        size_t collision_count = 0;
-        while (collision_count < m_max_walk_length)
+        // the facet BSDF in the frame of the side of wi
+        const Float side = outside ? 1.0 : -1.0;
+        return flatFacet()->pdf(outside ? walk.ior_i : walk.ior_t, outside ? walk.ior_t : walk.ior_i, side * wi, side * wo,
+                                side * collision.wm, sampler);
+    }
+
+    // the facet BSDF of the current collision
+    static const FacetBSDF *facet(const MicrosurfaceWalk &walk)
+    {
+        return static_cast<const FacetBSDF *>(walk.facet_bsdf);
+    }
+
+    // add a contribution of the collision after walk.collision_count collisions (or of the tail estimator after the
+    // last one) to walk.sum, and to its scattering order
+    static void accumulate(MicrosurfaceWalk &walk, const Float I)
+    {
+        walk.sum += I;
+        if (walk.orders)
+            walk.orders[std::min(walk.collision_count, walk.order_count - 1)] += I;
+    }
+
+    // a per-channel contribution goes to walk.spectral_sum, and its channel average to walk.sum and its order
+    static void accumulate(MicrosurfaceWalk &walk, const Spectrum &I)
+    {
+        walk.spectral_sum += I;
+        accumulate(walk, I.average());
+    }
+
+    // the lobes of nextEventLobes(), monochromatic or per channel (selected by the type of the last argument)
+    Float singularPhaseFunction(const MicrosurfaceWalk &walk, const Vector3 &wi, const Vector3 &wo, const bool wi_outside,
+                                const bool wo_outside, Float *out_pdf, const Float *) const
+    {
+        return m_ndf->evalPhaseFunctionSingular(flatFacet(), walk.ior_i, walk.ior_t, wi, wo, wi_outside, wo_outside, out_pdf);
+    }
+
+    // (dispersive walks: each channel with its own ior, out_pdf is the density for the hero)
+    Spectrum singularPhaseFunction(const MicrosurfaceWalk &walk, const Vector3 &wi, const Vector3 &wo, const bool wi_outside,
+                                   const bool wo_outside, Float *out_pdf, const Spectrum *) const
+    {
+        if (!walk.dispersive)
+            return m_ndf->evalPhaseFunctionSingularSpectrum(flatFacet(), walk.ior_i, walk.ior_t, wi, wo, wi_outside, wo_outside, out_pdf);
+
+        Spectrum result;
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+            result[c] = m_ndf->evalPhaseFunctionSingular(flatFacet(), walk.ior_i, walk.iors_t[c], wi, wo, wi_outside, wo_outside,
+                                                         (c == walk.hero) ? out_pdf : 0);
+        return result;
+    }
+
+    // throughput of a spectral walk per channel, with the spectral MIS weights of a dispersive walk
+    static Spectrum spectralWeight(const MicrosurfaceWalk &walk)
+    {
+        return walk.dispersive ? walk.spectral_weight / walk.hero_ratios.average() : walk.spectral_weight;
+    }
+
+    // dispersive walks: after the hero scattered from wi (world frame, side wi_outside) to the direction of the walk,
+    // weight each channel by its phase function over the density of the hero (see sampleDispersive())
+    void reweightChannels(MicrosurfaceWalk &walk, const Vector3 &wi, const bool wi_outside) const
+    {
+        const Vector3 wo = walk.outside ? walk.wr : -walk.wr;
+
+        Float values[SPECTRUM_CHANNELS];
+        Float pdfs[SPECTRUM_CHANNELS];
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+            values[c] = m_ndf->evalPhaseFunctionSingular(flatFacet(), walk.ior_i, walk.iors_t[c], wi, wo, wi_outside, walk.outside, &pdfs[c]);
+
+        const Float pdf_hero = pdfs[walk.hero];
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
         {
-            // next height
-            Vector3 wm; // microfacet normal
-            const BSDF* microfacet_bsdf = 0;
-            hr = m_ndf->sampleHeight(wr, hr, outside, wm, microfacet_bsdf);
+            walk.spectral_weight[c] *= (pdf_hero > 0.0) ? values[c] / pdf_hero : 0.0;
+            walk.hero_ratios[c] *= (pdf_hero > 0.0) ? pdfs[c] / pdf_hero : 0.0;
+        }
+    }
 
-            // leave the microsurface?
-            if (hr >= 0.0)
-                break;
+    static Float facetEval(const MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                           Sampler &sampler, const Float *)
+    {
+        return facet(walk)->eval(ior_i, ior_t, wi, wo, walk.wm, sampler);
+    }
 
-            assert(0 != microfacet_bsdf);
+    static Spectrum facetEval(const MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo,
+                              Sampler &sampler, const Spectrum *)
+    {
+        return facet(walk)->evalSpectrum(ior_i, ior_t, wi, wo, walk.wm, sampler);
+    }
 
-            // next event estimation
-            const double phaseFunctionSingular = m_ndf->evalPhaseFunctionSingular(ior_i, ior_t, outside ? -wr : wr, wo, outside, (wo.z > 0));
-            const double phaseFunction = microfacet_bsdf->eval(outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, wo, wm);
-            const double hr_inside = outside ? log(1.0 - exp(hr)) : hr;
-            const double hr_outside = outside ? hr : log(1.0 - exp(hr));
-            const double shadowingSingular = (wo.z > 0) ? m_ndf->G_1(wo, hr_outside) : m_ndf->G_1(-wo, hr_inside);
+    static Float balanceHeuristic(const Float pdf, const Float other_pdf)
+    {
+        return (pdf + other_pdf > 0.0) ? pdf / (pdf + other_pdf) : 0.0;
+    }
 
-            // apply the shadowing that aligns with what side we started on and whether the facet reflected or not
-            bool facet_reflected = dot(wo, wm) >= 0.0;
-            assert(dot(-wr, wm) >= 0.0); // assuming the facet always faces the ray
-            const double shadowing = (facet_reflected == outside) ? m_ndf->G_1(wo, hr_outside) : m_ndf->G_1(-wo, hr_inside);
-            const double I = weight * (phaseFunctionSingular * shadowingSingular + phaseFunction * shadowing);
-
-            if (IsFiniteNumber(I))
-                sum += I;
-
-            // next direction
-            collision_count++;
-            wr = microfacet_bsdf->sample(outside ? ior_i : ior_t, outside ? ior_t : ior_i, -wr, weight, wm);
-            if (dot(wr, wm) < 0.0)
+    // density with which the facet of a collision scattered the ray to the direction of the walk that it started,
+    // and let that ray escape
+    Float scatterPdf(const MicrosurfaceWalk &collision, const MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        const Vector3 wo = walk.outside ? walk.wr : -walk.wr;
+        Float pdfs[2];
+        nextEventLobes<Float>(collision, wo, m_ndf->sigma((wo.z > 0) ? -wo : wo), sampler, 0, pdfs);
+
+        // singular lobes: mirror reflection or refraction about the facet normal, which keeps the tangential
+        // component of the direction up to the ratio of iors (wi and ws in the space of the collision)
+        const bool reflected = (walk.outside == collision.outside);
+        const Vector3 wi = -collision.wr;
+        const Vector3 ws = reflected ? walk.wr : -walk.wr;
+        const Vector3 &wm = collision.wm;
+        const Float eta = collision.outside ? collision.ior_t / collision.ior_i : collision.ior_i / collision.ior_t;
+        const Vector3 d = (ws - wm * dot(ws, wm)) + (wi - wm * dot(wi, wm)) * (reflected ? 1.0 : 1.0 / eta);
+        const bool singular = dot(d, d) < 1e-12;
+
+        const Float pdf = singular ? pdfs[0] : pdfs[1];
+        return IsFiniteNumber(pdf) ? pdf : 0.0;
+    }
+
+    // end a sample walk at its collision after m_max_walk_length collisions with a direction of the tail lobe
+    void leaveThroughTail(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        const int side = walk.outside ? 0 : 1;
+
+        sampler.startSlot(SLOT_FACET);
+        const double u1 = RandomReal(sampler);
+        const double u2 = RandomReal(sampler);
+        const double u3 = RandomReal(sampler);
+        const Vector3 wo(m_tail.sample(side, u1, u2, u3));
+
+        if (walk.tracking_scatter_pdf)
+            walk.scatter_pdf = m_tail.collide_probability[side] * m_tail.density(side, wo);
+
+        walk.collision_count++;
+        walk.weight *= m_tail.sample_albedo[side];
+        walk.throughput *= m_tail.sample_albedo[side];
+        walk.spectral_weight *= Float(m_tail.sample_albedo[side]);
+        walk.outside = (wo.z > 0);
+        walk.wr = walk.outside ? wo : -wo;
+        walk.status = MicrosurfaceWalk::WALK_ESCAPED;
+    }
+
+    // gather the statistics of the tail estimator with untruncated sample walks
+    void gatherTail(NDFType *ndf, const MicrosurfaceTailOptions &options)
+    {
+        assert(m_max_walk_length > 0);
+
+        const NoRoulette no_roulette;
+        const MicrosurfaceOperator untruncated(ndf, MAX_WALK_LENGTH, &no_roulette);
+        PhiloxSampler sampler(options.seed);
+
+        // per side after K collisions: walks and their throughput, walks colliding again and their throughput,
+        // energy escaping after more than K collisions and its histogram of escape directions
+        double reached[2] = {0.0, 0.0}, reached_weight[2] = {0.0, 0.0};
+        double colliding[2] = {0.0, 0.0}, colliding_weight[2] = {0.0, 0.0};
+        double escaped[2] = {0.0, 0.0};
+        double histogram[2][TAIL_BINS] = {};
+
+        for (size_t i = 0; i < options.walks; ++i)
+        {
+            sampler.startQuery(i);
+            const Vector3 wi(lambertDir(sampler));
+
+            MicrosurfaceWalk walk;
+            untruncated.startSampleWalk(walk, options.ior_i, options.ior_t, wi, 1.0, sampler);
+
+            int side = -1;
+            double weight = 0.0;
+            bool active = true;
+            while (active)
             {
-                outside = !outside;
-                wr = -wr;
-                hr = log(1.0 - exp(hr));
+                active = untruncated.step(walk, sampler);
+                if ((side < 0) && (walk.collision_count == m_max_walk_length))
+                {
+                    side = walk.outside ? 0 : 1;
+                    weight = double(walk.weight);
+                }
             }
 
-            // if NaN (should not happen, just in case)
-            if ((hr != hr) || (wr.z != wr.z))
+            if ((side < 0) || (walk.status == MicrosurfaceWalk::WALK_FAILED))
+                continue;
+
+            reached[side] += 1.0;
+            reached_weight[side] += weight;
+            if (walk.collision_count > m_max_walk_length)
             {
-                return 0.0;
+                colliding[side] += 1.0;
+                colliding_weight[side] += weight;
+
+                if (walk.status == MicrosurfaceWalk::WALK_ESCAPED)
+                {
+                    escaped[side] += double(walk.weight);
+                    histogram[side][MicrosurfaceTail::bin(double(walk.outside ? walk.wr.z : -walk.wr.z))] += double(walk.weight);
+                }
             }
         }
 
-        return sum;
+        for (int side = 0; side < 2; ++side)
+        {
+            m_tail.eval_albedo[side] = (reached_weight[side] > 0.0) ? escaped[side] / reached_weight[side] : 0.0;
+            m_tail.sample_albedo[side] = (colliding_weight[side] > 0.0) ? escaped[side] / colliding_weight[side] : 0.0;
+            m_tail.collide_probability[side] = (reached[side] > 0.0) ? colliding[side] / reached[side] : 0.0;
+
+            double cdf = 0.0;
+            for (int b = 0; b < TAIL_BINS; ++b)
+            {
+                cdf += (escaped[side] > 0.0) ? histogram[side][b] / escaped[side] : 0.0;
+                m_tail.cdf[side][b] = cdf;
+            }
+        }
+        m_tail.enabled = true;
+    }
+
+    void startWalk(MicrosurfaceWalk &walk, const Float ior_i, const Float ior_t, const Vector3 &wi, const Float weight, Sampler &sampler) const
+    {
+        walk = MicrosurfaceWalk();
+        walk.ior_i = ior_i;
+        walk.ior_t = ior_t;
+        walk.wr = -wi;
+        walk.weight = weight;
+        walk.walk_domain = sampler.walkDomain();
+
+        if (wi.z < 0)
+            walk.status = MicrosurfaceWalk::WALK_FAILED;
+    }
+
+    // the facet BSDF of the NDF
+    const FacetBSDF *flatFacet() const
+    {
+        return static_cast<const FacetBSDF *>(m_ndf->m_bsdf);
+    }
+
+    // next event estimation of a walk on the flat surface (smooth limit) towards wo, before it scatters: the
+    // non-singular lobes of the facet BSDF about the macro normal, without shadowing (the singular lobes are in
+    // evalSingular())
+    // light_pdf >= 0 and io_pdf (optional): as nextEventEstimation()
+    Float evalFlat(const MicrosurfaceWalk &walk, const Vector3 &wo, Sampler &sampler, const Float light_pdf = -1.0, Float *io_pdf = 0) const
+    {
+        if (!(m_facet_lobes & LOBE_SMOOTH))
+            return 0.0;
+
+        // in the frame of the side of the walk
+        const bool outside = walk.outside;
+        const Vector3 wo_side = outside ? wo : -wo;
+        const Float ior_in = outside ? walk.ior_i : walk.ior_t;
+        const Float ior_out = outside ? walk.ior_t : walk.ior_i;
+
+        Float value = flatFacet()->eval(ior_in, ior_out, -walk.wr, wo_side, sampler);
+        if (io_pdf || (light_pdf >= 0.0))
+        {
+            const Float pdf = flatFacet()->pdf(ior_in, ior_out, -walk.wr, wo_side, sampler);
+            if (io_pdf && IsFiniteNumber(pdf))
+                *io_pdf += pdf;
+            if (light_pdf >= 0.0)
+                value *= balanceHeuristic(light_pdf, pdf);
+        }
+
+        const Float I = walk.weight * value;
+        return IsFiniteNumber(I) ? I : 0.0;
+    }
+
+    // evalFlat() per channel
+    Spectrum evalFlatSpectrum(const MicrosurfaceWalk &walk, const Vector3 &wo, Sampler &sampler) const
+    {
+        if (!(m_facet_lobes & LOBE_SMOOTH))
+            return Spectrum(0.0);
+
+        const bool outside = walk.outside;
+        const Vector3 wo_side = outside ? wo : -wo;
+        const Float ior_in = outside ? walk.ior_i : walk.ior_t;
+        const Float ior_out = outside ? walk.ior_t : walk.ior_i;
+
+        const Spectrum I = walk.spectral_weight * flatFacet()->evalSpectrum(ior_in, ior_out, -walk.wr, wo_side, sampler);
+        return IsFiniteNumber(I.average()) ? I : Spectrum(0.0);
+    }
+
+    // the walk in the smooth limit: next event estimation, then the facet BSDF scatters the ray once about the macro
+    // normal and the ray escapes (eval walks end without scattering)
+    void scatterFlat(MicrosurfaceWalk &walk, Sampler &sampler) const
+    {
+        const bool outside = walk.outside;
+        const Float ior_in = outside ? walk.ior_i : walk.ior_t;
+        const Float ior_out = outside ? walk.ior_t : walk.ior_i;
+        const Vector3 wi = -walk.wr;
+
+        walk.hr = 0.0;
+        walk.wm = Vector3(0, 0, 1);
+        walk.facet_bsdf = m_ndf->m_bsdf;
+
+        if (walk.estimating && (m_max_walk_length > 0))
+        {
+            if (walk.spectral)
+                accumulate(walk, evalFlatSpectrum(walk, walk.wo, sampler));
+            else
+                accumulate(walk, evalFlat(walk, walk.wo, sampler, walk.light_pdf, walk.tracking_pdf ? &walk.pdf : 0));
+        }
+
+        walk.collision_count = 1;
+        if (walk.evaluating)
+        {
+            walk.status = MicrosurfaceWalk::WALK_ESCAPED;
+            return;
+        }
+
+        sampler.startSlot(SLOT_FACET);
+        Float facet_weight = 1.0;
+        Vector3 ws;
+        if (walk.spectral && !walk.dispersive)
+        {
+            Spectrum facet_weights(1.0);
+            ws = flatFacet()->sampleSpectrum(ior_in, ior_out, wi, facet_weights, sampler);
+            walk.spectral_weight *= facet_weights;
+            facet_weight = facet_weights.average();
+        }
+        else
+            ws = flatFacet()->sample(ior_in, ior_out, wi, facet_weight, sampler);
+        walk.weight *= facet_weight;
+        walk.throughput *= facet_weight;
+        walk.outside = (ws.z >= 0.0) ? outside : !outside;
+        walk.wr = (ws.z >= 0.0) ? ws : -ws;
+
+        if (walk.wr.z != walk.wr.z)
+        {
+            walk.status = MicrosurfaceWalk::WALK_FAILED;
+            return;
+        }
+
+        // dispersive walks: the singular lobes of the flat facet only share reflections, and refractions with the ior of
+        // the hero
+        if (walk.dispersive)
+        {
+            const bool reflected = (walk.outside == outside);
+            const Float pdf_hero = flatFacet()->pdfSingular(ior_in, ior_out, wi, ws);
+            for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+            {
+                const bool shared = reflected || (walk.iors_t[c] == walk.ior_t);
+                const Float ior_in_c = outside ? walk.ior_i : walk.iors_t[c];
+                const Float ior_out_c = outside ? walk.iors_t[c] : walk.ior_i;
+                const Float value = shared ? flatFacet()->evalSingular(ior_in_c, ior_out_c, wi, ws) : 0.0;
+                const Float pdf = shared ? flatFacet()->pdfSingular(ior_in_c, ior_out_c, wi, ws) : 0.0;
+                walk.spectral_weight[c] *= (pdf_hero > 0.0) ? value / pdf_hero : 0.0;
+                walk.hero_ratios[c] *= (pdf_hero > 0.0) ? pdf / pdf_hero : 0.0;
+            }
+        }
+
+        // singular samples (mirror reflection or refraction about the macro normal, see scatterPdf()) cannot be
+        // reached by light sampling: the largest density gives them a balance heuristic weight of 1
+        if (walk.tracking_scatter_pdf)
+        {
+            const bool reflected = (walk.outside == outside);
+            const Vector3 d = Vector3(ws.x, ws.y, 0.0) + Vector3(wi.x, wi.y, 0.0) * (reflected ? 1.0 : ior_in / ior_out);
+            const bool singular = dot(d, d) < 1e-12;
+            const Float pdf = singular ? std::numeric_limits<Float>::max() : flatFacet()->pdf(ior_in, ior_out, wi, ws, sampler);
+            walk.scatter_pdf = IsFiniteNumber(pdf) ? pdf : 0.0;
+        }
+
+        walk.status = MicrosurfaceWalk::WALK_ESCAPED;
+    }
+
+public:
+    // true if the NDF is smooth enough to treat the microsurface as flat (see m_smooth_roughness): sample() then
+    // scatters once with the facet BSDF about the macro normal, eval() and pdf() are its non-singular lobes, and its
+    // singular lobes are in evalSingular() and pdfSingular()
+    bool smoothLimit() const
+    {
+        return m_ndf->roughness() <= m_smooth_roughness;
+    }
+
+    virtual unsigned lobes() const
+    {
+        return smoothLimit() ? m_facet_lobes : unsigned(LOBE_SMOOTH);
+    }
+
+    // singular lobes of the smooth limit (zero otherwise), in the direction of wo: those of the facet BSDF
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        if (!smoothLimit() || (wi.z < 0) || !(m_facet_lobes & ((wo.z >= 0) ? LOBE_DELTA_REFLECTION : LOBE_DELTA_TRANSMISSION)))
+            return 0.0;
+
+        return flatFacet()->evalSingular(ior_i, ior_t, wi, wo);
+    }
+
+    virtual Spectrum evalSingularSpectrum(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        if (!smoothLimit() || (wi.z < 0) || !(m_facet_lobes & ((wo.z >= 0) ? LOBE_DELTA_REFLECTION : LOBE_DELTA_TRANSMISSION)))
+            return Spectrum(0.0);
+
+        return flatFacet()->evalSingularSpectrum(ior_i, ior_t, wi, wo);
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
-        return 0.0; // TODO - special case this when both roughnesses are 0
+        if (!smoothLimit() || (wi.z < 0) || !(m_facet_lobes & ((wo.z >= 0) ? LOBE_DELTA_REFLECTION : LOBE_DELTA_TRANSMISSION)))
+            return 0.0;
+
+        return flatFacet()->pdfSingular(ior_i, ior_t, wi, wo);
     }
 };
+
+// runtime-polymorphic Microsurface: any NDF, any facet BSDF, in the precision tier Float
+template <class Float>
+using MicrosurfaceT = MicrosurfaceOperator<NDFT<Float>, BSDFT<Float>>;
+typedef MicrosurfaceT<double> Microsurface;
@@ -0,0 +1,767 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <typeinfo>
+
+#include <packet.h>
+#include <fresnel.h>
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/beckmann.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/mirror.h>
+
+//////////////////////////////////////////////////////////////////////////////////
+// PacketMicrosurface
+//////////////////////////////////////////////////////////////////////////////////
+
+// runs the random walks of a Microsurface batch PACKET_WIDTH at a time, one query per lane
+// - supports GGX and Beckmann NDFs with (monochromatic) conductor, dielectric and mirror facets (see supported())
+// - every lane follows the same walk as Microsurface::sample()/eval(); a lane whose walk ends is refilled
+//   with the next query of the batch, so lanes stay busy when walk lengths differ
+// - query i draws its random numbers from PhiloxSampler(seed) at query first_query + i (see PacketPhilox),
+//   so results do not depend on how a batch is split, but the walk consumes the stream in a different order
+//   than the scalar walk: results are statistically identical, not bitwise identical
+class PacketMicrosurface
+{
+public:
+    enum NDFType
+    {
+        NDF_GGX,
+        NDF_BECKMANN
+    };
+
+    enum FacetType
+    {
+        FACET_MIRROR,
+        FACET_CONDUCTOR,
+        FACET_DIELECTRIC
+    };
+
+    PacketMicrosurface(const Microsurface &microsurface)
+        : m_max_walk_length(microsurface.m_max_walk_length), m_roulette(microsurface.m_roulette), m_tail(microsurface.m_tail), m_analytic_single_scattering(microsurface.m_analytic_single_scattering), m_eta(0), m_k(0)
+    {
+        assert(supported(microsurface));
+
+        const ShapeInvariantNDF *ndf = dynamic_cast<const ShapeInvariantNDF *>(microsurface.m_ndf);
+        m_ndf_type = dynamic_cast<const GGXNDF *>(ndf) ? NDF_GGX : NDF_BECKMANN;
+        m_roughness_x = ndf->m_roughness_x;
+        m_roughness_y = ndf->m_roughness_y;
+
+        const BSDF *facet = ndf->m_bsdf;
+        if (const ConductorBRDF *conductor = dynamic_cast<const ConductorBRDF *>(facet))
+        {
+            m_facet_type = FACET_CONDUCTOR;
+            m_eta = conductor->m_eta;
+            m_k = conductor->m_k;
+        }
+        else if (dynamic_cast<const DielectricBSDF *>(facet))
+            m_facet_type = FACET_DIELECTRIC;
+        else
+            m_facet_type = FACET_MIRROR;
+    }
+
+    // true if the NDF and facet BSDF of the microsurface have packet kernels
+    // (microsurfaces in the smooth limit run without a walk, see Microsurface::smoothLimit())
+    static bool supported(const Microsurface &microsurface)
+    {
+        if (microsurface.smoothLimit())
+            return false;
+
+        const NDF *ndf = microsurface.m_ndf;
+        const bool ndf_supported = (typeid(*ndf) == typeid(GGXNDF)) || (typeid(*ndf) == typeid(BeckmannNDF));
+        if (!ndf_supported)
+            return false;
+
+        // the conductor kernel is monochromatic (colored conductors reflect the channel average of their Fresnel terms)
+        const BSDF *facet = ndf->m_bsdf;
+        if (typeid(*facet) == typeid(ConductorBRDF))
+            return !static_cast<const ConductorBRDF *>(facet)->m_colored;
+        return (typeid(*facet) == typeid(DielectricBSDF)) || (typeid(*facet) == typeid(MirrorBRDF));
+    }
+
+    // same result as Microsurface::evalBatch() with PhiloxSampler(seed), up to Monte Carlo noise
+    void evalBatch(const MicrosurfaceBatch &batch, double *out_value, const uint64_t seed) const
+    {
+        PacketPhilox rng(seed);
+        LaneQueries queries;
+        PacketVector3 wi, wo, wr;
+        Packet ior_i, ior_t, hr, sum, weight, collision_count, sigma_wo;
+        PacketMask wo_outside, outside;
+        PacketMask walking(false);
+
+        size_t next_query = 0;
+        while (true)
+        {
+            // retire finished lanes and refill them with the next queries
+            PacketMask started(false);
+            for (int l = 0; l < PACKET_WIDTH; ++l)
+            {
+                while (!walking[l])
+                {
+                    if (queries.index[l] != NO_QUERY)
+                    {
+                        out_value[queries.index[l]] = queries.weight[l] * sum[l];
+                        queries.index[l] = NO_QUERY;
+                    }
+
+                    if (next_query == batch.count)
+                        break;
+
+                    const size_t i = next_query++;
+                    if (!queries.start(l, batch, i, rng) || (batch.wi.get(i).z < 0))
+                    {
+                        out_value[i] = 0.0;
+                        queries.index[l] = NO_QUERY;
+                        continue;
+                    }
+
+                    wi.set(l, batch.wi.get(i));
+                    wo.set(l, batch.wo.get(i));
+                    ior_i[l] = queries.ior_i[l];
+                    ior_t[l] = queries.ior_t[l];
+                    wr.set(l, -wi.get(l));
+                    hr[l] = 0.0;
+                    sum[l] = 0.0;
+                    weight[l] = 1.0;
+                    collision_count[l] = 0.0;
+                    outside.set(l, true);
+                    walking.set(l, true);
+                    started.set(l, true);
+                }
+            }
+
+            if (!any(walking))
+                break;
+
+            // the cross section shadowing wo is the same at every collision: compute it once per query
+            if (any(started))
+            {
+                wo_outside = wo.z > 0.0;
+                sigma_wo = select(started, sigma(select(wo_outside, -wo, wo)), sigma_wo);
+            }
+
+            evalStep(ior_i, ior_t, wo, wo_outside, sigma_wo, wr, hr, outside, sum, weight, collision_count, walking, rng);
+        }
+    }
+
+    // same estimate as Microsurface::evalAdaptive() with PhiloxSampler(seed), up to Monte Carlo noise: each round
+    // runs its walks as one batch, PACKET_WIDTH walks at a time
+    MicrosurfaceEstimate evalAdaptive(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo,
+                                      const MicrosurfaceAdaptiveOptions &options, const uint64_t seed) const
+    {
+        std::vector<double> wi_x, wi_y, wi_z, wo_x, wo_y, wo_z, values;
+
+        MicrosurfaceAdaptiveRun run(options);
+        MicrosurfaceBatch batch;
+        batch.ior_i = ior_i;
+        batch.ior_t = ior_t;
+        bool control;
+        while (run.next(batch.first_query, batch.count, control))
+        {
+            // the same directions for every walk of the round
+            wi_x.assign(batch.count, wi.x), wi_y.assign(batch.count, wi.y), wi_z.assign(batch.count, wi.z);
+            wo_x.assign(batch.count, wo.x), wo_y.assign(batch.count, wo.y), wo_z.assign(batch.count, wo.z);
+            values.resize(batch.count);
+            batch.wi = Vector3Arrays<const double>(wi_x.data(), wi_y.data(), wi_z.data());
+            batch.wo = Vector3Arrays<const double>(wo_x.data(), wo_y.data(), wo_z.data());
+            evalBatch(batch, values.data(), seed);
+
+            for (size_t n = 0; n < batch.count; ++n)
+                run.add(control, values[n]);
+        }
+        return run.estimate;
+    }
+
+    // same result as Microsurface::sampleBatch() with PhiloxSampler(seed), up to Monte Carlo noise
+    void sampleBatch(const MicrosurfaceBatch &batch, const Vector3Arrays<double> &out_wo, double *out_weight, const uint64_t seed) const
+    {
+        PacketPhilox rng(seed);
+        LaneQueries queries;
+        PacketVector3 wr;
+        Packet ior_i, ior_t, hr, weight, collision_count;
+        PacketMask outside;
+        PacketMask walking(false);
+        PacketMask failed(false);
+
+        size_t next_query = 0;
+        while (true)
+        {
+            // retire finished lanes and refill them with the next queries
+            for (int l = 0; l < PACKET_WIDTH; ++l)
+            {
+                while (!walking[l])
+                {
+                    if (queries.index[l] != NO_QUERY)
+                    {
+                        const size_t i = queries.index[l];
+                        const Vector3 wo = wr.get(l);
+                        out_wo.set(i, failed[l] ? Vector3(0, 0, 1) : (outside[l] ? wo : -wo));
+                        out_weight[i] = failed[l] ? 0.0 : queries.weight[l] * weight[l];
+                        queries.index[l] = NO_QUERY;
+                    }
+
+                    if (next_query == batch.count)
+                        break;
+
+                    const size_t i = next_query++;
+                    const Vector3 wi = batch.wi.get(i);
+                    if (!queries.start(l, batch, i, rng) || (wi.z < 0))
+                    {
+                        out_wo.set(i, Vector3(0, 0, 1));
+                        out_weight[i] = 0.0;
+                        queries.index[l] = NO_QUERY;
+                        continue;
+                    }
+
+                    ior_i[l] = queries.ior_i[l];
+                    ior_t[l] = queries.ior_t[l];
+                    wr.set(l, -wi);
+                    hr[l] = 0.0;
+                    weight[l] = 1.0;
+                    collision_count[l] = 0.0;
+                    outside.set(l, true);
+                    walking.set(l, true);
+                    failed.set(l, false);
+                }
+            }
+
+            if (!any(walking))
+                break;
+
+            sampleStep(ior_i, ior_t, wr, hr, outside, weight, collision_count, walking, failed, rng);
+        }
+    }
+
+private:
+    NDFType m_ndf_type;
+    FacetType m_facet_type;
+    size_t m_max_walk_length;
+    const RoulettePolicy *m_roulette;
+    MicrosurfaceTail m_tail;
+    bool m_analytic_single_scattering;
+    double m_roughness_x, m_roughness_y;
+    double m_eta, m_k; // conductor facets only
+
+    static const size_t NO_QUERY = ~size_t(0);
+
+    // the batch query running in each lane
+    struct LaneQueries
+    {
+        size_t index[PACKET_WIDTH];
+        double weight[PACKET_WIDTH];
+        double ior_i[PACKET_WIDTH];
+        double ior_t[PACKET_WIDTH];
+
+        LaneQueries()
+        {
+            for (int l = 0; l < PACKET_WIDTH; ++l)
+                index[l] = NO_QUERY;
+        }
+
+        // run query i in lane l, false if its weight is zero and there is nothing to do
+        bool start(const int l, const MicrosurfaceBatch &batch, const size_t i, PacketPhilox &rng)
+        {
+            index[l] = i;
+            weight[l] = batch.weights ? batch.weights[i] : 1.0;
+            ior_i[l] = batch.iors_i ? batch.iors_i[i] : batch.ior_i;
+            ior_t[l] = batch.iors_t ? batch.iors_t[i] : batch.ior_t;
+            rng.startQuery(l, batch.first_query + i);
+            return weight[l] != 0.0;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // NDF kernels (see ShapeInvariantNDF, GGXNDF and BeckmannNDF)
+    //////////////////////////////////////////////////////////////////////////////////
+
+    Packet roughness_i(const PacketVector3 &wi) const
+    {
+        const Packet invSinTheta2 = 1.0 / (1.0 - wi.z * wi.z);
+        const Packet cosPhi2 = wi.x * wi.x * invSinTheta2;
+        const Packet sinPhi2 = wi.y * wi.y * invSinTheta2;
+        return sqrt(cosPhi2 * (m_roughness_x * m_roughness_x) + sinPhi2 * (m_roughness_y * m_roughness_y));
+    }
+
+    Packet sigma(const PacketVector3 &wi) const
+    {
+        const Packet roughnessi = roughness_i(wi);
+        const Packet sin_theta_i = sqrt(max(0.0, 1.0 - wi.z * wi.z));
+
+        Packet value;
+        if (m_ndf_type == NDF_GGX)
+        {
+            value = 0.5 * (wi.z + sqrt(wi.z * wi.z + sin_theta_i * sin_theta_i * roughnessi * roughnessi));
+        }
+        else
+        {
+            const Packet a = wi.z / sin_theta_i / roughnessi;
+            value = 0.5 * (erf(a) + 1.0) * wi.z + INV_2_SQRT_M_PI * roughnessi * sin_theta_i * exp(-a * a);
+        }
+
+        return select(wi.z > 0.9999, Packet(1.0), select(wi.z < -0.9999, Packet(0.0), value));
+    }
+
+    Packet D(const PacketVector3 &wm) const
+    {
+        const Packet slope_x = -wm.x / wm.z / m_roughness_x;
+        const Packet slope_y = -wm.y / wm.z / m_roughness_y;
+        const Packet r2 = slope_x * slope_x + slope_y * slope_y;
+        const Packet z4 = wm.z * wm.z * wm.z * wm.z;
+
+        Packet P22;
+        if (m_ndf_type == NDF_GGX)
+        {
+            const Packet tmp = 1.0 + r2;
+            P22 = 1.0 / (M_PI * m_roughness_x * m_roughness_y) / (tmp * tmp);
+        }
+        else
+        {
+            P22 = 1.0 / (M_PI * m_roughness_x * m_roughness_y) * exp(-r2);
+        }
+
+        return select(wm.z <= 0.0, Packet(0.0), P22 / z4);
+    }
+
+    // sample the distribution of visible slopes with roughness=1.0, given cos and sin of theta_i
+    void sampleP22_11GGX(const Packet &theta_i, const Packet &cos_theta_i, const Packet &sin_theta_i,
+                         Packet &slope_x, Packet &slope_y, PacketPhilox &rng) const
+    {
+        const Packet U = rng.next();
+        const Packet U_2 = rng.next();
+        const Packet U_3 = rng.next();
+
+        // normal incidence
+        const Packet r = sqrt(U / (1.0 - U));
+        const Packet phi = 2 * Pi * U_2;
+        const Packet normal_x = r * cos(phi);
+        const Packet normal_y = r * sin(phi);
+
+        const Packet tan_theta_i = sin_theta_i / cos_theta_i;
+        const Packet sigma = 0.5 * (cos_theta_i + 1.0);
+        const Packet c = 1.0 / sigma;
+
+        const Packet A = 2.0 * U / cos_theta_i / c - 1.0;
+        const Packet B = tan_theta_i;
+        const Packet tmp = 1.0 / (A * A - 1.0);
+
+        const Packet D = sqrt(max(0.0, B * B * tmp * tmp - (A * A - B * B) * tmp));
+        const Packet slope_x_1 = B * tmp - D;
+        const Packet slope_x_2 = B * tmp + D;
+        const Packet sx = select((A < 0.0) | (slope_x_2 > 1.0 / tan_theta_i), slope_x_1, slope_x_2);
+        const Packet sy = sqrt(-1.0 - sx * sx + (1.0 + sx * sx) / pow(1.0 - U_2, 2.0 / 3.0)) * sin(2 * Pi * U_3);
+
+        const PacketMask degenerate = (sigma < 0.0001f) | isNaN(sigma);
+        const PacketMask normal = theta_i < 0.0001;
+        slope_x = select(normal, normal_x, select(degenerate, Packet(0.0), sx));
+        slope_y = select(normal, normal_y, select(degenerate, Packet(0.0), sy));
+    }
+
+    void sampleP22_11Beckmann(const Packet &theta_i, const Packet &cos_theta_i, const Packet &sin_theta_i,
+                              Packet &slope_x, Packet &slope_y, const PacketMask &active, PacketPhilox &rng) const
+    {
+        const Packet U = rng.next();
+        const Packet U_2 = rng.next();
+
+        // normal incidence
+        const Packet r = sqrt(-log(U));
+        const Packet phi = 2 * Pi * U_2;
+        const Packet normal_x = r * cos(phi);
+        const Packet normal_y = r * sin(phi);
+
+        const Packet slope_i = cos_theta_i / sin_theta_i;
+        const Packet a = slope_i;
+        const Packet sigma = 0.5 * (erf(a) + 1.0) * cos_theta_i + INV_2_SQRT_M_PI * sin_theta_i * exp(-a * a);
+        const Packet c = 1.0 / sigma;
+
+        // search, each lane stops when the scalar loop would break
+        Packet erf_min(-0.9999);
+        Packet erf_max = max(erf_min, erf(slope_i));
+        Packet erf_current = 0.5 * (erf_min + erf_max);
+
+        PacketMask searching = active & (erf_max - erf_min > 0.000001);
+        while (any(searching))
+        {
+            const PacketMask outside_bounds = !((erf_current >= erf_min) & (erf_current <= erf_max));
+            erf_current = select(outside_bounds, 0.5 * (erf_min + erf_max), erf_current);
+
+            const Packet slope = erfinv(erf_current);
+            const Packet CDF = select(slope >= slope_i, Packet(1.0), c * (INV_2_SQRT_M_PI * sin_theta_i * exp(-slope * slope) + cos_theta_i * (0.5 + 0.5 * erf(slope))));
+            const Packet diff = CDF - U;
+
+            const PacketMask converged = abs(diff) < 0.000001;
+            const PacketMask above = diff > 0.0;
+            const PacketMask stuck = select(above, erf_max, erf_min) == erf_current;
+            searching = searching & !converged & !stuck;
+
+            erf_max = select(searching & above, erf_current, erf_max);
+            erf_min = select(searching & !above, erf_current, erf_min);
+
+            const Packet derivative = 0.5 * c * cos_theta_i - 0.5 * c * sin_theta_i * slope;
+            erf_current = select(searching, erf_current - diff / derivative, erf_current);
+            searching = searching & (erf_max - erf_min > 0.000001);
+        }
+
+        Packet sx = erfinv(min(erf_max, max(erf_min, erf_current)));
+        const Packet sy = erfinv(2.0 * U_2 - 1.0);
+
+        // grazing incidence from below
+        const Packet u = cos_theta_i;
+        const PacketMask below = u < 0.0;
+        if (any(active & below))
+        {
+            const Packet R_1 = rng.next();
+            const Packet R_2 = rng.next();
+            const Packet R_3 = rng.next();
+            const Packet R_4 = rng.next();
+            const Packet R_5 = rng.next();
+            const Packet R_6 = rng.next();
+
+            const Packet m = u / sqrt(1.0 - u * u);
+            const Packet xx = select(R_1 < pow(-u, 1.3), R_2 * R_3, 1.0 - erf(sqrt(-log(R_4))));
+            sx = select(below, erfinv(-1.0 + xx * (1.0 + erf(m))), sx);
+
+            const Packet x = R_5 * pow(R_6, -u);
+            const Packet m2 = m * m;
+            const Packet t = 2.0 * m2 + log(8.0) - 2.0 * log((x - 2.0 * m2 * x) / (m2 * m));
+            sx = select(u < -0.9, -(sqrt(t - log(t)) / sqrt(2.0)), sx);
+        }
+
+        const PacketMask normal = theta_i < 0.00001;
+        slope_x = select(normal, normal_x, sx);
+        slope_y = select(normal, normal_y, sy);
+    }
+
+    // sample the VNDF, the results of inactive lanes are not used
+    PacketVector3 sampleD_wi(const PacketVector3 &wi, const PacketMask &active, PacketPhilox &rng) const
+    {
+        // stretch to match configuration with roughness=1.0
+        const PacketVector3 wi_11 = normalize(PacketVector3(m_roughness_x * wi.x, m_roughness_y * wi.y, wi.z));
+
+        // sample visible slope with roughness=1.0
+        const Packet theta_i = acos(wi_11.z);
+        const Packet cos_theta_i = wi_11.z;
+        const Packet sin_theta_i = sqrt(max(0.0, 1.0 - wi_11.z * wi_11.z));
+        Packet slope_11_x, slope_11_y;
+        if (m_ndf_type == NDF_GGX)
+            sampleP22_11GGX(theta_i, cos_theta_i, sin_theta_i, slope_11_x, slope_11_y, rng);
+        else
+            sampleP22_11Beckmann(theta_i, cos_theta_i, sin_theta_i, slope_11_x, slope_11_y, active, rng);
+
+        // align with view direction
+        const Packet phi = atan2(wi_11.y, wi_11.x);
+        const Packet cos_phi = cos(phi);
+        const Packet sin_phi = sin(phi);
+        const Packet slope_x = m_roughness_x * (cos_phi * slope_11_x - sin_phi * slope_11_y);
+        const Packet slope_y = m_roughness_y * (sin_phi * slope_11_x + cos_phi * slope_11_y);
+
+        // if numerical instability
+        const PacketMask unstable = !isFinite(slope_x);
+        const PacketVector3 fallback = select(wi.z > 0.0, PacketVector3(Vector3(0, 0, 1)), normalize(PacketVector3(wi.x, wi.y, 0.0)));
+
+        return select(unstable, fallback, normalize(PacketVector3(-slope_x, -slope_y, 1.0)));
+    }
+
+    // free path along wr from height hr, as in ShapeInvariantNDF::sampleHeight()
+    // also returns the cross section sigma(-wr), and the lanes where it is degenerate
+    Packet sampleHeight(const PacketVector3 &wr, const Packet &hr, Packet &out_sigma_t, PacketMask &out_degenerate, PacketPhilox &rng) const
+    {
+        const Packet sigma_t = sigma(-wr);
+        out_sigma_t = sigma_t;
+        out_degenerate = sigma_t < 0.00001;
+
+        const Packet dh = -log(rng.next()) * wr.z / sigma_t;
+        return min(0.0, hr) + dh;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // facet kernels (see ConductorBRDF, DielectricBSDF and MirrorBRDF)
+    //////////////////////////////////////////////////////////////////////////////////
+
+    // ConductorR() and DielectricR()
+    Packet conductorR(const Packet &cos_i, const Packet &ior_i) const
+    {
+        if (m_eta == 0.0 && m_k == 0.0)
+            return Packet(1.0);
+        return ConductorRClosedForm(cos_i, ior_i, Packet(m_eta), Packet(m_k));
+    }
+
+    static Packet dielectricR(const Packet &cos_i, const Packet &eta)
+    {
+        const Packet sqrtinput = eta * eta - 1.0 + cos_i * cos_i;
+        return select(sqrtinput <= 0.0, Packet(1.0), evalF(sqrt(max(0.0, sqrtinput)), cos_i));
+    }
+
+    // facet evalSingular(1.0, eta, ...) given the facet-space cosines of wi and wo
+    Packet facetEvalSingular(const Packet &eta, const Packet &cos_i, const Packet &cos_o) const
+    {
+        Packet value(1.0);
+        if (m_facet_type == FACET_CONDUCTOR)
+        {
+            value = conductorR(cos_i, Packet(1.0));
+        }
+        else if (m_facet_type == FACET_DIELECTRIC)
+        {
+            const Packet R = dielectricR(cos_i, eta);
+            value = select(cos_o >= 0.0, R, (1.0 - R) * eta * eta);
+        }
+        return value;
+    }
+
+    // facet sample() about normal wm, wi points away from the facet
+    PacketVector3 facetSample(const Packet &ior_i, const Packet &ior_t, const PacketVector3 &wi, Packet &io_weight,
+                              const PacketVector3 &wm, PacketPhilox &rng) const
+    {
+        const Packet cos_i = dot(wi, wm);
+        const PacketVector3 reflected = reflect(wi, wm);
+
+        if (m_facet_type == FACET_CONDUCTOR)
+        {
+            io_weight = io_weight * conductorR(cos_i, ior_i);
+        }
+        else if (m_facet_type == FACET_DIELECTRIC)
+        {
+            const Packet FR = dielectricR(cos_i, ior_t / ior_i);
+
+            // refract(-wi, wm, ior_i, ior_t)
+            const Packet ratio = ior_i / ior_t;
+            const PacketVector3 refracted = ratio * (-wi + cos_i * wm) - sqrt(1.0 - ratio * ratio * (1.0 - cos_i * cos_i)) * wm;
+
+            return select(rng.next() <= FR, reflected, refracted);
+        }
+
+        return reflected;
+    }
+
+    // NDF::evalPhaseFunctionSingular() for the facet BSDF in the active lanes
+    // sigma_wi is the cross section sigma(wi_outside ? wi : -wi), known from the free-path sampling
+    Packet evalPhaseFunctionSingular(const Packet &ior_i, const Packet &ior_t, const PacketVector3 &wi, const PacketVector3 &wo,
+                                     const PacketMask &wi_outside, const PacketMask &wo_outside, const Packet &sigma_wi,
+                                     const PacketMask &active) const
+    {
+        const Packet etaRatio = ior_t / ior_i;
+        const Packet eta = select(wi_outside, etaRatio, 1.0 / etaRatio);
+        const Packet s = select(wi_outside, Packet(1.0), Packet(-1.0));
+        const Packet c = select(sigma_wi == 0.0, Packet(0.0), 1.0 / sigma_wi);
+        const PacketMask is_reflection = (wi_outside & wo_outside) | !(wi_outside | wo_outside);
+
+        Packet value(0.0);
+        if (any(active & is_reflection))
+        {
+            const PacketVector3 wh = normalize(wi + wo);
+            const Packet cos_i = dot(wi, wh);
+            const Packet D_wi = c * max(0.0, cos_i) * D(s * wh);
+            value = select(is_reflection, 0.25 * D_wi / cos_i * facetEvalSingular(eta, cos_i, dot(wo, wh)), value);
+        }
+
+        if (any(active & !is_reflection))
+        {
+            PacketVector3 wh = -normalize(wi + wo * eta);
+            wh = wh * (s * sign(wh.z));
+            const Packet cos_i = dot(wi, wh);
+            const Packet cos_o = dot(wo, wh);
+            const Packet D_wi = c * max(0.0, cos_i) * D(s * wh);
+            const Packet denominator = cos_i + eta * cos_o;
+            const Packet transmission = facetEvalSingular(eta, cos_i, cos_o) * D_wi * max(0.0, -cos_o) / (denominator * denominator);
+            value = select(is_reflection, value, select(cos_i < 0.0, Packet(0.0), transmission));
+        }
+
+        return value;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////
+    // random walks (see Microsurface::sample() and Microsurface::eval())
+    //////////////////////////////////////////////////////////////////////////////////
+
+    // Russian roulette of Microsurface::collide() in the walking lanes (weight is the throughput of a walk started with a
+    // unit weight): survivors have their weight divided by their survival probability
+    // returns the lanes that do not survive
+    PacketMask roulette(Packet &weight, const Packet &collision_count, const PacketMask &walking, PacketPhilox &rng) const
+    {
+        Packet survival(1.0);
+        for (int l = 0; l < PACKET_WIDTH; ++l)
+        {
+            if (walking[l])
+                survival[l] = m_roulette->survivalProbability(weight[l], size_t(collision_count[l]));
+        }
+
+        if (!any(walking & (survival < 1.0)))
+            return PacketMask(false);
+
+        const PacketMask absorbed = walking & !(rng.next() < survival);
+        weight = select(walking & !absorbed, weight / survival, weight);
+        return absorbed;
+    }
+
+    // one collision of Microsurface::sample() in every walking lane
+    // lanes stop walking when they escape (wr, outside hold the result) or fail (weight 0)
+    void sampleStep(const Packet &ior_i, const Packet &ior_t, PacketVector3 &wr, Packet &hr, PacketMask &outside,
+                    Packet &weight, Packet &collision_count, PacketMask &walking, PacketMask &failed, PacketPhilox &rng) const
+    {
+        rng.startEvents(collision_count);
+
+        // next height
+        Packet sigma_t;
+        PacketMask degenerate;
+        const Packet h = sampleHeight(wr, hr, sigma_t, degenerate, rng);
+
+        // leave the microsurface? (without a cross section, rays going down never escape)
+        failed = failed | (walking & degenerate & (wr.z < 0.0));
+        walking = walking & !degenerate & (h < 0.0);
+        if (!any(walking))
+            return;
+        hr = select(walking, h, hr);
+
+        // tail estimator: lanes that collide again after the maximum number of collisions leave through the tail lobe
+        // (see Microsurface::leaveThroughTail())
+        if (m_tail.enabled)
+        {
+            const PacketMask tail = walking & (collision_count >= double(m_max_walk_length));
+            if (any(tail))
+            {
+                const Packet u1 = rng.next();
+                const Packet u2 = rng.next();
+                const Packet u3 = rng.next();
+                for (int l = 0; l < PACKET_WIDTH; ++l)
+                {
+                    if (!tail[l])
+                        continue;
+
+                    const int side = outside[l] ? 0 : 1;
+                    const Vector3 wo = m_tail.sample(side, u1[l], u2[l], u3[l]);
+                    weight[l] *= m_tail.sample_albedo[side];
+                    outside.set(l, wo.z > 0);
+                    wr.set(l, (wo.z > 0) ? wo : -wo);
+                }
+                walking = walking & !tail;
+                if (!any(walking))
+                    return;
+            }
+        }
+
+        // Russian roulette (lanes that do not survive return a zero weight)
+        const PacketMask absorbed = roulette(weight, collision_count, walking, rng);
+        failed = failed | absorbed;
+        walking = walking & !absorbed;
+        if (!any(walking))
+            return;
+
+        // next direction
+        const PacketVector3 wm = sampleD_wi(-wr, walking, rng);
+        Packet weight_next = weight;
+        const PacketVector3 wr_next = facetSample(select(outside, ior_i, ior_t), select(outside, ior_t, ior_i), -wr, weight_next, wm, rng);
+        collision_count = select(walking, collision_count + 1.0, collision_count);
+
+        const PacketMask flip = walking & (dot(wr_next, wm) < 0.0);
+        outside = (outside & !flip) | (flip & !outside);
+        wr = select(walking, select(flip, -wr_next, wr_next), wr);
+        hr = select(flip, log(1.0 - exp(hr)), hr);
+        weight = select(walking, weight_next, weight);
+
+        // if NaN (should not happen, just in case), or still inside after the maximum number of collisions
+        const PacketMask nan = isNaN(hr) | isNaN(wr.z);
+        const PacketMask trapped = collision_count >= double(m_max_walk_length + 1);
+        failed = failed | (walking & (nan | trapped));
+        walking = walking & !nan & !trapped;
+    }
+
+    // one collision of Microsurface::eval() in every walking lane, accumulating into sum
+    void evalStep(const Packet &ior_i, const Packet &ior_t, const PacketVector3 &wo, const PacketMask &wo_outside, const Packet &sigma_wo,
+                  PacketVector3 &wr, Packet &hr, PacketMask &outside, Packet &sum, Packet &weight,
+                  Packet &collision_count, PacketMask &walking, PacketPhilox &rng) const
+    {
+        rng.startEvents(collision_count);
+
+        // next height
+        Packet sigma_t;
+        PacketMask degenerate;
+        const Packet h = sampleHeight(wr, hr, sigma_t, degenerate, rng);
+
+        // leave the microsurface?
+        walking = walking & !degenerate & (h < 0.0);
+        if (!any(walking))
+            return;
+        hr = select(walking, h, hr);
+
+        // Russian roulette
+        walking = walking & !roulette(weight, collision_count, walking, rng);
+        if (!any(walking))
+            return;
+
+        const PacketVector3 wm = sampleD_wi(-wr, walking, rng);
+
+        // next event estimation (facets are smooth, only the singular part contributes)
+        const Packet phaseFunctionSingular = evalPhaseFunctionSingular(ior_i, ior_t, select(outside, -wr, wr), wo, outside, wo_outside, sigma_t, walking);
+        const Packet hr_flipped = log(1.0 - exp(hr));
+        const Packet hr_wo = select((outside & wo_outside) | !(outside | wo_outside), hr, hr_flipped);
+        const Packet wo_z = abs(wo.z);
+        Packet shadowingSingular = select(wo_z == 0.0, Packet(0.0), select(hr_wo >= 0.0, Packet(1.0), exp(hr_wo / wo_z * sigma_wo)));
+
+        // first collision: shadowing in expectation over the height (see Microsurface::singleScatteringShadowing())
+        const PacketMask first = walking & (collision_count == 0.0);
+        if (m_analytic_single_scattering && any(first))
+        {
+            const Packet lambda_i = sigma_t / abs(wr.z);
+            const Packet lambda_o = sigma_wo / wo_z;
+            for (int l = 0; l < PACKET_WIDTH; ++l)
+            {
+                if (!first[l] || (wo_z[l] == 0.0))
+                    continue;
+
+                shadowingSingular[l] = wo_outside[l] ? lambda_i[l] / (lambda_i[l] + lambda_o[l])
+                                                     : exp(lgamma(lambda_i[l] + 1.0) + lgamma(lambda_o[l] + 1.0) - lgamma(lambda_i[l] + lambda_o[l] + 1.0));
+            }
+        }
+        const Packet I = weight * phaseFunctionSingular * shadowingSingular;
+        sum = sum + select(walking & isFinite(I), I, Packet(0.0));
+
+        // next direction
+        Packet weight_next = weight;
+        const PacketVector3 wr_next = facetSample(select(outside, ior_i, ior_t), select(outside, ior_t, ior_i), -wr, weight_next, wm, rng);
+        collision_count = select(walking, collision_count + 1.0, collision_count);
+
+        const PacketMask flip = walking & (dot(wr_next, wm) < 0.0);
+        outside = (outside & !flip) | (flip & !outside);
+        wr = select(walking, select(flip, -wr_next, wr_next), wr);
+        hr = select(flip, hr_flipped, hr);
+        weight = select(walking, weight_next, weight);
+
+        // if NaN (should not happen, just in case)
+        const PacketMask nan = walking & (isNaN(hr) | isNaN(wr.z));
+        sum = select(nan, Packet(0.0), sum);
+
+        // tail estimator: the higher scattering orders after the maximum number of collisions (see
+        // Microsurface::tailEstimation())
+        if (m_tail.enabled)
+        {
+            const PacketMask tail = walking & !nan & (collision_count == double(m_max_walk_length));
+            for (int l = 0; l < PACKET_WIDTH; ++l)
+            {
+                if (!tail[l])
+                    continue;
+
+                const int side = outside[l] ? 0 : 1;
+                const double I = weight[l] * m_tail.eval_albedo[side] * m_tail.density(side, wo.get(l));
+                sum[l] += IsFiniteNumber(I) ? I : 0.0;
+            }
+        }
+
+        walking = walking & !nan & (collision_count < double(m_max_walk_length));
+    }
+};
@@ -19,23 +19,50 @@
 #include <bsdf.h>
 
 // smooth mirror
-class MirrorBRDF : public BSDF
+template <class Float>
+class MirrorBRDFT final : public BSDFT<Float>
 {
 public:
-    MirrorBRDF(){};
+    typedef BSDFT<Float> BSDF;
+    typedef Vector3T<Float> Vector3;
 
-    virtual Vector3 sample(const double ior_i, const double ior_t, const Vector3 &wi, double &weight) const
+    using BSDF::sample;
+    using BSDF::eval;
+    using BSDF::pdf;
+    using BSDF::evalSingular;
+    using BSDF::pdfSingular;
+
+    MirrorBRDFT(){};
+
+    virtual unsigned lobes() const
+    {
+        return LOBE_DELTA_REFLECTION;
+    }
+
+    virtual Vector3 sample(const Float ior_i, const Float ior_t, const Vector3 &wi, Float &weight, Sampler &sampler) const
     {
         return reflect(wi, Vector3(0, 0, 1));
     }
 
-    virtual double eval(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float eval(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
+    {
+        return 0.0;
+    }
+
+    virtual Float evalSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
+    {
+        return 1.0;
+    }
+
+    virtual Float pdf(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo, Sampler &sampler) const
     {
         return 0.0;
     }
 
-    virtual double evalSingular(const double ior_i, const double ior_t, const Vector3 &wi, const Vector3 &wo) const
+    virtual Float pdfSingular(const Float ior_i, const Float ior_t, const Vector3 &wi, const Vector3 &wo) const
     {
         return 1.0;
     }
-};
\ No newline at end of file
+};
+
+typedef MirrorBRDFT<double> MirrorBRDF;
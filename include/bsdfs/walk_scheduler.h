@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <bsdfs/microsurface.h>
+#include <typeinfo>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////
+// WalkScheduler
+//////////////////////////////////////////////////////////////////////////////////
+
+// wavefront scheduler for Microsurface random walks
+// - queries are queued per microsurface and per kind (eval or sample); the walks of a queue advance one
+//   collision at a time, stage by stage (free path and facet normal, next event estimation, facet sampling),
+//   so that each stage runs the same code over a long array of walks
+// - walks that escape or end are compacted out of the list of live walks after each stage
+// - queues hold the queries; the walks of a wavefront of a few thousand queries are started in a buffer that is reused
+//   from one wavefront to the next, so that the working set stays in cache
+// - queues run in order of NDF and facet BSDF type, so that materials of the same type run back to back
+// - query q draws from PhiloxSampler(seed, q): it runs the walk of Microsurface::sample()/eval() with a
+//   PhiloxSampler(seed) started at query q, whatever the order in which walks are advanced (walks only keep their
+//   position in the stream, and one sampler is moved to the stream of each walk it advances)
+//   NB: the results are bit-identical only without contraction of floating point operations (-ffp-contract=off, or
+//   targets without FMA): the scheduler and the per-query loop inline the kernels differently, so the compiler may
+//   fuse different mul+add, and the results then agree up to rounding
+// - the stages run the same scalar virtual kernels as Microsurface::step(), one walk at a time, and the walk states go
+//   through memory between the stages: the scheduler is no faster than the per-query loop on the CPU (see
+//   test/benchmarks/bench_wavefront.cpp), its stage arrays are where batched kernels plug in
+// NB: walks nested inside a facet BSDF (biscale microsurfaces) run to completion within the stage
+//     that evaluates or samples that facet
+class WalkScheduler
+{
+public:
+    WalkScheduler(const uint64_t seed)
+        : m_seed(seed)
+    {
+    }
+
+    // queue an eval query, its result is weight * eval(ior_i, ior_t, wi, wo)
+    // returns the index of the result
+    size_t addEval(const Microsurface *microsurface, const double ior_i, const double ior_t,
+                   const Vector3 &wi, const Vector3 &wo, const uint64_t query, const double weight = 1.0)
+    {
+        const size_t result = m_results.size();
+        m_results.push_back(Result(weight));
+
+        // nothing to do (as in Microsurface::evalBatch())
+        if (weight == 0.0)
+            return result;
+
+        queue(microsurface, true).queries.push_back(Query(ior_i, ior_t, wi, wo, weight, query, result));
+        return result;
+    }
+
+    // queue a sample query, its result is the sampled direction and weight * sample weight
+    // returns the index of the result
+    size_t addSample(const Microsurface *microsurface, const double ior_i, const double ior_t,
+                     const Vector3 &wi, const uint64_t query, const double weight = 1.0)
+    {
+        const size_t result = m_results.size();
+        m_results.push_back(Result(weight));
+
+        queue(microsurface, false).queries.push_back(Query(ior_i, ior_t, wi, Vector3(0, 0, 1), weight, query, result));
+        return result;
+    }
+
+    // queue all the queries of a batch (query i runs as query batch.first_query + i)
+    // returns the index of the result of the first query, the others follow
+    size_t addEvalBatch(const Microsurface *microsurface, const MicrosurfaceBatch &batch)
+    {
+        const size_t first = m_results.size();
+        for (size_t i = 0; i < batch.count; ++i)
+        {
+            addEval(microsurface, batch.iors_i ? batch.iors_i[i] : batch.ior_i, batch.iors_t ? batch.iors_t[i] : batch.ior_t,
+                    batch.wi.get(i), batch.wo.get(i), batch.first_query + i, batch.weights ? batch.weights[i] : 1.0);
+        }
+        return first;
+    }
+
+    size_t addSampleBatch(const Microsurface *microsurface, const MicrosurfaceBatch &batch)
+    {
+        const size_t first = m_results.size();
+        for (size_t i = 0; i < batch.count; ++i)
+        {
+            addSample(microsurface, batch.iors_i ? batch.iors_i[i] : batch.ior_i, batch.iors_t ? batch.iors_t[i] : batch.ior_t,
+                      batch.wi.get(i), batch.first_query + i, batch.weights ? batch.weights[i] : 1.0);
+        }
+        return first;
+    }
+
+    // advance all queued walks until they end
+    void run()
+    {
+        // group materials of the same type
+        std::stable_sort(m_queues.begin(), m_queues.end(), [](const Queue &a, const Queue &b) { return a.type < b.type; });
+
+        PhiloxSampler sampler(m_seed);
+        std::vector<Walk> wavefront;
+        std::vector<uint32_t> live;
+        for (size_t q = 0; q < m_queues.size(); ++q)
+        {
+            const Queue &queue = m_queues[q];
+            const Microsurface *microsurface = queue.microsurface;
+            const std::vector<Query> &queries = queue.queries;
+
+            // one wavefront at a time, so that the walks being advanced stay in cache
+            for (size_t first = 0; first < queries.size(); first += m_wavefront_size)
+            {
+                const size_t count = std::min(m_wavefront_size, queries.size() - first);
+                wavefront.resize(count);
+                live.resize(count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const Query &query = queries[first + i];
+                    Walk &walk = wavefront[i];
+                    walk.query = query.query;
+                    walk.dimension = 0;
+                    walk.result = query.result;
+
+                    resume(sampler, walk);
+                    if (queue.evaluating)
+                        microsurface->startEvalWalk(walk.state, query.ior_i, query.ior_t, query.wi, query.wo, sampler);
+                    else
+                        microsurface->startSampleWalk(walk.state, query.ior_i, query.ior_t, query.wi, query.weight, sampler);
+                    walk.dimension = sampler.m_dimension;
+                    live[i] = uint32_t(i);
+                }
+                retire(wavefront.data(), live, queue.evaluating, microsurface);
+
+                while (!live.empty())
+                {
+                    // free path and facet normal
+                    for (size_t i = 0; i < live.size(); ++i)
+                    {
+                        Walk &walk = wavefront[live[i]];
+                        resume(sampler, walk);
+                        microsurface->collide(walk.state, sampler);
+                        walk.dimension = sampler.m_dimension;
+                    }
+                    retire(wavefront.data(), live, queue.evaluating, microsurface);
+
+                    // next event estimation
+                    if (queue.evaluating)
+                    {
+                        for (size_t i = 0; i < live.size(); ++i)
+                        {
+                            Walk &walk = wavefront[live[i]];
+                            resume(sampler, walk);
+                            microsurface->nextEventEstimation(walk.state, sampler);
+                            walk.dimension = sampler.m_dimension;
+                        }
+                    }
+
+                    // facet sampling
+                    for (size_t i = 0; i < live.size(); ++i)
+                    {
+                        Walk &walk = wavefront[live[i]];
+                        resume(sampler, walk);
+                        microsurface->scatter(walk.state, sampler);
+                        walk.dimension = sampler.m_dimension;
+                    }
+                    retire(wavefront.data(), live, queue.evaluating, microsurface);
+                }
+            }
+        }
+
+        m_queues.clear();
+    }
+
+    // number of walks advanced together
+    void setWavefrontSize(const size_t wavefront_size)
+    {
+        assert(wavefront_size > 0);
+        m_wavefront_size = wavefront_size;
+    }
+
+    size_t size() const
+    {
+        return m_results.size();
+    }
+
+    // eval queries: weight * eval, sample queries: weight * sample weight
+    double value(const size_t result) const
+    {
+        return m_results[result].value;
+    }
+
+    // sample queries: sampled direction
+    const Vector3 &direction(const size_t result) const
+    {
+        return m_results[result].direction;
+    }
+
+    // drop all results and queued walks
+    void clear()
+    {
+        m_results.clear();
+        m_queues.clear();
+    }
+
+private:
+    // a queued query
+    struct Query
+    {
+        Query(const double in_ior_i, const double in_ior_t, const Vector3 &in_wi, const Vector3 &in_wo, const double in_weight,
+              const uint64_t in_query, const size_t in_result)
+            : ior_i(in_ior_i), ior_t(in_ior_t), wi(in_wi), wo(in_wo), weight(in_weight), query(in_query), result(in_result)
+        {
+        }
+
+        double ior_i, ior_t;
+        Vector3 wi, wo; // wo: eval queries only
+        double weight;
+        uint64_t query;
+        size_t result;
+    };
+
+    // a walk of the wavefront, and its position in the Philox stream of its query
+    // (the walks do not hold a sampler: PhiloxSampler is over-aligned, which std::vector only supports from C++17)
+    struct Walk
+    {
+        MicrosurfaceWalk state;
+        uint64_t query;
+        uint64_t dimension;
+        size_t result;
+    };
+
+    struct Queue
+    {
+        const Microsurface *microsurface;
+        bool evaluating;
+        std::string type; // NDF and facet BSDF type names
+        std::vector<Query> queries;
+    };
+
+    struct Result
+    {
+        Result(const double weight)
+            : value(weight), direction(0, 0, 1)
+        {
+        }
+
+        double value; // holds the query weight until the walk ends
+        Vector3 direction;
+    };
+
+    uint64_t m_seed;
+    size_t m_wavefront_size = 4096;
+    std::vector<Queue> m_queues;
+    std::vector<Result> m_results;
+
+    Queue &queue(const Microsurface *microsurface, const bool evaluating)
+    {
+        for (size_t q = 0; q < m_queues.size(); ++q)
+        {
+            if (m_queues[q].microsurface == microsurface && m_queues[q].evaluating == evaluating)
+                return m_queues[q];
+        }
+
+        Queue queue;
+        queue.microsurface = microsurface;
+        queue.evaluating = evaluating;
+        queue.type = std::string(typeid(*microsurface->m_ndf).name()) + "/" + typeid(*microsurface->m_ndf->m_bsdf).name();
+        m_queues.push_back(queue);
+        return m_queues.back();
+    }
+
+    // move the sampler to the stream of the walk (the numbers only depend on the query and the dimension)
+    static void resume(PhiloxSampler &sampler, const Walk &walk)
+    {
+        sampler.m_query = walk.query;
+        sampler.m_dimension = walk.dimension;
+    }
+
+    // write the results of the walks that ended and compact the indices of the live walks, in order
+    void retire(const Walk *walks, std::vector<uint32_t> &live, const bool evaluating, const Microsurface *microsurface)
+    {
+        size_t live_count = 0;
+        for (size_t i = 0; i < live.size(); ++i)
+        {
+            const Walk &walk = walks[live[i]];
+            if (walk.state.status == MicrosurfaceWalk::WALK_ACTIVE)
+            {
+                live[live_count++] = live[i];
+                continue;
+            }
+
+            Result &result = m_results[walk.result];
+            if (evaluating)
+            {
+                result.value *= microsurface->evalResult(walk.state);
+            }
+            else
+            {
+                double weight = 0.0;
+                result.direction = microsurface->sampleResult(walk.state, weight);
+                result.value = weight;
+            }
+        }
+        live.resize(live_count);
+    }
+};
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <util.h>
+#include <math_functions.h>
+
+// fully unroll the loops over the N partials: GCC otherwise vectorizes them as loops, whose setup costs more than the
+// few operations of a small N (2-3x the time of a derivative walk with 3 or 4 derivatives)
+#if defined(__GNUC__)
+#define DUAL_UNROLL _Pragma("GCC unroll 16")
+#else
+#define DUAL_UNROLL
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////
+// dual numbers
+//////////////////////////////////////////////////////////////////////////////////
+
+// forward-mode derivatives: a value and its partial derivatives with respect to N parameters, usable as the scalar
+// type of a precision tier (see vector.h), e.g. GGXNDFT<DualT<2>> with dual roughnesses returns the derivatives of
+// sigma(), D(), ... with their values (see Microsurface::evalDerivatives())
+// comparisons, and so the branches of the code, only see the value
+template <int N>
+struct DualT
+{
+    double v;    // value
+    double d[N]; // partial derivatives
+
+    DualT(const double value = 0.0)
+        : v(value)
+    {
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            d[i] = 0.0;
+    }
+
+    // parameter i, of the given value
+    static DualT parameter(const double value, const int i)
+    {
+        DualT x(value);
+        x.d[i] = 1.0;
+        return x;
+    }
+
+    // value and derivatives of f(x), given f(x.v) and f'(x.v)
+    DualT chain(const double value, const double derivative) const
+    {
+        DualT result(value);
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            result.d[i] = derivative * d[i];
+        return result;
+    }
+
+    // the value, without the derivatives
+    explicit operator double() const
+    {
+        return v;
+    }
+
+    explicit operator float() const
+    {
+        return float(v);
+    }
+
+    DualT operator-() const
+    {
+        return chain(-v, -1.0);
+    }
+
+    DualT &operator+=(const DualT &b)
+    {
+        v += b.v;
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            d[i] += b.d[i];
+        return *this;
+    }
+
+    DualT &operator-=(const DualT &b)
+    {
+        v -= b.v;
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            d[i] -= b.d[i];
+        return *this;
+    }
+
+    DualT &operator*=(const DualT &b)
+    {
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            d[i] = d[i] * b.v + v * b.d[i];
+        v *= b.v;
+        return *this;
+    }
+
+    DualT &operator/=(const DualT &b)
+    {
+        const double inv = 1.0 / b.v;
+        v *= inv;
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            d[i] = (d[i] - v * b.d[i]) * inv;
+        return *this;
+    }
+
+    friend DualT operator+(DualT a, const DualT &b)
+    {
+        return a += b;
+    }
+
+    friend DualT operator-(DualT a, const DualT &b)
+    {
+        return a -= b;
+    }
+
+    friend DualT operator*(DualT a, const DualT &b)
+    {
+        return a *= b;
+    }
+
+    friend DualT operator/(DualT a, const DualT &b)
+    {
+        return a /= b;
+    }
+
+    friend bool operator<(const DualT &a, const DualT &b)
+    {
+        return a.v < b.v;
+    }
+
+    friend bool operator>(const DualT &a, const DualT &b)
+    {
+        return a.v > b.v;
+    }
+
+    friend bool operator<=(const DualT &a, const DualT &b)
+    {
+        return a.v <= b.v;
+    }
+
+    friend bool operator>=(const DualT &a, const DualT &b)
+    {
+        return a.v >= b.v;
+    }
+
+    friend bool operator==(const DualT &a, const DualT &b)
+    {
+        return a.v == b.v;
+    }
+
+    friend bool operator!=(const DualT &a, const DualT &b)
+    {
+        return a.v != b.v;
+    }
+};
+
+template <int N>
+inline DualT<N> sqrt(const DualT<N> &x)
+{
+    const double value = std::sqrt(x.v);
+    return x.chain(value, 0.5 / value);
+}
+
+template <int N>
+inline DualT<N> exp(const DualT<N> &x)
+{
+    const double value = std::exp(x.v);
+    return x.chain(value, value);
+}
+
+template <int N>
+inline DualT<N> log(const DualT<N> &x)
+{
+    return x.chain(std::log(x.v), 1.0 / x.v);
+}
+
+template <int N>
+inline DualT<N> pow(const DualT<N> &x, const double y)
+{
+    // (as the compiler folds pow(x, 2.0) for doubles)
+    if (y == 2.0)
+        return x * x;
+
+    return x.chain(std::pow(x.v, y), (y == 0.0) ? 0.0 : y * std::pow(x.v, y - 1.0));
+}
+
+template <int N>
+inline DualT<N> pow(const DualT<N> &x, const DualT<N> &y)
+{
+    const double value = std::pow(x.v, y.v);
+    DualT<N> result = x.chain(value, (y.v == 0.0) ? 0.0 : y.v * std::pow(x.v, y.v - 1.0));
+    if (value != 0.0)
+    {
+        const double log_x = std::log(x.v);
+        DUAL_UNROLL
+        for (int i = 0; i < N; ++i)
+            result.d[i] += value * log_x * y.d[i];
+    }
+    return result;
+}
+
+template <int N>
+inline DualT<N> pow(const double x, const DualT<N> &y)
+{
+    const double value = std::pow(x, y.v);
+    return y.chain(value, value * std::log(x));
+}
+
+template <int N>
+inline DualT<N> abs(const DualT<N> &x)
+{
+    return (x.v < 0.0) ? -x : x;
+}
+
+template <int N>
+inline DualT<N> fabs(const DualT<N> &x)
+{
+    return abs(x);
+}
+
+template <int N>
+inline DualT<N> floor(const DualT<N> &x)
+{
+    return DualT<N>(std::floor(x.v));
+}
+
+template <int N>
+inline DualT<N> ceil(const DualT<N> &x)
+{
+    return DualT<N>(std::ceil(x.v));
+}
+
+template <int N>
+inline DualT<N> sin(const DualT<N> &x)
+{
+    return x.chain(std::sin(x.v), std::cos(x.v));
+}
+
+template <int N>
+inline DualT<N> cos(const DualT<N> &x)
+{
+    return x.chain(std::cos(x.v), -std::sin(x.v));
+}
+
+template <int N>
+inline DualT<N> tan(const DualT<N> &x)
+{
+    const double value = std::tan(x.v);
+    return x.chain(value, 1.0 + value * value);
+}
+
+template <int N>
+inline DualT<N> acos(const DualT<N> &x)
+{
+    return x.chain(std::acos(x.v), -1.0 / std::sqrt(1.0 - x.v * x.v));
+}
+
+template <int N>
+inline DualT<N> asin(const DualT<N> &x)
+{
+    return x.chain(std::asin(x.v), 1.0 / std::sqrt(1.0 - x.v * x.v));
+}
+
+template <int N>
+inline DualT<N> atan(const DualT<N> &x)
+{
+    return x.chain(std::atan(x.v), 1.0 / (1.0 + x.v * x.v));
+}
+
+template <int N>
+inline DualT<N> atan2(const DualT<N> &y, const DualT<N> &x)
+{
+    const double inv = 1.0 / (x.v * x.v + y.v * y.v);
+    DualT<N> result(std::atan2(y.v, x.v));
+    DUAL_UNROLL
+    for (int i = 0; i < N; ++i)
+        result.d[i] = (x.v * y.d[i] - y.v * x.d[i]) * inv;
+    return result;
+}
+
+template <int N>
+inline DualT<N> erf(const DualT<N> &x)
+{
+    return x.chain(std::erf(x.v), 2.0 * INV_SQRT_M_PI * std::exp(-x.v * x.v));
+}
+
+// derivative: the digamma function
+template <int N>
+inline DualT<N> lgamma(const DualT<N> &x)
+{
+    // recurrence to x >= 6, then the asymptotic series
+    double z = x.v;
+    double digamma = 0.0;
+    while (z < 6.0)
+    {
+        digamma -= 1.0 / z;
+        z += 1.0;
+    }
+    const double inv2 = 1.0 / (z * z);
+    digamma += std::log(z) - 0.5 / z - inv2 * (1.0 / 12.0 - inv2 * (1.0 / 120.0 - inv2 * (1.0 / 252.0 - inv2 * (1.0 / 240.0 - inv2 / 132.0))));
+    return x.chain(std::lgamma(x.v), digamma);
+}
+
+template <int N>
+inline DualT<N> tgamma(const DualT<N> &x)
+{
+    return exp(lgamma(x));
+}
+
+template <int N>
+inline bool IsFiniteNumber(const DualT<N> &x)
+{
+    return IsFiniteNumber(x.v);
+}
+
+template <int N>
+inline DualT<N> sign(const DualT<N> &x)
+{
+    return DualT<N>(sign(x.v));
+}
+
+template <int N>
+inline DualT<N> erfinv(const DualT<N> &x)
+{
+    const double value = erfinv(x.v);
+    return x.chain(value, 0.5 * SQRT_M_PI * std::exp(value * value));
+}
@@ -23,7 +23,10 @@
 // Fresnel
 //////////////////////////////////////////////////////////////////////////////////
 
-inline double evalF(const double g, const double c)
+// templated on the precision tier (see vector.h)
+
+template <class Float>
+inline Float evalF(const Float g, const Float c)
 {
   return (pow(-c + g, 2) * (1 + pow(-1 + c * (c + g), 2) / pow(1 + c * (-c + g), 2))) /
          (2. * pow(c + g, 2));
@@ -31,53 +34,63 @@ inline double evalF(const double g, const double c)
 
 // costheta = 1 is normal incidence
 // eta is ratio of new medium / current medium
-inline double DielectricR(const double costheta, const double eta)
+template <class Float>
+inline Float DielectricR(const Float costheta, const Float eta)
 {
-  const double sqrtinput = eta * eta - 1.0 + costheta * costheta;
-  if (sqrtinput <= 0.0)
+  const Float sqrtinput = eta * eta - Float(1) + costheta * costheta;
+  if (sqrtinput <= Float(0))
   {
-    return 1.0;
+    return Float(1);
   }
   else
   {
-    return evalF(sqrt(std::max(0.0, sqrtinput)), costheta);
+    return evalF(Float(sqrt(std::max(Float(0), sqrtinput))), costheta);
   }
 }
 
 // careful: "in" here is the direction light is MOVING before striking the surface
 //  (pointing away from the camera/light)
-inline Vector3 refract(const Vector3 in, const Vector3 normal, const double etai, const double etat)
+template <class Float>
+inline Vector3T<Float> refract(const Vector3T<Float> in, const Vector3T<Float> normal, const Float etai, const Float etat)
 {
   return (etai * (in - normal * dot(in, normal))) / etat -
-         normal * Sqrt(1 - (pow(etai, 2) * (1 - pow(dot(in, normal), 2))) / pow(etat, 2));
+         normal * Float(Sqrt(1 - (pow(etai, 2) * (1 - pow(dot(in, normal), 2))) / pow(etat, 2)));
 }
 
-inline double refractCosine(const double ui, const double etai, const double etao)
+template <class Float>
+inline Float refractCosine(const Float ui, const Float etai, const Float etao)
 {
-  return sqrt(1.0 - etai * etai * (1.0 - ui * ui) / (etao * etao));
+  return sqrt(Float(1) - etai * etai * (Float(1) - ui * ui) / (etao * etao));
+}
+
+// the closed form of ConductorR(), for a nonzero ior (branch free, so Float may also be a SIMD Packet)
+template <class Float>
+inline Float ConductorRClosedForm(const Float costheta, const Float etai, const Float eta, const Float k)
+{
+  // the repeated subexpressions of the closed form, computed once (auto: the same types as in the closed form, e.g.
+  // double for Float = float)
+  const auto c2 = Power(costheta, 2);
+  const auto etai2 = Power(etai, 2);
+  const auto eta2 = Power(eta, 2);
+  const auto k2 = Power(k, 2);
+  const auto root = Sqrt(4 * eta2 * k2 + Power(eta2 + (-1 + c2) * etai2 - k2, 2));
+  const auto root_expanded = Sqrt(Power(eta, 4) + Power(-((-1 + c2) * etai2) + k2, 2) + 2 * eta2 * ((-1 + c2) * etai2 + k2));
+  const auto b = Sqrt(2) * costheta * etai * Sqrt(eta2 - etai2 + c2 * etai2 - k2 + root);
+
+  return ((etai2 - 2 * c2 * etai2 + Power(costheta, 4) * etai2 + c2 * root) * (c2 * etai2 + root - b)) /
+         ((c2 * etai2 + root + b) *
+          (Power(-1 + c2, 2) * etai2 + c2 * root_expanded -
+           Sqrt(2) * costheta * (-1 + c2) * etai * Sqrt(eta2 - etai2 + c2 * etai2 - k2 + root_expanded)));
 }
 
-inline double ConductorR(const double costheta, const double etai, const double eta, const double k)
+template <class Float>
+inline Float ConductorR(const Float costheta, const Float etai, const Float eta, const Float k)
 {
     if (eta == 0. && k == 0.) {
         return 1.;
     }
 
-  return ((Power(etai, 2) - 2 * Power(costheta, 2) * Power(etai, 2) + Power(costheta, 4) * Power(etai, 2) +
-           Power(costheta, 2) * Sqrt(4 * Power(eta, 2) * Power(k, 2) +
-                                     Power(Power(eta, 2) + (-1 + Power(costheta, 2)) * Power(etai, 2) - Power(k, 2), 2))) *
-          (Power(costheta, 2) * Power(etai, 2) + Sqrt(4 * Power(eta, 2) * Power(k, 2) + Power(Power(eta, 2) + (-1 + Power(costheta, 2)) * Power(etai, 2) - Power(k, 2), 2)) -
-           Sqrt(2) * costheta * etai * Sqrt(Power(eta, 2) - Power(etai, 2) + Power(costheta, 2) * Power(etai, 2) - Power(k, 2) + Sqrt(4 * Power(eta, 2) * Power(k, 2) + Power(Power(eta, 2) + (-1 + Power(costheta, 2)) * Power(etai, 2) - Power(k, 2), 2))))) /
-         ((Power(costheta, 2) * Power(etai, 2) + Sqrt(4 * Power(eta, 2) * Power(k, 2) + Power(Power(eta, 2) + (-1 + Power(costheta, 2)) * Power(etai, 2) - Power(k, 2), 2)) +
-           Sqrt(2) * costheta * etai * Sqrt(Power(eta, 2) - Power(etai, 2) + Power(costheta, 2) * Power(etai, 2) - Power(k, 2) + Sqrt(4 * Power(eta, 2) * Power(k, 2) + Power(Power(eta, 2) + (-1 + Power(costheta, 2)) * Power(etai, 2) - Power(k, 2), 2)))) *
-          (Power(-1 + Power(costheta, 2), 2) * Power(etai, 2) +
-           Power(costheta, 2) * Sqrt(Power(eta, 4) +
-                                     Power(-((-1 + Power(costheta, 2)) * Power(etai, 2)) + Power(k, 2), 2) +
-                                     2 * Power(eta, 2) * ((-1 + Power(costheta, 2)) * Power(etai, 2) + Power(k, 2))) -
-           Sqrt(2) * costheta * (-1 + Power(costheta, 2)) * etai *
-               Sqrt(Power(eta, 2) - Power(etai, 2) + Power(costheta, 2) * Power(etai, 2) - Power(k, 2) +
-                    Sqrt(Power(eta, 4) + Power(-((-1 + Power(costheta, 2)) * Power(etai, 2)) + Power(k, 2), 2) +
-                         2 * Power(eta, 2) * ((-1 + Power(costheta, 2)) * Power(etai, 2) + Power(k, 2))))));
+  return ConductorRClosedForm(costheta, etai, eta, k);
 }
 
 // exact [Dunkle 1963]
@@ -0,0 +1,864 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SIMD packet types: PACKET_WIDTH independent lanes of doubles, masks and vectors.
+// The operations are written with AVX-512 (8 lanes) or AVX2 (4 lanes) intrinsics, whichever the target has
+// (e.g. g++ -O3 -march=native), and fall back to loops over the lanes otherwise.
+// Transcendentals are vectorized polynomial and rational approximations (from Cephes) accurate to a few ulps,
+// so the packet code needs neither -ffast-math nor a vector math library.
+
+#pragma once
+
+#include <vector.h>
+#include <random.h>
+#include <math_functions.h>
+
+#include <cmath>
+#include <limits>
+
+#ifndef PACKET_WIDTH
+#if defined(__AVX512F__)
+#define PACKET_WIDTH 8
+#else
+#define PACKET_WIDTH 4
+#endif
+#endif
+
+#if (PACKET_WIDTH == 8) && defined(__AVX512F__)
+#define PACKET_AVX512
+#elif (PACKET_WIDTH == 4) && defined(__AVX2__)
+#define PACKET_AVX2
+#endif
+
+#if defined(PACKET_AVX512) || defined(PACKET_AVX2)
+#include <immintrin.h>
+#endif
+
+#define PACKET_LOOP for (int l = 0; l < PACKET_WIDTH; ++l)
+
+//////////////////////////////////////////////////////////////////////////////////
+// PacketMask
+//////////////////////////////////////////////////////////////////////////////////
+
+// AVX-512: one bit per lane, AVX2 and loops: all bits of the lane set
+struct alignas(PACKET_WIDTH * 8) PacketMask
+{
+    PacketMask() {}
+
+    PacketMask(const bool b)
+    {
+#if defined(PACKET_AVX512)
+        k = b ? 0xFF : 0;
+#elif defined(PACKET_AVX2)
+        r = _mm256_castsi256_pd(_mm256_set1_epi64x(b ? -1 : 0));
+#else
+        PACKET_LOOP m[l] = b ? -1 : 0;
+#endif
+    }
+
+#if defined(PACKET_AVX512)
+    explicit PacketMask(const __mmask8 in_k)
+        : k(in_k) {}
+
+    __mmask8 k;
+
+    bool operator[](const int l) const
+    {
+        return (k >> l) & 1;
+    }
+
+    void set(const int l, const bool b)
+    {
+        k = b ? (k | (1 << l)) : (k & ~(1 << l));
+    }
+#else
+#if defined(PACKET_AVX2)
+    explicit PacketMask(const __m256d in_r)
+        : r(in_r) {}
+
+    union
+    {
+        __m256d r;
+        int64_t m[PACKET_WIDTH];
+    };
+#else
+    int64_t m[PACKET_WIDTH];
+#endif
+
+    bool operator[](const int l) const
+    {
+        return m[l] != 0;
+    }
+
+    void set(const int l, const bool b)
+    {
+        m[l] = b ? -1 : 0;
+    }
+#endif
+};
+
+inline PacketMask operator&(const PacketMask &a, const PacketMask &b)
+{
+#if defined(PACKET_AVX512)
+    return PacketMask(__mmask8(a.k & b.k));
+#elif defined(PACKET_AVX2)
+    return PacketMask(_mm256_and_pd(a.r, b.r));
+#else
+    PacketMask r;
+    PACKET_LOOP r.m[l] = a.m[l] & b.m[l];
+    return r;
+#endif
+}
+
+inline PacketMask operator|(const PacketMask &a, const PacketMask &b)
+{
+#if defined(PACKET_AVX512)
+    return PacketMask(__mmask8(a.k | b.k));
+#elif defined(PACKET_AVX2)
+    return PacketMask(_mm256_or_pd(a.r, b.r));
+#else
+    PacketMask r;
+    PACKET_LOOP r.m[l] = a.m[l] | b.m[l];
+    return r;
+#endif
+}
+
+inline PacketMask operator!(const PacketMask &a)
+{
+#if defined(PACKET_AVX512)
+    return PacketMask(__mmask8(~a.k));
+#elif defined(PACKET_AVX2)
+    return PacketMask(_mm256_xor_pd(a.r, PacketMask(true).r));
+#else
+    PacketMask r;
+    PACKET_LOOP r.m[l] = ~a.m[l];
+    return r;
+#endif
+}
+
+inline PacketMask operator^(const PacketMask &a, const PacketMask &b)
+{
+#if defined(PACKET_AVX512)
+    return PacketMask(__mmask8(a.k ^ b.k));
+#elif defined(PACKET_AVX2)
+    return PacketMask(_mm256_xor_pd(a.r, b.r));
+#else
+    PacketMask r;
+    PACKET_LOOP r.m[l] = a.m[l] ^ b.m[l];
+    return r;
+#endif
+}
+
+inline bool any(const PacketMask &a)
+{
+#if defined(PACKET_AVX512)
+    return a.k != 0;
+#elif defined(PACKET_AVX2)
+    return _mm256_movemask_pd(a.r) != 0;
+#else
+    int64_t r = 0;
+    PACKET_LOOP r |= a.m[l];
+    return r != 0;
+#endif
+}
+
+inline bool all(const PacketMask &a)
+{
+#if defined(PACKET_AVX512)
+    return a.k == 0xFF;
+#elif defined(PACKET_AVX2)
+    return _mm256_movemask_pd(a.r) == 0xF;
+#else
+    int64_t r = -1;
+    PACKET_LOOP r &= a.m[l];
+    return r != 0;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Packet
+//////////////////////////////////////////////////////////////////////////////////
+
+struct alignas(PACKET_WIDTH * 8) Packet
+{
+    Packet() {}
+
+    Packet(const double c)
+    {
+#if defined(PACKET_AVX512)
+        r = _mm512_set1_pd(c);
+#elif defined(PACKET_AVX2)
+        r = _mm256_set1_pd(c);
+#else
+        PACKET_LOOP v[l] = c;
+#endif
+    }
+
+#if defined(PACKET_AVX512)
+    explicit Packet(const __m512d in_r)
+        : r(in_r) {}
+
+    union
+    {
+        __m512d r;
+        double v[PACKET_WIDTH];
+    };
+#elif defined(PACKET_AVX2)
+    explicit Packet(const __m256d in_r)
+        : r(in_r) {}
+
+    union
+    {
+        __m256d r;
+        double v[PACKET_WIDTH];
+    };
+#else
+    double v[PACKET_WIDTH];
+#endif
+
+    double &operator[](const int l)
+    {
+        return v[l];
+    }
+
+    double operator[](const int l) const
+    {
+        return v[l];
+    }
+
+    Packet operator-() const
+    {
+#if defined(PACKET_AVX512)
+        return Packet(_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(r), _mm512_set1_epi64(int64_t(0x8000000000000000ull)))));
+#elif defined(PACKET_AVX2)
+        return Packet(_mm256_xor_pd(r, _mm256_set1_pd(-0.0)));
+#else
+        Packet r;
+        PACKET_LOOP r.v[l] = -v[l];
+        return r;
+#endif
+    }
+};
+
+#if defined(PACKET_AVX512)
+#define PACKET_BINARY_OP(OP, INTRINSIC)                                    \
+    inline Packet operator OP(const Packet &a, const Packet &b)            \
+    {                                                                      \
+        return Packet(_mm512_##INTRINSIC##_pd(a.r, b.r));                  \
+    }
+#define PACKET_COMPARE_OP(OP, PREDICATE)                                   \
+    inline PacketMask operator OP(const Packet &a, const Packet &b)        \
+    {                                                                      \
+        return PacketMask(_mm512_cmp_pd_mask(a.r, b.r, PREDICATE));        \
+    }
+#elif defined(PACKET_AVX2)
+#define PACKET_BINARY_OP(OP, INTRINSIC)                                    \
+    inline Packet operator OP(const Packet &a, const Packet &b)            \
+    {                                                                      \
+        return Packet(_mm256_##INTRINSIC##_pd(a.r, b.r));                  \
+    }
+#define PACKET_COMPARE_OP(OP, PREDICATE)                                   \
+    inline PacketMask operator OP(const Packet &a, const Packet &b)        \
+    {                                                                      \
+        return PacketMask(_mm256_cmp_pd(a.r, b.r, PREDICATE));             \
+    }
+#else
+#define PACKET_BINARY_OP(OP, INTRINSIC)                                    \
+    inline Packet operator OP(const Packet &a, const Packet &b)            \
+    {                                                                      \
+        Packet r;                                                          \
+        PACKET_LOOP r.v[l] = a.v[l] OP b.v[l];                             \
+        return r;                                                          \
+    }
+#define PACKET_COMPARE_OP(OP, PREDICATE)                                   \
+    inline PacketMask operator OP(const Packet &a, const Packet &b)        \
+    {                                                                      \
+        PacketMask r;                                                      \
+        PACKET_LOOP r.m[l] = (a.v[l] OP b.v[l]) ? -1 : 0;                  \
+        return r;                                                          \
+    }
+#endif
+
+PACKET_BINARY_OP(+, add)
+PACKET_BINARY_OP(-, sub)
+PACKET_BINARY_OP(*, mul)
+PACKET_BINARY_OP(/, div)
+
+// ordered predicates, except !=, as for doubles: comparisons with NaN are false, except !=
+PACKET_COMPARE_OP(<, _CMP_LT_OQ)
+PACKET_COMPARE_OP(<=, _CMP_LE_OQ)
+PACKET_COMPARE_OP(>, _CMP_GT_OQ)
+PACKET_COMPARE_OP(>=, _CMP_GE_OQ)
+PACKET_COMPARE_OP(==, _CMP_EQ_OQ)
+PACKET_COMPARE_OP(!=, _CMP_NEQ_UQ)
+
+// per lane: mask ? a : b
+inline Packet select(const PacketMask &mask, const Packet &a, const Packet &b)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_mask_blend_pd(mask.k, b.r, a.r));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_blendv_pd(b.r, a.r, mask.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = mask.m[l] ? a.v[l] : b.v[l];
+    return r;
+#endif
+}
+
+inline Packet sqrt(const Packet &a)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_sqrt_pd(a.r));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_sqrt_pd(a.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::sqrt(a.v[l]);
+    return r;
+#endif
+}
+
+inline Packet abs(const Packet &a)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a.r), _mm512_set1_epi64(0x7FFFFFFFFFFFFFFFll))));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::abs(a.v[l]);
+    return r;
+#endif
+}
+
+inline Packet floor(const Packet &a)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_roundscale_pd(a.r, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_floor_pd(a.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::floor(a.v[l]);
+    return r;
+#endif
+}
+
+// same as std::max(a, b) and std::min(a, b), also when b is NaN (max(0.0, x) is 0.0 for x = NaN)
+inline Packet max(const Packet &a, const Packet &b)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_max_pd(b.r, a.r));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_max_pd(b.r, a.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::max(a.v[l], b.v[l]);
+    return r;
+#endif
+}
+
+inline Packet min(const Packet &a, const Packet &b)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_min_pd(b.r, a.r));
+#elif defined(PACKET_AVX2)
+    return Packet(_mm256_min_pd(b.r, a.r));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::min(a.v[l], b.v[l]);
+    return r;
+#endif
+}
+
+inline PacketMask isNaN(const Packet &a)
+{
+#if defined(PACKET_AVX512)
+    return PacketMask(_mm512_cmp_pd_mask(a.r, a.r, _CMP_UNORD_Q));
+#elif defined(PACKET_AVX2)
+    return PacketMask(_mm256_cmp_pd(a.r, a.r, _CMP_UNORD_Q));
+#else
+    PacketMask r;
+    PACKET_LOOP r.m[l] = std::isnan(a.v[l]) ? -1 : 0;
+    return r;
+#endif
+}
+
+// neither NaN nor infinite
+inline PacketMask isFinite(const Packet &a)
+{
+    return abs(a) < Packet(std::numeric_limits<double>::infinity());
+}
+
+inline Packet sign(const Packet &a)
+{
+    return select(a > 0.0, Packet(1.0), Packet(-1.0));
+}
+
+// a * 2^n for integral n, and the lanes of 2^n must be normal numbers (|n| <= 1022)
+inline Packet ldexp(const Packet &a, const Packet &n)
+{
+#if defined(PACKET_AVX512)
+    return Packet(_mm512_scalef_pd(a.r, n.r));
+#elif defined(PACKET_AVX2)
+    // the biased exponent in the low bits of the mantissa of 2^52 + n + 1023, shifted into the exponent
+    const __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n.r, _mm256_set1_pd(4503599627370496.0 + 1023.0)));
+    return a * Packet(_mm256_castsi256_pd(_mm256_slli_epi64(bits, 52)));
+#else
+    Packet r;
+    PACKET_LOOP r.v[l] = std::ldexp(a.v[l], int(n.v[l]));
+    return r;
+#endif
+}
+
+// a = mantissa * 2^exponent with the mantissa in [0.5, 1), for positive normal lanes
+inline Packet frexp(const Packet &a, Packet &exponent)
+{
+#if defined(PACKET_AVX512)
+    exponent = Packet(_mm512_getexp_pd(a.r)) + 1.0;
+    return Packet(_mm512_getmant_pd(a.r, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_zero));
+#elif defined(PACKET_AVX2)
+    const __m256i bits = _mm256_castpd_si256(a.r);
+    const __m256d biased = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0))));
+    exponent = Packet(biased) - (4503599627370496.0 + 1022.0);
+    const __m256i mantissa = _mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFll));
+    return Packet(_mm256_castsi256_pd(_mm256_or_si256(mantissa, _mm256_castpd_si256(_mm256_set1_pd(0.5)))));
+#else
+    Packet r;
+    PACKET_LOOP
+    {
+        int e;
+        r.v[l] = std::frexp(a.v[l], &e);
+        exponent.v[l] = double(e);
+    }
+    return r;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Packet math functions
+//////////////////////////////////////////////////////////////////////////////////
+
+// c[0] x^(N-1) + c[1] x^(N-2) + ... + c[N-1]
+template <int N>
+inline Packet polynomial(const Packet &x, const double (&c)[N])
+{
+    Packet p(c[0]);
+    for (int i = 1; i < N; ++i)
+        p = p * x + c[i];
+    return p;
+}
+
+// x = n log(2) + r with |r| <= log(2)/2, exp(r) = 1 + 2 r P(r^2) / (Q(r^2) - r P(r^2))
+inline Packet exp(const Packet &x)
+{
+    const double P[] = {1.26177193074810590878E-4, 3.02994407707441961300E-2, 9.99999999999999999910E-1};
+    const double Q[] = {3.00198505138664455042E-6, 2.52448340349684104192E-3, 2.27265548208155028766E-1, 2.00000000000000000009E0};
+
+    const Packet n = floor(1.4426950408889634073599 * x + 0.5);
+    const Packet r = (x - n * 6.93145751953125E-1) - n * 1.42860682030941723212E-6;
+    const Packet r2 = r * r;
+    const Packet p = r * polynomial(r2, P);
+    const Packet e = 1.0 + 2.0 * p / (polynomial(r2, Q) - p);
+
+    // 2^n in two factors, so that subnormal results are not flushed to zero
+    const Packet n_half = floor(0.5 * min(max(n, Packet(-1100.0)), Packet(1100.0)));
+    const Packet value = ldexp(ldexp(e, n_half), n - n_half);
+    return select(x > 709.782712893384, Packet(std::numeric_limits<double>::infinity()), select(x < -745.2, Packet(0.0), value));
+}
+
+// x = 2^e (1 + f) with sqrt(1/2) <= 1 + f < sqrt(2), log(1 + f) = f - f^2/2 + f^3 P(f) / Q(f)
+inline Packet log(const Packet &x)
+{
+    const double P[] = {1.01875663804580931796E-4, 4.97494994976747001425E-1, 4.70579119878881725854E0,
+                        1.44989225341610930846E1, 1.79368678507819816313E1, 7.70838733755885391666E0};
+    const double Q[] = {1.0, 1.12873587189167450590E1, 4.52279145837532221105E1, 8.29875266912776603211E1,
+                        7.11544750618563894466E1, 2.31251620126765340583E1};
+
+    // subnormals are scaled into the normal range first
+    const PacketMask subnormal = x < 2.2250738585072014e-308;
+    Packet e;
+    Packet m = frexp(select(subnormal, x * 18014398509481984.0, x), e);
+    e = select(subnormal, e - 54.0, e);
+
+    const PacketMask low = m < 0.70710678118654752440;
+    e = select(low, e - 1.0, e);
+    const Packet f = select(low, m + m, m) - 1.0;
+
+    const Packet f2 = f * f;
+    Packet y = f * (f2 * polynomial(f, P) / polynomial(f, Q));
+    y = y - e * 2.121944400546905827679e-4;
+    y = y - 0.5 * f2;
+    const Packet value = (f + y) + e * 0.693359375;
+
+    const Packet infinity(std::numeric_limits<double>::infinity());
+    return select(x == 0.0, -infinity, select(x < 0.0, Packet(std::numeric_limits<double>::quiet_NaN()),
+                                              select(x == infinity, infinity, select(isNaN(x), x, value))));
+}
+
+// |x| = y pi/4 + z with y even and |z| <= pi/4, then a polynomial for sin(z) or cos(z) by the octant y mod 8
+inline void sincos(const Packet &x, Packet &out_sin, Packet &out_cos)
+{
+    const double S[] = {1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+                        -1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1};
+    const double C[] = {-1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+                        2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2};
+
+    const Packet ax = abs(x);
+    Packet y = floor(ax * 1.27323954473516268615);
+    y = y + (y - 2.0 * floor(0.5 * y)); // to the next even octant
+    const Packet octant = y - 8.0 * floor(0.125 * y);
+
+    const Packet z = ((ax - y * 7.85398125648498535156E-1) - y * 3.77489470793079817668E-8) - y * 2.69515142907905952645E-15;
+    const Packet z2 = z * z;
+    const Packet poly_sin = z + z * z2 * polynomial(z2, S);
+    const Packet poly_cos = 1.0 - 0.5 * z2 + z2 * z2 * polynomial(z2, C);
+
+    // octants 0 and 4: sin(z), cos(z), octants 2 and 6: cos(z), -sin(z); both negated in octants 4 and 6
+    const PacketMask swap = (octant == 2.0) | (octant == 6.0);
+    const PacketMask negate = octant >= 4.0;
+    const Packet s = select(swap, poly_cos, poly_sin);
+    const Packet c = select(swap, -poly_sin, poly_cos);
+    out_sin = select(negate ^ (x < 0.0), -s, s);
+    out_cos = select(negate, -c, c);
+}
+
+inline Packet sin(const Packet &x)
+{
+    Packet s, c;
+    sincos(x, s, c);
+    return s;
+}
+
+inline Packet cos(const Packet &x)
+{
+    Packet s, c;
+    sincos(x, s, c);
+    return c;
+}
+
+inline Packet tan(const Packet &x)
+{
+    Packet s, c;
+    sincos(x, s, c);
+    return s / c;
+}
+
+// reduced to |x| <= tan(pi/8) with atan(x) = pi/2 + atan(-1/x) or pi/4 + atan((x-1)/(x+1)),
+// then atan(x) = x + x^3 P(x^2) / Q(x^2)
+inline Packet atan(const Packet &x)
+{
+    const double P[] = {-8.750608600031904122785E-1, -1.615753718733365076637E1, -7.500855792314704667340E1,
+                        -1.228866684490136173410E2, -6.485021904942025371773E1};
+    const double Q[] = {1.0, 2.485846490142306297962E1, 1.650270098316988542046E2, 4.328810604912902668951E2,
+                        4.853903996359136964868E2, 1.945506571482613964425E2};
+    const double more_bits = 6.123233995736765886130E-17; // pi/2 - double(pi/2)
+
+    const Packet ax = abs(x);
+    const PacketMask big = ax > 2.41421356237309504880;
+    const PacketMask mid = (ax > 0.66) & !big;
+    const Packet r = select(big, -1.0 / ax, select(mid, (ax - 1.0) / (ax + 1.0), ax));
+    const Packet base = select(big, Packet(0.5 * Pi), select(mid, Packet(0.25 * Pi), Packet(0.0)));
+    const Packet base_low = select(big, Packet(more_bits), select(mid, Packet(0.5 * more_bits), Packet(0.0)));
+
+    const Packet r2 = r * r;
+    const Packet value = base + ((r + r * (r2 * polynomial(r2, P) / polynomial(r2, Q))) + base_low);
+    return select(x < 0.0, -value, value);
+}
+
+// as std::atan2(), except for the signs of zeros
+inline Packet atan2(const Packet &y, const Packet &x)
+{
+    const Packet value = atan(y / x);
+    const Packet quadrant = select(x < 0.0, select(y < 0.0, Packet(-Pi), Packet(Pi)), Packet(0.0));
+    return select((x == 0.0) & (y == 0.0), select(x < 0.0, Packet(Pi), Packet(0.0)), value + quadrant);
+}
+
+inline Packet acos(const Packet &x)
+{
+    return atan2(sqrt((1.0 - x) * (1.0 + x)), x);
+}
+
+// erf(x) = x T(x^2) / U(x^2) for |x| <= 1, 1 - erfc(x) above with erfc(x) = exp(-x^2) P(x) / Q(x) (1 to double
+// precision above 6)
+inline Packet erf(const Packet &x)
+{
+    const double T[] = {9.60497373987051638749E0, 9.00260197203842689217E1, 2.23200534594684319226E3,
+                        7.00332514112805075473E3, 5.55923013010394962768E4};
+    const double U[] = {1.0, 3.35617141647503099647E1, 5.21357949780152679795E2, 4.59432382970980127987E3,
+                        2.26290000613890934246E4, 4.92673942608635921086E4};
+    const double P[] = {2.46196981473530512524E-10, 5.64189564831068821977E-1, 7.46321056442269912687E0,
+                        4.86371970985681366614E1, 1.96520832956077098242E2, 5.26445194995477358631E2,
+                        9.34528527171957607540E2, 1.02755188689515710272E3, 5.57535335369399327526E2};
+    const double Q[] = {1.0, 1.32281951154744992508E1, 8.67072140885989742329E1, 3.54937778887819891062E2,
+                        9.75708501743205489753E2, 1.82390916687909736289E3, 2.24633760818710981792E3,
+                        1.65666309194161350182E3, 5.57535340817727675546E2};
+
+    const Packet x2 = x * x;
+    const Packet small = x * polynomial(x2, T) / polynomial(x2, U);
+
+    const Packet ax = min(abs(x), Packet(6.0));
+    const Packet large = 1.0 - exp(-ax * ax) * polynomial(ax, P) / polynomial(ax, Q);
+    return select(abs(x) <= 1.0, small, select(x < 0.0, -large, large));
+}
+
+// same approximation as erfinv(double)
+inline Packet erfinv(const Packet &x)
+{
+    const double P_center[] = {2.81022636e-08, 3.43273939e-07, -3.5233877e-06, -4.39150654e-06, 0.00021858087,
+                               -0.00125372503, -0.00417768164, 0.246640727, 1.50140941};
+    const double P_tail[] = {-0.000200214257, 0.000100950558, 0.00134934322, -0.00367342844, 0.00573950773,
+                             -0.0076224613, 0.00943887047, 1.00167406, 2.83297682};
+
+    const Packet w = -log((1.0 - x) * (1.0 + x));
+    const Packet p = select(w < 5.0, polynomial(w - 2.5, P_center), polynomial(sqrt(w) - 3.0, P_tail));
+    return p * x;
+}
+
+// for a >= 0 (integral powers up to 4 of any a are exact products)
+inline Packet pow(const Packet &a, const Packet &b)
+{
+    const Packet value = exp(b * log(a));
+    return select(b == 0.0, Packet(1.0), value);
+}
+
+inline Packet pow(const Packet &a, const double b)
+{
+    if (b == 2.0)
+        return a * a;
+    if (b == 3.0)
+        return a * a * a;
+    if (b == 4.0)
+    {
+        const Packet a2 = a * a;
+        return a2 * a2;
+    }
+    return pow(a, Packet(b));
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// PacketVector3
+//////////////////////////////////////////////////////////////////////////////////
+
+struct PacketVector3
+{
+    PacketVector3(const Packet &in_x, const Packet &in_y, const Packet &in_z)
+        : x(in_x), y(in_y), z(in_z){};
+
+    PacketVector3(const Vector3 &v)
+        : x(v.x), y(v.y), z(v.z){};
+
+    PacketVector3() {}
+
+    Packet x, y, z;
+
+    Vector3 get(const int l) const
+    {
+        return Vector3(x[l], y[l], z[l]);
+    }
+
+    void set(const int l, const Vector3 &v)
+    {
+        x[l] = v.x;
+        y[l] = v.y;
+        z[l] = v.z;
+    }
+
+    PacketVector3 operator-() const
+    {
+        return PacketVector3(-x, -y, -z);
+    }
+};
+
+inline PacketVector3 operator+(const PacketVector3 &a, const PacketVector3 &b)
+{
+    return PacketVector3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+inline PacketVector3 operator-(const PacketVector3 &a, const PacketVector3 &b)
+{
+    return PacketVector3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+inline PacketVector3 operator*(const Packet &c, const PacketVector3 &v)
+{
+    return PacketVector3(c * v.x, c * v.y, c * v.z);
+}
+
+inline PacketVector3 operator*(const PacketVector3 &v, const Packet &c)
+{
+    return PacketVector3(c * v.x, c * v.y, c * v.z);
+}
+
+inline PacketVector3 operator/(const PacketVector3 &v, const Packet &c)
+{
+    return PacketVector3(v.x / c, v.y / c, v.z / c);
+}
+
+inline Packet dot(const PacketVector3 &a, const PacketVector3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline PacketVector3 normalize(const PacketVector3 &v)
+{
+    return v * (1.0 / sqrt(dot(v, v)));
+}
+
+inline PacketVector3 reflect(const PacketVector3 &in, const PacketVector3 &n)
+{
+    return -in + 2.0 * dot(in, n) * n;
+}
+
+inline PacketVector3 select(const PacketMask &mask, const PacketVector3 &a, const PacketVector3 &b)
+{
+    return PacketVector3(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z));
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// PacketPhilox - one counter-based random stream per lane
+//////////////////////////////////////////////////////////////////////////////////
+
+// each lane runs its own query and walk event: lane l draws dimension
+//   event[l] * PACKET_EVENT_DIMENSIONS + d
+// of PhiloxSampler(seed) after startQuery(query[l]), where d counts the calls to next() since startEvents()
+// (all lanes advance d together, so every Philox block serves two consecutive calls)
+#define PACKET_EVENT_DIMENSIONS 16
+
+class PacketPhilox
+{
+public:
+    PacketPhilox(const uint64_t seed)
+        : m_seed(seed), m_dimension(0)
+    {
+        for (int l = 0; l < PACKET_WIDTH; ++l)
+        {
+            m_query[l] = 0;
+            m_event[l] = 0;
+        }
+    }
+
+    void startQuery(const int lane, const uint64_t query)
+    {
+        m_query[lane] = query;
+        m_event[lane] = 0;
+    }
+
+    // start the walk event event[l] in every lane
+    void startEvents(const Packet &event)
+    {
+        for (int l = 0; l < PACKET_WIDTH; ++l)
+            m_event[l] = uint64_t(event[l]);
+        m_dimension = 0;
+    }
+
+    Packet next()
+    {
+        assert(m_dimension < PACKET_EVENT_DIMENSIONS);
+        const int half = int(m_dimension & 1);
+        const uint64_t offset = m_dimension >> 1;
+        m_dimension++;
+
+        if (half)
+            return m_cache;
+
+#if defined(PACKET_AVX512) || defined(PACKET_AVX2)
+        // philox4x32() and bitsToUnitDouble() in every lane, with the 32-bit words of the counter in 64-bit lanes
+        const Lanes low_bits = broadcast(0xFFFFFFFFu);
+        const Lanes query = load(m_query);
+        const Lanes block = add(shiftLeft<3>(load(m_event)), broadcast(offset));
+        static_assert(PACKET_EVENT_DIMENSIONS / 2 == 8, "block = event * 8 + offset");
+
+        Lanes c0 = bitAnd(query, low_bits), c1 = shiftRight<32>(query);
+        Lanes c2 = bitAnd(block, low_bits), c3 = shiftRight<32>(block);
+        uint32_t k0 = uint32_t(m_seed);
+        uint32_t k1 = uint32_t(m_seed >> 32);
+        for (int round = 0; round < 10; ++round)
+        {
+            const Lanes p0 = multiply32(broadcast(0xD2511F53u), c0);
+            const Lanes p1 = multiply32(broadcast(0xCD9E8D57u), c2);
+            c0 = bitXor(bitXor(shiftRight<32>(p1), c1), broadcast(k0));
+            c2 = bitXor(bitXor(shiftRight<32>(p0), c3), broadcast(k1));
+            c1 = bitAnd(p1, low_bits);
+            c3 = bitAnd(p0, low_bits);
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+
+        m_cache = unitDouble(c2, c3);
+        return unitDouble(c0, c1);
+#else
+        Packet r;
+        for (int l = 0; l < PACKET_WIDTH; ++l)
+        {
+            const uint64_t block = m_event[l] * (PACKET_EVENT_DIMENSIONS / 2) + offset;
+            uint32_t counter[4] = {uint32_t(m_query[l]), uint32_t(m_query[l] >> 32), uint32_t(block), uint32_t(block >> 32)};
+            philox4x32(counter, m_seed);
+            r.v[l] = bitsToUnitDouble(counter[0], counter[1]);
+            m_cache.v[l] = bitsToUnitDouble(counter[2], counter[3]);
+        }
+        return r;
+#endif
+    }
+
+private:
+    uint64_t m_seed;
+    alignas(PACKET_WIDTH * 8) uint64_t m_query[PACKET_WIDTH];
+    alignas(PACKET_WIDTH * 8) uint64_t m_event[PACKET_WIDTH];
+    uint64_t m_dimension;
+    Packet m_cache;
+
+#if defined(PACKET_AVX512)
+    typedef __m512i Lanes;
+
+    static Lanes load(const uint64_t *values) { return _mm512_load_si512(values); }
+    static Lanes broadcast(const uint64_t c) { return _mm512_set1_epi64(int64_t(c)); }
+    static Lanes add(const Lanes a, const Lanes b) { return _mm512_add_epi64(a, b); }
+    static Lanes bitAnd(const Lanes a, const Lanes b) { return _mm512_and_si512(a, b); }
+    static Lanes bitOr(const Lanes a, const Lanes b) { return _mm512_or_si512(a, b); }
+    static Lanes bitXor(const Lanes a, const Lanes b) { return _mm512_xor_si512(a, b); }
+    template <int N> static Lanes shiftLeft(const Lanes a) { return _mm512_slli_epi64(a, N); }
+    template <int N> static Lanes shiftRight(const Lanes a) { return _mm512_srli_epi64(a, N); }
+    static Lanes multiply32(const Lanes a, const Lanes b) { return _mm512_mul_epu32(a, b); } // of the low 32 bits
+    static Packet asDouble(const Lanes a) { return Packet(_mm512_castsi512_pd(a)); }
+#elif defined(PACKET_AVX2)
+    typedef __m256i Lanes;
+
+    static Lanes load(const uint64_t *values) { return _mm256_load_si256(reinterpret_cast<const __m256i *>(values)); }
+    static Lanes broadcast(const uint64_t c) { return _mm256_set1_epi64x(int64_t(c)); }
+    static Lanes add(const Lanes a, const Lanes b) { return _mm256_add_epi64(a, b); }
+    static Lanes bitAnd(const Lanes a, const Lanes b) { return _mm256_and_si256(a, b); }
+    static Lanes bitOr(const Lanes a, const Lanes b) { return _mm256_or_si256(a, b); }
+    static Lanes bitXor(const Lanes a, const Lanes b) { return _mm256_xor_si256(a, b); }
+    template <int N> static Lanes shiftLeft(const Lanes a) { return _mm256_slli_epi64(a, N); }
+    template <int N> static Lanes shiftRight(const Lanes a) { return _mm256_srli_epi64(a, N); }
+    static Lanes multiply32(const Lanes a, const Lanes b) { return _mm256_mul_epu32(a, b); } // of the low 32 bits
+    static Packet asDouble(const Lanes a) { return Packet(_mm256_castsi256_pd(a)); }
+#endif
+
+#if defined(PACKET_AVX512) || defined(PACKET_AVX2)
+    // bitsToUnitDouble(hi, lo): the top 53 bits as two exact halves of 27 and 26 bits, converted by adding 2^52
+    static Packet unitDouble(const Lanes hi, const Lanes lo)
+    {
+        const Lanes bits = shiftRight<11>(bitOr(shiftLeft<32>(hi), lo));
+        const Lanes two_52 = broadcast(0x4330000000000000ull);
+        const Packet top = asDouble(bitOr(shiftRight<26>(bits), two_52)) - 4503599627370496.0;
+        const Packet bottom = asDouble(bitOr(bitAnd(bits, broadcast(0x3FFFFFFull)), two_52)) - 4503599627370496.0;
+        return top * (1.0 / 134217728.0) + bottom * (1.0 / 9007199254740992.0);
+    }
+#endif
+};
@@ -18,6 +18,7 @@
 
 #include <vector.h>
 #include <random>
+#include <cstdint>
 #include <math.h>
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -25,75 +26,454 @@
 //////////////////////////////////////////////////////////////////////////////////
 
 #ifndef M_PI
-const double M_PI = 3.141592653f;
+const double M_PI = 3.14159265358979323846;
 #endif 
 
-extern std::mt19937 g_mt;
+//////////////////////////////////////////////////////////////////////////////////
+// Samplers
+//////////////////////////////////////////////////////////////////////////////////
+
+// dimension slots of a random-walk event (collision), each one a 2D pair of random numbers
+// QMC samplers give every slot of every event fixed low-discrepancy dimensions, so that
+// the dimensions of a bounce do not depend on how many numbers earlier bounces consumed
+enum SamplerSlot
+{
+    SLOT_FREE_PATH = 0, // free-path length to the next collision
+    SLOT_VNDF,          // visible normal sampling (sampleP22_11, null-collision disk sampling)
+    SLOT_VNDF_EXTRA,    // any further vNDF decisions (azimuth sign, Student-T m', null-collision acceptance)
+    SLOT_FACET,         // sampling the BSDF of the microfacet
+    SLOT_ROULETTE,      // Russian roulette
+    SLOT_WAVELENGTH,    // hero channel of a dispersive walk (drawn once, at event 0)
+    SLOT_COUNT
+};
+
+// source of uniform random numbers in [0,1) - threaded through sample()/eval() so that
+// a const BSDF/NDF graph can be queried from many threads at once, each with its own sampler
+// NB: samplers are stateful and must not be shared between threads
+class Sampler
+{
+public:
+    virtual ~Sampler() {}
+
+    virtual double next1D() = 0;
+
+    // start the random stream of query number 'index' - counter-based samplers restart at (seed, index, 0)
+    // so that any query can be replayed independently of the order in which queries are run
+    virtual void startQuery(const uint64_t index) {}
+
+    // QMC dimension management for random walks (no-ops for pseudo-random samplers):
+    // - walkDomain(): dimension domain for a new walk, derived from the current position in the
+    //   stream so that walks nested inside an event (biscale microsurfaces) get their own dimensions
+    // - startEvent(): select the dimensions of event 'index' of the walk with domain 'walk_domain'
+    // - startSlot(): switch to a slot of the current event; numbers drawn beyond the first two of a slot
+    //   (rejection loops, null collisions) continue with well-distributed pseudo-random numbers
+    virtual uint64_t walkDomain() const { return 0; }
+    virtual void startEvent(const uint64_t walk_domain, const uint64_t index) {}
+    virtual void startSlot(const SamplerSlot slot) {}
+};
+
+// Mersenne twister sampler (aligned so that per-thread instances never share a cache line)
+class alignas(64) MTSampler : public Sampler
+{
+public:
+    MTSampler()
+        : m_mt(std::random_device()())
+    {
+    }
+
+    MTSampler(const uint32_t seed)
+        : m_mt(seed)
+    {
+    }
+
+    virtual double next1D()
+    {
+        std::uniform_real_distribution<double> r(0., 1.);
+        return r(m_mt);
+    }
+
+    std::mt19937 m_mt;
+};
+
+// Philox4x32-10 counter-based generator [Salmon et al. 2011]: a pure function of a 128-bit counter and a 64-bit key
+inline void philox4x32(uint32_t counter[4], const uint64_t key)
+{
+    uint32_t k0 = uint32_t(key);
+    uint32_t k1 = uint32_t(key >> 32);
+
+    for (int round = 0; round < 10; ++round)
+    {
+        const uint64_t p0 = uint64_t(0xD2511F53u) * counter[0];
+        const uint64_t p1 = uint64_t(0xCD9E8D57u) * counter[2];
+
+        const uint32_t c0 = uint32_t(p1 >> 32) ^ counter[1] ^ k0;
+        const uint32_t c2 = uint32_t(p0 >> 32) ^ counter[3] ^ k1;
+        counter[1] = uint32_t(p1);
+        counter[3] = uint32_t(p0);
+        counter[0] = c0;
+        counter[2] = c2;
+
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+}
+
+// uniform double in [0,1) from 53 random bits
+inline double bitsToUnitDouble(const uint32_t hi, const uint32_t lo)
+{
+    return double(((uint64_t(hi) << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// counter-based sampler: the i-th number of query q is a pure function of (seed, q, i)
+// - setup is a few integer stores (no state to warm up, unlike std::mt19937)
+// - each Philox block yields two numbers, the second one is cached
+class alignas(64) PhiloxSampler : public Sampler
+{
+public:
+    PhiloxSampler(const uint64_t seed = 0, const uint64_t query = 0)
+        : m_seed(seed), m_query(query), m_dimension(0)
+    {
+    }
+
+    virtual void startQuery(const uint64_t index)
+    {
+        m_query = index;
+        m_dimension = 0;
+    }
+
+    virtual double next1D()
+    {
+        const double result = get(m_query, m_dimension);
+        m_dimension++;
+        return result;
+    }
+
+    // random number of dimension 'dimension' in query 'query', independent of the sampler's state
+    double get(const uint64_t query, const uint64_t dimension)
+    {
+        const uint64_t block = dimension >> 1;
+        if (block != m_cached_block || query != m_cached_query)
+        {
+            uint32_t counter[4] = {uint32_t(query), uint32_t(query >> 32), uint32_t(block), uint32_t(block >> 32)};
+            philox4x32(counter, m_seed);
+            m_cache[0] = bitsToUnitDouble(counter[0], counter[1]);
+            m_cache[1] = bitsToUnitDouble(counter[2], counter[3]);
+            m_cached_block = block;
+            m_cached_query = query;
+        }
+        return m_cache[dimension & 1];
+    }
+
+    uint64_t m_seed;
+    uint64_t m_query;
+    uint64_t m_dimension;
+
+private:
+    uint64_t m_cached_query = ~uint64_t(0);
+    uint64_t m_cached_block = ~uint64_t(0);
+    double m_cache[2] = {0.0, 0.0};
+};
+
+// 64-bit hash combine (splitmix64 finalizer)
+inline uint64_t hashCombine(const uint64_t a, const uint64_t b)
+{
+    uint64_t x = a ^ (b + 0x9E3779B97F4A7C15ull + (a << 6) + (a >> 2));
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// hash-based Owen scrambling [Burley 2020]
+inline uint32_t nestedUniformScramble(uint32_t x, const uint32_t seed)
+{
+    x = reverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverseBits(x);
+}
+
+// first two dimensions of the Sobol sequence
+inline void sobol2D(uint32_t index, uint32_t &out_x, uint32_t &out_y)
+{
+    out_x = reverseBits(index);
+    out_y = 0;
+    for (uint32_t v = 0x80000000u; index != 0; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+            out_y ^= v;
+    }
+}
+
+// padded, Owen-scrambled Sobol sampler: every slot of every walk event is an independently
+// scrambled and shuffled 2D Sobol point set [Burley 2020]
+// - startQuery(i) selects the i-th point of the sequence (use consecutive indices for the samples of one estimate)
+// - numbers beyond the first two of a slot come from Philox, keyed by the event, slot and draw count
+class alignas(64) SobolSampler : public Sampler
+{
+public:
+    SobolSampler(const uint64_t seed = 0)
+        : m_seed(seed)
+    {
+        startQuery(0);
+    }
+
+    virtual void startQuery(const uint64_t index)
+    {
+        m_index = index;
+        startEvent(0, 0);
+    }
+
+    virtual uint64_t walkDomain() const
+    {
+        return hashCombine(hashCombine(m_domain, m_slot), m_slot_count[m_slot]);
+    }
+
+    virtual void startEvent(const uint64_t walk_domain, const uint64_t index)
+    {
+        m_domain = hashCombine(walk_domain, index);
+        m_slot = SLOT_FREE_PATH;
+        for (int i = 0; i < SLOT_COUNT; ++i)
+            m_slot_count[i] = 0;
+    }
+
+    virtual void startSlot(const SamplerSlot slot)
+    {
+        m_slot = slot;
+    }
+
+    virtual double next1D()
+    {
+        const uint64_t dimension = hashCombine(m_domain, m_slot);
+        const uint32_t count = m_slot_count[m_slot]++;
+
+        if (count < 2)
+        {
+            const uint64_t scramble = hashCombine(m_seed, dimension);
+            const uint32_t index = nestedUniformScramble(uint32_t(m_index), uint32_t(scramble));
+            uint32_t x, y;
+            sobol2D(index, x, y);
+            const uint32_t value = (count == 0) ? nestedUniformScramble(x, uint32_t(scramble >> 32))
+                                                : nestedUniformScramble(y, uint32_t(scramble >> 32) ^ 0x68bc21ebu);
+            return value * (1.0 / 4294967296.0);
+        }
+
+        const uint64_t key = hashCombine(dimension, count);
+        uint32_t counter[4] = {uint32_t(m_index), uint32_t(m_index >> 32), uint32_t(key), uint32_t(key >> 32)};
+        philox4x32(counter, m_seed);
+        return bitsToUnitDouble(counter[0], counter[1]);
+    }
+
+    uint64_t m_seed;
+
+private:
+    uint64_t m_index;
+    uint64_t m_domain;
+    SamplerSlot m_slot;
+    uint32_t m_slot_count[SLOT_COUNT];
+};
+
+// adapts a Sampler to the UniformRandomBitGenerator interface expected by <random> distributions
+struct SamplerURBG
+{
+    typedef uint32_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffffu; }
+
+    result_type operator()() { return result_type(m_sampler.next1D() * 4294967296.0); }
+
+    Sampler &m_sampler;
+};
+
+// per-thread default sampler used by every entry point that is not given an explicit one
+extern thread_local MTSampler g_sampler;
+
+inline Sampler &defaultSampler()
+{
+    return g_sampler;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Random variates
+//////////////////////////////////////////////////////////////////////////////////
+
 typedef std::gamma_distribution<> D_gamma;
 
-inline double RandomReal()
+inline double RandomReal(Sampler &sampler)
 {
-    std::uniform_real_distribution<double> r(0., 1.);
-    return r(g_mt);
+    return sampler.next1D();
 }
 
-inline double RandomReal(double a, double b)
+inline double RandomReal(double a, double b, Sampler &sampler)
 {
-    std::uniform_real_distribution<double> rd(0., 1.);
-    double r = rd(g_mt);
+    const double r = sampler.next1D();
     return r * b + (1.0 - r) * a;
 }
 
-inline double RandomGauss()
+inline double RandomGauss(Sampler &sampler)
 {
-    return sqrt(2.0) * cos(2 * M_PI * RandomReal()) * sqrt(-log(RandomReal()));
+    return sqrt(2.0) * cos(2 * M_PI * RandomReal(sampler)) * sqrt(-log(RandomReal(sampler)));
 }
 
+// Gamma variates with unit scale [Marsaglia and Tsang 2000]
+// the shape-dependent constants are computed once, so hot loops (Student-T vNDF sampling)
+// can keep one GammaSampler per shape instead of constructing a distribution for every variate
+class GammaSampler
+{
+public:
+    GammaSampler(const double shape)
+        : m_shape(shape)
+    {
+        // shapes below 1 are boosted: Gamma(a) = Gamma(a + 1) * U^(1/a)
+        const double a = (shape < 1.0) ? shape + 1.0 : shape;
+        m_d = a - 1.0 / 3.0;
+        m_c = 1.0 / sqrt(9.0 * m_d);
+        m_inv_shape = 1.0 / shape;
+    }
+
+    double sample(Sampler &sampler) const
+    {
+        assert(m_shape > 0.0);
+
+        double result;
+        while (true)
+        {
+            const double x = RandomGauss(sampler);
+            double v = 1.0 + m_c * x;
+            if (v <= 0.0)
+                continue;
+            v = v * v * v;
+
+            const double u = RandomReal(sampler);
+            const double x2 = x * x;
+            // squeeze, then the full acceptance test
+            if (u < 1.0 - 0.0331 * x2 * x2 || log(u) < 0.5 * x2 + m_d * (1.0 - v + log(v)))
+            {
+                result = m_d * v;
+                break;
+            }
+        }
+
+        if (m_shape < 1.0)
+            result *= pow(RandomReal(sampler), m_inv_shape);
+
+        return result;
+    }
+
+    // fill out[0..count-1] with independent variates
+    void sample(double *out, const size_t count, Sampler &sampler) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = sample(sampler);
+    }
+
+    double m_shape;
+
+private:
+    double m_d, m_c, m_inv_shape;
+};
 
 // random Gamma variate for general shape parameter a > 0.0
+inline double RandomGamma(const double a, Sampler &sampler)
+{
+    return GammaSampler(a).sample(sampler);
+}
+
+inline double RandomReal()
+{
+    return RandomReal(defaultSampler());
+}
+
+inline double RandomReal(double a, double b)
+{
+    return RandomReal(a, b, defaultSampler());
+}
+
+inline double RandomGauss()
+{
+    return RandomGauss(defaultSampler());
+}
+
 inline double RandomGamma(const double a)
 {
-    D_gamma r(a, 1.0);
-    return r(g_mt);
+    return RandomGamma(a, defaultSampler());
 }
 
 //////////////////////////////////////////////////////////////////////////////////
 // Random Directions
 //////////////////////////////////////////////////////////////////////////////////
 
-inline Vector2 diskSample2D(const double radius)
+inline Vector2 diskSample2D(const double radius, Sampler &sampler)
 {
-    const double phi = RandomReal(0.0, 2 * M_PI);
-    return radius * sqrt(RandomReal()) * Vector2(cos(phi), sin(phi));
+    const double phi = RandomReal(0.0, 2 * M_PI, sampler);
+    return radius * sqrt(RandomReal(sampler)) * Vector2(cos(phi), sin(phi));
 }
 
-inline Vector3 diskSample(const double radius)
+inline Vector3 diskSample(const double radius, Sampler &sampler)
 {
-    const double phi = RandomReal(0.0, 2 * M_PI);
-    return radius * sqrt(RandomReal()) * Vector3(cos(phi), sin(phi), 0.0);
+    const double phi = RandomReal(0.0, 2 * M_PI, sampler);
+    return radius * sqrt(RandomReal(sampler)) * Vector3(cos(phi), sin(phi), 0.0);
 }
 
-inline Vector3 isotropicDir()
+inline Vector3 isotropicDir(Sampler &sampler)
 {
-    const double w = RandomReal(-1.0, 1.0);
-    const double p = RandomReal(0.0, 2.0 * M_PI);
+    const double w = RandomReal(-1.0, 1.0, sampler);
+    const double p = RandomReal(0.0, 2.0 * M_PI, sampler);
     const double s = sqrt(1.0 - w * w);
     return Vector3(w, s * cos(p), s * sin(p));
 }
 
-inline Vector3 lambertDir()
+inline Vector3 lambertDir(Sampler &sampler)
 {
-    const double w = sqrt(RandomReal());
-    const double p = RandomReal(0.0, 2.0 * M_PI);
+    const double w = sqrt(RandomReal(sampler));
+    const double p = RandomReal(0.0, 2.0 * M_PI, sampler);
     const double s = sqrt(1.0 - w * w);
     return Vector3(s * cos(p), s * sin(p), w); // z axis is the normal
 }
 
 // sample a Lambertian direction about normal n:
-inline Vector3 lambertDir(const Vector3 &n)
+inline Vector3 lambertDir(const Vector3 &n, Sampler &sampler)
 {
-    const Vector3 local(lambertDir());
+    const Vector3 local(lambertDir(sampler));
     Vector3 x, y;
     buildOrthonormalBasis(x, y, n);
     return x * local.x + y * local.y + n * local.z;
 }
+
+inline Vector2 diskSample2D(const double radius)
+{
+    return diskSample2D(radius, defaultSampler());
+}
+
+inline Vector3 diskSample(const double radius)
+{
+    return diskSample(radius, defaultSampler());
+}
+
+inline Vector3 isotropicDir()
+{
+    return isotropicDir(defaultSampler());
+}
+
+inline Vector3 lambertDir()
+{
+    return lambertDir(defaultSampler());
+}
+
+inline Vector3 lambertDir(const Vector3 &n)
+{
+    return lambertDir(n, defaultSampler());
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <util.h>
+
+// number of channels of a Spectrum (3 for RGB), fixed at compile time
+#ifndef SPECTRUM_CHANNELS
+#define SPECTRUM_CHANNELS 3
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////
+// Spectrum
+//////////////////////////////////////////////////////////////////////////////////
+
+// a small fixed-width vector of per-channel values (throughput, reflectance, ...), so that one random walk carries
+// all the channels of a material whose geometry (heights, facet normals, directions) does not depend on the channel
+template <class Float>
+struct SpectrumT
+{
+    typedef Float Scalar;
+
+    Float c[SPECTRUM_CHANNELS];
+
+    // gray
+    explicit SpectrumT(const Float value = 0.0)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] = value;
+    }
+
+    // first three channels (RGB), the others are copies of the last one
+    SpectrumT(const Float r, const Float g, const Float b)
+    {
+        const Float rgb[3] = {r, g, b};
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] = rgb[std::min(i, 2)];
+    }
+
+    // one value per channel (e.g. the wavelength samples of a dispersive walk)
+    explicit SpectrumT(const Float *values)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] = values[i];
+    }
+
+    // conversion between precision tiers
+    template <class Other>
+    explicit SpectrumT(const SpectrumT<Other> &s)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] = Float(s.c[i]);
+    }
+
+    Float &operator[](const int i)
+    {
+        return c[i];
+    }
+
+    Float operator[](const int i) const
+    {
+        return c[i];
+    }
+
+    Float average() const
+    {
+        Float sum = 0.0;
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            sum += c[i];
+        return sum / Float(SPECTRUM_CHANNELS);
+    }
+
+    Float max() const
+    {
+        Float result = c[0];
+        for (int i = 1; i < SPECTRUM_CHANNELS; ++i)
+            result = std::max(result, c[i]);
+        return result;
+    }
+
+    bool isGray() const
+    {
+        for (int i = 1; i < SPECTRUM_CHANNELS; ++i)
+        {
+            if (c[i] != c[0])
+                return false;
+        }
+        return true;
+    }
+
+    SpectrumT operator+(const SpectrumT &b) const
+    {
+        SpectrumT result;
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            result.c[i] = c[i] + b.c[i];
+        return result;
+    }
+
+    SpectrumT operator*(const SpectrumT &b) const
+    {
+        SpectrumT result;
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            result.c[i] = c[i] * b.c[i];
+        return result;
+    }
+
+    SpectrumT operator*(const Float b) const
+    {
+        SpectrumT result;
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            result.c[i] = c[i] * b;
+        return result;
+    }
+
+    SpectrumT operator/(const Float b) const
+    {
+        SpectrumT result;
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            result.c[i] = c[i] / b;
+        return result;
+    }
+
+    SpectrumT &operator+=(const SpectrumT &b)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] += b.c[i];
+        return *this;
+    }
+
+    SpectrumT &operator*=(const SpectrumT &b)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] *= b.c[i];
+        return *this;
+    }
+
+    SpectrumT &operator*=(const Float b)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] *= b;
+        return *this;
+    }
+
+    SpectrumT &operator/=(const Float b)
+    {
+        for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+            c[i] /= b;
+        return *this;
+    }
+};
+
+typedef SpectrumT<double> Spectrum;
+
+template <class Float>
+inline SpectrumT<Float> operator*(const typename SpectrumT<Float>::Scalar a, const SpectrumT<Float> &s)
+{
+    return s * a;
+}
+
+template <class Float>
+inline bool operator==(const SpectrumT<Float> &a, const SpectrumT<Float> &b)
+{
+    for (int i = 0; i < SPECTRUM_CHANNELS; ++i)
+    {
+        if (a.c[i] != b.c[i])
+            return false;
+    }
+    return true;
+}
+
+template <class Float>
+inline bool operator!=(const SpectrumT<Float> &a, const SpectrumT<Float> &b)
+{
+    return !(a == b);
+}
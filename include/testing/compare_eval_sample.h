@@ -20,6 +20,7 @@
 
 #include <util.h>
 #include <bsdfs/NDF.h>
+#include <bsdfs/microsurface.h>
 
 const int numtheta = 100;
 const int numphi = 101;
@@ -78,10 +79,12 @@ const double evalFactor = 2.0 * M_PI * M_PI / (numtheta * numphi);
 // compareEvalSample:
 //
 // numsamplesSample: number of samples to test sample() with
-// numsamplesEval: number of samples to test eval() with (run for every pixel in the output)
+// numsamplesEval: number of samples to test eval() with (run for every pixel in the output, all pixels share each walk)
+// sampler: every sample is a separate query (startQuery()), so QMC samplers stratify each histogram bin
 ////////////////////////////////////////////////////////////////////////////
 
-void compareEvalSample(BSDF &bsdf, const double theta_i, const size_t numsamplesSample, const size_t numsamplesEval, const double ior_i, const double ior_t)
+void compareEvalSample(BSDF &bsdf, const double theta_i, const size_t numsamplesSample, const size_t numsamplesEval, const double ior_i, const double ior_t,
+                       Sampler &sampler = defaultSampler())
 {
     for (size_t i = 0; i < numOrdinates; ++i)
     {
@@ -93,8 +96,9 @@ void compareEvalSample(BSDF &bsdf, const double theta_i, const size_t numsamples
 
     for (size_t i = 0; i < numsamplesSample; ++i)
     {
+        sampler.startQuery(i);
         double w(1.0);
-        Vector3 wo = bsdf.sample(ior_i, ior_t, wi, w);
+        Vector3 wo = bsdf.sample(ior_i, ior_t, wi, w, sampler);
         int oi = oIndex(wo, 0.0);
         g_bsdfsampled[oi] += w;
     }
@@ -103,19 +107,163 @@ void compareEvalSample(BSDF &bsdf, const double theta_i, const size_t numsamples
     writeHistogram(g_bsdfsampled, numsamplesSample);
 
     std::cout << "BSDF.eval():\n";
+
+    // every eval query evaluates one jittered direction in every histogram bin along one walk (evalMany())
+    std::vector<Vector3> wo(numOrdinates);
+    std::vector<double> cos_theta(numOrdinates);
+    std::vector<double> value(numOrdinates);
+    std::vector<double> meanEval(numOrdinates, 0.0);
+    for (size_t i = 0; i < numsamplesEval; ++i)
+    {
+        sampler.startQuery(i);
+        for (int theta_index = 0; theta_index < numtheta; ++theta_index)
+        {
+            for (int phi_i = 0; phi_i < numphi; ++phi_i)
+            {
+                const int index = theta_index * numphi + phi_i;
+                const double theta = -0.5 * M_PI + double(theta_index + RandomReal(sampler)) * M_PI / double(numtheta);
+                const double phi = -M_PI + double(phi_i + RandomReal(sampler)) * 2.0 * M_PI / double(numphi);
+                wo[index] = Vector3(cosf(theta) * sinf(phi), cosf(theta) * cosf(phi), sinf(theta));
+                cos_theta[index] = cosf(theta);
+            }
+        }
+
+        bsdf.evalMany(ior_i, ior_t, wi, wo.data(), numOrdinates, value.data(), sampler);
+        for (int index = 0; index < numOrdinates; ++index)
+            meanEval[index] += value[index] * cos_theta[index];
+    }
+
     for (int theta_index = 0; theta_index < numtheta; ++theta_index)
     {
         for (int phi_i = 0; phi_i < numphi; ++phi_i)
         {
-            double meanEval(0.f);
+            std::cout << evalFactor * meanEval[theta_index * numphi + phi_i] / double(numsamplesEval) << " ";
+        }
+        std::cout << std::endl;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// compareEvalSampleOrders: compareEvalSample() per scattering order, in the same passes
+//
+// numorders: histograms of orders 1 to numorders (the last one gathers all higher orders too)
+// prints the histograms of sample() for every order ("BSDF.sample() order k:"), then those of eval()
+// ("BSDF.eval() order k:")
+////////////////////////////////////////////////////////////////////////////
+
+void compareEvalSampleOrders(const Microsurface &bsdf, const double theta_i, const size_t numsamplesSample, const size_t numsamplesEval,
+                             const double ior_i, const double ior_t, const size_t numorders, Sampler &sampler = defaultSampler())
+{
+    const double phi = -M_PI * 0.5;
+    const Vector3 wi = Vector3(sin(theta_i) * cos(phi), sin(theta_i) * sin(phi), cos(theta_i));
+
+    std::vector<double> sampled(numorders * numOrdinates, 0.0);
+    for (size_t i = 0; i < numsamplesSample; ++i)
+    {
+        sampler.startQuery(i);
+        double w(1.0);
+        size_t order = 0;
+        Vector3 wo = bsdf.sampleOrder(ior_i, ior_t, wi, w, order, sampler);
+        if (order == 0)
+            continue;
+        sampled[std::min(order, numorders) * numOrdinates - numOrdinates + oIndex(wo, 0.0)] += w;
+    }
+
+    for (size_t k = 0; k < numorders; ++k)
+    {
+        std::cout << "BSDF.sample() order " << k + 1 << ":\n";
+        writeHistogram(sampled.data() + k * numOrdinates, numsamplesSample);
+    }
+
+    // every eval query evaluates one jittered direction in every histogram bin along one walk
+    std::vector<Vector3> wo(numOrdinates);
+    std::vector<double> cos_theta(numOrdinates);
+    std::vector<double> value(numOrdinates);
+    std::vector<double> orders(numOrdinates * numorders);
+    std::vector<double> meanEval(numOrdinates * numorders, 0.0);
+    for (size_t i = 0; i < numsamplesEval; ++i)
+    {
+        sampler.startQuery(i);
+        for (int theta_index = 0; theta_index < numtheta; ++theta_index)
+        {
+            for (int phi_i = 0; phi_i < numphi; ++phi_i)
+            {
+                const int index = theta_index * numphi + phi_i;
+                const double theta = -0.5 * M_PI + double(theta_index + RandomReal(sampler)) * M_PI / double(numtheta);
+                const double phi = -M_PI + double(phi_i + RandomReal(sampler)) * 2.0 * M_PI / double(numphi);
+                wo[index] = Vector3(cosf(theta) * sinf(phi), cosf(theta) * cosf(phi), sinf(theta));
+                cos_theta[index] = cosf(theta);
+            }
+        }
+
+        bsdf.evalMany(ior_i, ior_t, wi, wo.data(), numOrdinates, value.data(), numorders, orders.data(), sampler);
+        for (int index = 0; index < numOrdinates; ++index)
+        {
+            for (size_t k = 0; k < numorders; ++k)
+                meanEval[k * numOrdinates + index] += orders[index * numorders + k] * cos_theta[index];
+        }
+    }
+
+    for (size_t k = 0; k < numorders; ++k)
+    {
+        std::cout << "BSDF.eval() order " << k + 1 << ":\n";
+        for (int theta_index = 0; theta_index < numtheta; ++theta_index)
+        {
+            for (int phi_i = 0; phi_i < numphi; ++phi_i)
+            {
+                std::cout << evalFactor * meanEval[k * numOrdinates + theta_index * numphi + phi_i] / double(numsamplesEval) << " ";
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "\n\n";
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// comparePdfSample: histogram of the directions returned by sample() (weights ignored) against pdf()
+//
+// numsamplesSample: number of samples to test sample() with
+// numsamplesEval: number of samples to test pdf() with (run for every pixel in the output)
+////////////////////////////////////////////////////////////////////////////
+
+void comparePdfSample(BSDF &bsdf, const double theta_i, const size_t numsamplesSample, const size_t numsamplesEval, const double ior_i, const double ior_t,
+                      Sampler &sampler = defaultSampler())
+{
+    for (size_t i = 0; i < numOrdinates; ++i)
+    {
+        g_bsdfsampled[i] = 0.0;
+    }
+
+    const double phi = -M_PI * 0.5;
+    const Vector3 wi = Vector3(sin(theta_i) * cos(phi), sin(theta_i) * sin(phi), cos(theta_i));
+
+    for (size_t i = 0; i < numsamplesSample; ++i)
+    {
+        sampler.startQuery(i);
+        double w(1.0);
+        Vector3 wo = bsdf.sample(ior_i, ior_t, wi, w, sampler);
+        int oi = oIndex(wo, 0.0);
+        g_bsdfsampled[oi] += (w != 0.0) ? 1.0 : 0.0;
+    }
+
+    std::cout << "BSDF.sample():\n";
+    writeHistogram(g_bsdfsampled, numsamplesSample);
+
+    std::cout << "BSDF.pdf():\n";
+    for (int theta_index = 0; theta_index < numtheta; ++theta_index)
+    {
+        for (int phi_i = 0; phi_i < numphi; ++phi_i)
+        {
+            double meanPdf(0.0);
             for (size_t i = 0; i < numsamplesEval; ++i)
             {
-                const double theta = -0.5 * M_PI + double(theta_index + RandomReal()) * M_PI / double(numtheta);
-                const double phi = -M_PI + double(phi_i + RandomReal()) * 2.0 * M_PI / double(numphi);
+                sampler.startQuery(i);
+                const double theta = -0.5 * M_PI + double(theta_index + RandomReal(sampler)) * M_PI / double(numtheta);
+                const double phi = -M_PI + double(phi_i + RandomReal(sampler)) * 2.0 * M_PI / double(numphi);
                 Vector3 wo = Vector3(cosf(theta) * sinf(phi), cosf(theta) * cosf(phi), sinf(theta));
-                meanEval += bsdf.eval(ior_i, ior_t, wi, wo) * cosf(theta);
+                meanPdf += bsdf.pdf(ior_i, ior_t, wi, wo, sampler) * cosf(theta);
             }
-            std::cout << evalFactor * meanEval / double(numsamplesEval) << " ";
+            std::cout << evalFactor * meanPdf / double(numsamplesEval) << " ";
         }
         std::cout << std::endl;
     }
@@ -128,7 +276,8 @@ void compareEvalSample(BSDF &bsdf, const double theta_i, const size_t numsamples
 // numsamplesEval: number of samples to test eval() with (run for every pixel in the output)
 ////////////////////////////////////////////////////////////////////////////
 
-void testVNDF(NDF &ndf, const double theta_i, const double phi, const size_t numsamplesSample, const size_t numsamplesEval)
+void testVNDF(NDF &ndf, const double theta_i, const double phi, const size_t numsamplesSample, const size_t numsamplesEval,
+              Sampler &sampler = defaultSampler())
 {
     for (size_t i = 0; i < numOrdinates; ++i)
     {
@@ -139,8 +288,9 @@ void testVNDF(NDF &ndf, const double theta_i, const double phi, const size_t num
 
     for (size_t i = 0; i < numsamplesSample; ++i)
     {
+        sampler.startQuery(i);
         double w(1.0);
-        Vector3 wo = ndf.sampleD_wi(wi);
+        Vector3 wo = ndf.sampleD_wi(wi, sampler);
         int oi = oIndex(wo, 0.0);
         g_bsdfsampled[oi] += w;
     }
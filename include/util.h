@@ -31,15 +31,15 @@
 #define Cosh cosh
 #define Sinh sinh
 
-const double Pi(3.141592653);
+const double Pi(3.14159265358979323846);
 
-#define INV_M_PI 0.31830988618379067153f        /* 1/pi */
-#define SQRT_M_PI 1.77245385090551602729f       /* sqrt(pi) */
-#define SQRT_2 1.41421356237309504880f          /* sqrt(2) */
-#define INV_SQRT_M_PI 0.56418958354775628694f   /* 1/sqrt(pi) */
-#define INV_2_SQRT_M_PI 0.28209479177387814347f /* 0.5/sqrt(pi) */
-#define INV_SQRT_2_M_PI 0.3989422804014326779f  /* 1/sqrt(2*pi) */
-#define INV_SQRT_2 0.7071067811865475244f       /* 1/sqrt(2) */
+#define INV_M_PI 0.31830988618379067153        /* 1/pi */
+#define SQRT_M_PI 1.77245385090551602729       /* sqrt(pi) */
+#define SQRT_2 1.41421356237309504880          /* sqrt(2) */
+#define INV_SQRT_M_PI 0.56418958354775628694   /* 1/sqrt(pi) */
+#define INV_2_SQRT_M_PI 0.28209479177387814347 /* 0.5/sqrt(pi) */
+#define INV_SQRT_2_M_PI 0.3989422804014326779  /* 1/sqrt(2*pi) */
+#define INV_SQRT_2 0.7071067811865475244       /* 1/sqrt(2) */
 
 //////////////////////////////////////////////////////////////////////////////////
 // utilities
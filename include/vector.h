@@ -17,49 +17,67 @@
 #pragma once
 
 #include <util.h>
+#include <type_traits>
+
+//////////////////////////////////////////////////////////////////////////////////
+// precision tiers
+//////////////////////////////////////////////////////////////////////////////////
+
+// vectors, Fresnel terms, BSDFs, NDFs and Microsurface are templates on their scalar type (Float):
+// double is the reference tier (Vector3, BSDF, NDF, Microsurface, ... are the double instances),
+// float halves the memory traffic of batched queries and runs the transcendentals in single precision
+// (Vector3T<float>, BSDFT<float>, GGXNDFT<float>, MicrosurfaceT<float>, ...)
 
 //////////////////////////////////////////////////////////////////////////////////
 // Vector2
 //////////////////////////////////////////////////////////////////////////////////
 
-struct Vector2
+template <class Float>
+struct Vector2T
 {
-    Vector2(const double in_x, const double in_y)
+    typedef Float Scalar;
+
+    Vector2T(const Float in_x, const Float in_y)
         : x(in_x), y(in_y){};
 
-    Vector2()
+    Vector2T()
         : x(0.0), y(0.0){};
 
-    double x, y;
+    // conversion between precision tiers
+    template <class Other>
+    explicit Vector2T(const Vector2T<Other> &v)
+        : x(Float(v.x)), y(Float(v.y)){};
+
+    Float x, y;
 
-    Vector2 operator*(const double c) const
+    Vector2T operator*(const Float c) const
     {
-        return Vector2(c * this->x, c * this->y);
+        return Vector2T(c * this->x, c * this->y);
     };
 
-    Vector2 operator/(const double c) const
+    Vector2T operator/(const Float c) const
     {
-        return Vector2(this->x / c, this->y / c);
+        return Vector2T(this->x / c, this->y / c);
     };
 
-    Vector2 operator+(Vector2 b) const
+    Vector2T operator+(Vector2T b) const
     {
-        return Vector2(b.x + this->x, b.y + this->y);
+        return Vector2T(b.x + this->x, b.y + this->y);
     };
 
-    Vector2 operator-() const
+    Vector2T operator-() const
     {
-        return Vector2(-this->x, -this->y);
+        return Vector2T(-this->x, -this->y);
     };
 
-    Vector2 operator+=(Vector2 b)
+    Vector2T operator+=(Vector2T b)
     {
         this->x += b.x;
         this->y += b.y;
         return *this;
     };
 
-    Vector2 operator-=(Vector2 b)
+    Vector2T operator-=(Vector2T b)
     {
         this->x -= b.x;
         this->y -= b.y;
@@ -67,102 +85,121 @@ struct Vector2
     };
 };
 
-inline Vector2 operator*(const double c, const Vector2 &v)
+typedef Vector2T<double> Vector2;
+
+// NB: scalar arguments take the scalar type of the vector (typename Vector2T<Float>::Scalar), so that literals and
+//     scalars of the other tier convert instead of failing template argument deduction
+template <class Float>
+inline Vector2T<Float> operator*(const typename Vector2T<Float>::Scalar c, const Vector2T<Float> &v)
 {
-    return Vector2(c * v.x, c * v.y);
+    return Vector2T<Float>(c * v.x, c * v.y);
 }
 
-inline Vector2 operator-(const Vector2 &a, const Vector2 &b)
+template <class Float>
+inline Vector2T<Float> operator-(const Vector2T<Float> &a, const Vector2T<Float> &b)
 {
-    return Vector2(a.x - b.x, a.y - b.y);
+    return Vector2T<Float>(a.x - b.x, a.y - b.y);
 }
 
-inline bool operator==(const Vector2 &a, const Vector2 &b)
+template <class Float>
+inline bool operator==(const Vector2T<Float> &a, const Vector2T<Float> &b)
 {
     return a.x == b.x && a.y == b.y;
 }
 
-inline bool operator!=(const Vector2 &a, const Vector2 &b)
+template <class Float>
+inline bool operator!=(const Vector2T<Float> &a, const Vector2T<Float> &b)
 {
     return a.x != b.x || a.y != b.y;
 }
 
-inline double dot(const Vector2 &a, const Vector2 &b)
+template <class Float>
+inline Float dot(const Vector2T<Float> &a, const Vector2T<Float> &b)
 {
     return a.x * b.x + a.y * b.y;
 }
 
-inline double Norm(const Vector2 &v)
+template <class Float>
+inline Float Norm(const Vector2T<Float> &v)
 {
     return sqrt(v.x * v.x + v.y * v.y);
 }
 
-inline Vector2 normalize(const Vector2 &v)
+template <class Float>
+inline Vector2T<Float> normalize(const Vector2T<Float> &v)
 {
-    return v * (1.0 / Norm(v));
+    return v * (Float(1) / Norm(v));
 }
 
 //////////////////////////////////////////////////////////////////////////////////
 // Vector3
 //////////////////////////////////////////////////////////////////////////////////
 
-struct Vector3
+template <class Float>
+struct Vector3T
 {
-    Vector3(const double in_x, const double in_y, const double in_z)
+    typedef Float Scalar;
+
+    Vector3T(const Float in_x, const Float in_y, const Float in_z)
         : x(in_x), y(in_y), z(in_z){};
 
-    Vector3()
+    Vector3T()
         : x(0.0), y(0.0), z(0.0){};
-    double x, y, z;
+    Float x, y, z;
 
-    Vector3(const double *ptr)
+    Vector3T(const Float *ptr)
     {
         x = ptr[0];
         y = ptr[1];
         z = ptr[2];
     }
 
-    Vector3 operator*(const Vector3 &c) const
+    // conversion between precision tiers
+    template <class Other>
+    explicit Vector3T(const Vector3T<Other> &v)
+        : x(Float(v.x)), y(Float(v.y)), z(Float(v.z)){};
+
+    Vector3T operator*(const Vector3T &c) const
     {
-        return Vector3(c.x * this->x, c.y * this->y, c.z * this->z);
+        return Vector3T(c.x * this->x, c.y * this->y, c.z * this->z);
     };
 
-    double min() const
+    Float min() const
     {
         return std::min(x, std::min(y, z));
     }
 
-    double max() const
+    Float max() const
     {
         return std::max(x, std::max(y, z));
     }
 
-    double sum() const
+    Float sum() const
     {
         return x + y + z;
     }
 
-    Vector3 operator*(const double c) const
+    Vector3T operator*(const Float c) const
     {
-        return Vector3(c * this->x, c * this->y, c * this->z);
+        return Vector3T(c * this->x, c * this->y, c * this->z);
     };
 
-    Vector3 operator/(const double c) const
+    Vector3T operator/(const Float c) const
     {
-        return Vector3(this->x / c, this->y / c, this->z / c);
+        return Vector3T(this->x / c, this->y / c, this->z / c);
     };
 
-    Vector3 operator+(Vector3 b) const
+    Vector3T operator+(Vector3T b) const
     {
-        return Vector3(b.x + this->x, b.y + this->y, b.z + this->z);
+        return Vector3T(b.x + this->x, b.y + this->y, b.z + this->z);
     };
 
-    Vector3 operator-() const
+    Vector3T operator-() const
     {
-        return Vector3(-this->x, -this->y, -this->z);
+        return Vector3T(-this->x, -this->y, -this->z);
     };
 
-    Vector3 operator+=(Vector3 b)
+    Vector3T operator+=(Vector3T b)
     {
         this->x += b.x;
         this->y += b.y;
@@ -171,7 +208,7 @@ struct Vector3
         return *this;
     };
 
-    Vector3 operator*=(Vector3 b)
+    Vector3T operator*=(Vector3T b)
     {
         this->x *= b.x;
         this->y *= b.y;
@@ -180,7 +217,7 @@ struct Vector3
         return *this;
     };
 
-    Vector3 operator*=(double b)
+    Vector3T operator*=(Float b)
     {
         this->x *= b;
         this->y *= b;
@@ -189,7 +226,7 @@ struct Vector3
         return *this;
     };
 
-    Vector3 operator-=(Vector3 b)
+    Vector3T operator-=(Vector3T b)
     {
         this->x -= b.x;
         this->y -= b.y;
@@ -199,82 +236,127 @@ struct Vector3
     };
 };
 
-inline Vector3 operator*(const double c, const Vector3 &v)
+typedef Vector3T<double> Vector3;
+
+template <class Float>
+inline Vector3T<Float> operator*(const typename Vector3T<Float>::Scalar c, const Vector3T<Float> &v)
 {
-    return Vector3(c * v.x, c * v.y, c * v.z);
+    return Vector3T<Float>(c * v.x, c * v.y, c * v.z);
 }
 
-inline Vector3 operator/(const double c, const Vector3 &v)
+template <class Float>
+inline Vector3T<Float> operator/(const typename Vector3T<Float>::Scalar c, const Vector3T<Float> &v)
 {
-    return Vector3(c / v.x, c / v.y, c / v.z);
+    return Vector3T<Float>(c / v.x, c / v.y, c / v.z);
 }
 
-inline Vector3 operator-(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline Vector3T<Float> operator-(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
-    return Vector3(a.x - b.x, a.y - b.y, a.z - b.z);
+    return Vector3T<Float>(a.x - b.x, a.y - b.y, a.z - b.z);
 }
 
-inline Vector3 operator/(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline Vector3T<Float> operator/(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
-    return Vector3(a.x / b.x, a.y / b.y, a.z / b.z);
+    return Vector3T<Float>(a.x / b.x, a.y / b.y, a.z / b.z);
 }
 
-inline bool operator==(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline bool operator==(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
     return a.x == b.x && a.y == b.y && a.z == b.z;
 }
 
-inline bool operator!=(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline bool operator!=(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
     return a.x != b.x || a.y != b.y || a.z != b.z;
 }
 
-inline double dot(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline Float dot(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-inline double Norm(const Vector3 &v)
+template <class Float>
+inline Float Norm(const Vector3T<Float> &v)
 {
     return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
 }
 
-inline Vector3 normalize(const Vector3 &v)
+template <class Float>
+inline Vector3T<Float> normalize(const Vector3T<Float> &v)
 {
-    return v * (1.0 / Norm(v));
+    return v * (Float(1) / Norm(v));
 }
 
-inline Vector3 Clamp(const Vector3 &v, const double min, const double max)
+template <class Float>
+inline Vector3T<Float> Clamp(const Vector3T<Float> &v, const typename Vector3T<Float>::Scalar min, const typename Vector3T<Float>::Scalar max)
 {
-    return Vector3(
+    return Vector3T<Float>(
         Clamp(v.x, min, max),
         Clamp(v.y, min, max),
         Clamp(v.z, min, max));
 }
 
-inline Vector3 Cross(const Vector3 &a, const Vector3 &b)
+template <class Float>
+inline Vector3T<Float> Cross(const Vector3T<Float> &a, const Vector3T<Float> &b)
 {
-    return Vector3(-b.y * a.z + a.y * b.z, b.x * a.z - a.x * b.z, -b.x * a.y + a.x * b.y);
+    return Vector3T<Float>(-b.y * a.z + a.y * b.z, b.x * a.z - a.x * b.z, -b.x * a.y + a.x * b.y);
 }
 
-inline Vector3 reflect(const Vector3 &in, const Vector3 &n)
+template <class Float>
+inline Vector3T<Float> reflect(const Vector3T<Float> &in, const Vector3T<Float> &n)
 {
-    return -in + 2.0 * dot(in, n) * n;
+    return -in + Float(2) * dot(in, n) * n;
 }
 
+//////////////////////////////////////////////////////////////////////////////////
+// Vector3Arrays - structure-of-arrays view of caller-owned vectors
+//////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> // double or float, or const double/const float for read-only inputs
+struct Vector3Arrays
+{
+    typedef typename std::remove_const<T>::type Scalar;
+
+    Vector3Arrays(T *in_x, T *in_y, T *in_z)
+        : x(in_x), y(in_y), z(in_z){};
+
+    Vector3Arrays()
+        : x(0), y(0), z(0){};
+
+    T *x, *y, *z;
+
+    Vector3T<Scalar> get(const size_t i) const
+    {
+        return Vector3T<Scalar>(x[i], y[i], z[i]);
+    }
+
+    void set(const size_t i, const Vector3T<Scalar> &v) const
+    {
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+};
+
 // build orthonormal basis (Building an Orthonormal Basis from a 3D Unit Vector Without Normalization, [Frisvad2012])
-inline void buildOrthonormalBasis(Vector3 &omega_1, Vector3 &omega_2, const Vector3 &omega_3)
+template <class Float>
+inline void buildOrthonormalBasis(Vector3T<Float> &omega_1, Vector3T<Float> &omega_2, const Vector3T<Float> &omega_3)
 {
-    if (omega_3.z < -0.9999999f)
+    if (omega_3.z < Float(-0.9999999))
     {
-        omega_1 = Vector3(0.0f, -1.0f, 0.0f);
-        omega_2 = Vector3(-1.0f, 0.0f, 0.0f);
+        omega_1 = Vector3T<Float>(0, -1, 0);
+        omega_2 = Vector3T<Float>(-1, 0, 0);
     }
     else
     {
-        const float a = 1.0f / (1.0f + omega_3.z);
-        const float b = -omega_3.x * omega_3.y * a;
-        omega_1 = Vector3(1.0f - omega_3.x * omega_3.x * a, b, -omega_3.x);
-        omega_2 = Vector3(b, 1.0f - omega_3.y * omega_3.y * a, -omega_3.y);
+        const Float a = Float(1) / (Float(1) + omega_3.z);
+        const Float b = -omega_3.x * omega_3.y * a;
+        omega_1 = Vector3T<Float>(Float(1) - omega_3.x * omega_3.x * a, b, -omega_3.x);
+        omega_2 = Vector3T<Float>(b, Float(1) - omega_3.y * omega_3.y * a, -omega_3.y);
     }
 }
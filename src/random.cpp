@@ -1,4 +1,3 @@
 #include <random.h>
 
-std::random_device dev;
-std::mt19937 g_mt(dev());
+thread_local MTSampler g_sampler;
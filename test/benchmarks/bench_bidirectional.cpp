@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark Microsurface::evalBidirectional() against eval() at fixed pairs of directions, from grazing wo to grazing wi:
+// the means must agree statistically (both are unbiased), the variances and times give the efficiency of
+// evalBidirectional(), (variance x time of eval()) / (variance x time of evalBidirectional())
+// returns a nonzero exit code on a mismatch
+// build: g++ -I include test/benchmarks/bench_bidirectional.cpp src/random.cpp -O3 -DNDEBUG -o test/benchmarks/bench_bidirectional
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/beckmann.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+
+#define Z_BOUND 4.0
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// direction at (theta, phi) in degrees, below the surface if transmitted
+Vector3 direction(const double theta, const double phi, const bool transmitted = false)
+{
+    const double t = theta * Pi / 180.0;
+    const double p = phi * Pi / 180.0;
+    return Vector3(sin(t) * cos(p), sin(t) * sin(p), (transmitted ? -1.0 : 1.0) * cos(t));
+}
+
+// mean and variance of a sum of values
+struct Moments
+{
+    double sum = 0.0, sum2 = 0.0;
+
+    void add(const double value)
+    {
+        sum += value;
+        sum2 += value * value;
+    }
+
+    double mean(const size_t count) const
+    {
+        return sum / double(count);
+    }
+
+    double variance(const size_t count) const
+    {
+        return std::max(sum2 / double(count) - mean(count) * mean(count), 0.0);
+    }
+};
+
+// compare evalBidirectional() with eval() from wi to wo, returns false on a mismatch
+bool compare(const char *name, const Microsurface &microsurface, const double ior, const Vector3 &wi, const Vector3 &wo,
+             const size_t numqueries)
+{
+    PhiloxSampler sampler(1);
+
+    Moments eval, bidirectional;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        sampler.startQuery(i);
+        eval.add(microsurface.eval(1.0, ior, wi, wo, sampler));
+    }
+    const double time_eval = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        sampler.startQuery(numqueries + i);
+        bidirectional.add(microsurface.evalBidirectional(1.0, ior, wi, wo, sampler));
+    }
+    const double time_bidirectional = seconds(start);
+
+    const double error = sqrt((eval.variance(numqueries) + bidirectional.variance(numqueries)) / double(numqueries));
+    const double z = (error > 0.0) ? (bidirectional.mean(numqueries) - eval.mean(numqueries)) / error : 0.0;
+    const bool passed = (std::abs(z) <= Z_BOUND);
+    const double variance_ratio = bidirectional.variance(numqueries) / eval.variance(numqueries);
+    const double time_ratio = time_bidirectional / time_eval;
+
+    std::cout << name << ", wi.z " << wi.z << ", wo.z " << wo.z << ": eval " << eval.mean(numqueries) << " vs "
+              << bidirectional.mean(numqueries) << " (z " << z << "), variance x" << variance_ratio << ", time x" << time_ratio
+              << ", efficiency x" << 1.0 / (variance_ratio * time_ratio) << (passed ? "" : " FAILED") << "\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_bidirectional alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    ConductorBRDF conductor(0.2, 3.0);
+    DielectricBSDF dielectric;
+    LambertBRDF lambert(0.8);
+    GGXNDF ggx_conductor(&conductor, alpha, alpha);
+    GGXNDF ggx_dielectric(&dielectric, alpha, alpha);
+    BeckmannNDF beckmann_lambert(&lambert, alpha, alpha);
+
+    const Microsurface materials[3] = {Microsurface(&ggx_conductor), Microsurface(&ggx_dielectric), Microsurface(&beckmann_lambert)};
+    const char *names[3] = {"GGX conductor", "GGX dielectric", "Beckmann Lambert"};
+    const double iors[3] = {1.0, 1.5, 1.0};
+
+    // grazing wo, grazing wi, neither, both
+    const Vector3 reflected[4][2] = {{direction(30, 0), direction(85, 120)},
+                                     {direction(85, 0), direction(30, 120)},
+                                     {direction(60, 0), direction(60, 170)},
+                                     {direction(89, 0), direction(89, 180)}};
+    const Vector3 transmitted[3][2] = {{direction(30, 0), direction(85, 120, true)},
+                                       {direction(85, 0), direction(30, 120, true)},
+                                       {direction(60, 0), direction(45, 10, true)}};
+
+    bool passed = true;
+    for (int m = 0; m < 3; ++m)
+    {
+        for (int j = 0; j < 4; ++j)
+            passed &= compare(names[m], materials[m], iors[m], reflected[j][0], reflected[j][1], numqueries);
+        if (iors[m] != 1.0)
+            for (int j = 0; j < 3; ++j)
+                passed &= compare(names[m], materials[m], iors[m], transmitted[j][0], transmitted[j][1], numqueries);
+    }
+
+    return passed ? 0 : 1;
+}
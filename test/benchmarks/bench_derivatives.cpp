@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark the derivatives of eval() from one walk (Microsurface::evalDerivatives() in a DualT<N> tier, N the number
+// of derivatives of the material)
+// against central finite differences of eval() (two walk sets per parameter, with the same random numbers)
+// the value of evalDerivatives() must match eval() with the same random numbers (up to the contraction of floating point
+// operations, which may change a sampled walk, hence compared on the mean over the queries); the mean derivatives over
+// the same queries are compared statistically with the finite differences
+// returns a nonzero exit code on a mismatch
+// build: g++ -I include test/benchmarks/bench_derivatives.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_derivatives
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#define Z_BOUND 4.0
+#define VALUE_ERROR_BOUND 1e-6 // relative error of the mean value
+#define STEP 0.01 // relative step of the finite differences
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Queries
+{
+    std::vector<Vector3> wi, wo;
+};
+
+// mean and variance of a sum of values
+struct Moments
+{
+    double sum = 0.0, sum2 = 0.0;
+
+    void add(const double value)
+    {
+        sum += value;
+        sum2 += value * value;
+    }
+
+    double mean(const size_t count) const
+    {
+        return sum / double(count);
+    }
+
+    double variance(const size_t count) const
+    {
+        return std::max(sum2 / double(count) - mean(count) * mean(count), 0.0);
+    }
+};
+
+const char *derivativeName(const int i)
+{
+    const char *names[DERIVATIVE_COUNT] = {"roughness_x", "roughness_y", "gamma", "ior", "eta", "k"};
+    return names[i];
+}
+
+// shift parameter d of (parameters, ior) by h (eta and k: all the channels)
+void shiftParameter(MaterialParameters &parameters, double &ior, const int d, const double h)
+{
+    double *scalars[DERIVATIVE_COUNT] = {&parameters.roughness_x, &parameters.roughness_y, &parameters.gamma, &ior, 0, 0};
+    if (scalars[d])
+        *scalars[d] += h;
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+    {
+        if (d == DERIVATIVE_ETA)
+            parameters.eta[c] += h;
+        if (d == DERIVATIVE_K)
+            parameters.k[c] += h;
+    }
+}
+
+// a material: make<Float>(parameters, out_objects) builds the facet BSDF, NDF and Microsurface of a tier
+template <class Float>
+struct Material
+{
+    std::unique_ptr<BSDFT<Float>> facet;
+    std::unique_ptr<NDFT<Float>> ndf;
+    std::unique_ptr<MicrosurfaceT<Float>> microsurface;
+};
+
+// compare the derivatives of the parameters derivatives (with ior_t = ior) with finite differences, returns false on
+// a mismatch
+template <class Make, int N>
+bool compare(const char *name, const Make &make, const MaterialParameters &parameters, const double ior,
+             const MicrosurfaceDerivative (&derivatives)[N], const Queries &queries)
+{
+    const size_t count = queries.wi.size();
+    PhiloxSampler sampler(1);
+
+    // one derivative walk per query
+    Material<DualT<N>> dual;
+    make(derivativeParameters(parameters, derivatives), dual);
+    const DualT<N> dual_ior = derivativeParameter(ior, DERIVATIVE_IOR, derivatives);
+    std::vector<DualT<N>> results(count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        results[i] = dual.microsurface->evalDerivatives(1.0, dual_ior, Vector3T<DualT<N>>(queries.wi[i]),
+                                                        Vector3T<DualT<N>>(queries.wo[i]), sampler);
+    }
+    const double time_derivatives = seconds(start);
+
+    // eval(), for the values
+    Material<double> base;
+    make(parameters, base);
+    double value_error = 0.0, sum_values = 0.0, sum_results = 0.0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        const double value = base.microsurface->eval(1.0, ior, queries.wi[i], queries.wo[i], sampler);
+        value_error = std::max(value_error, std::abs(results[i].v - value) / std::max(std::abs(value), 1e-6));
+        sum_values += value;
+        sum_results += results[i].v;
+    }
+    const double time_eval = seconds(start);
+
+    const double mean_error = std::abs(sum_results - sum_values) / std::max(std::abs(sum_values), 1e-6);
+    bool passed = (mean_error <= VALUE_ERROR_BOUND);
+    std::cout << name << ": eval " << 1e9 * time_eval / double(count) << " ns/query, derivatives " << 1e9 * time_derivatives / double(count)
+              << " ns/query (" << time_derivatives / time_eval << "x eval); max relative value error " << value_error
+              << ", of the mean " << mean_error << (passed ? "" : " FAILED") << "\n";
+
+    // central differences with the same random numbers
+    double time_differences = 0.0;
+    for (int j = 0; j < N; ++j)
+    {
+        const MicrosurfaceDerivative d = derivatives[j];
+        MaterialParameters minus = parameters, plus = parameters;
+        double ior_minus = ior, ior_plus = ior;
+        const double values[DERIVATIVE_COUNT] = {parameters.roughness_x, parameters.roughness_y, parameters.gamma, ior, parameters.eta[0], parameters.k[0]};
+        const double h = STEP * values[d];
+        shiftParameter(plus, ior_plus, d, h);
+        shiftParameter(minus, ior_minus, d, -h);
+
+        Material<double> material_minus, material_plus;
+        make(minus, material_minus);
+        make(plus, material_plus);
+
+        Moments differences, estimates;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            sampler.startQuery(i);
+            const double value_plus = material_plus.microsurface->eval(1.0, ior_plus, queries.wi[i], queries.wo[i], sampler);
+            sampler.startQuery(i);
+            const double value_minus = material_minus.microsurface->eval(1.0, ior_minus, queries.wi[i], queries.wo[i], sampler);
+            differences.add((value_plus - value_minus) / (2.0 * h));
+        }
+        time_differences += seconds(start);
+
+        for (size_t i = 0; i < count; ++i)
+            estimates.add(results[i].d[j]);
+
+        const double error = sqrt((differences.variance(count) + estimates.variance(count)) / double(count));
+        const double z = (error > 0.0) ? (estimates.mean(count) - differences.mean(count)) / error : 0.0;
+        const bool derivative_passed = (std::abs(z) <= Z_BOUND);
+        passed &= derivative_passed;
+
+        std::cout << "  d/d" << derivativeName(d) << ": finite differences " << differences.mean(count) << " vs " << estimates.mean(count)
+                  << " (z " << z << "), variance " << differences.variance(count) << " vs " << estimates.variance(count)
+                  << (derivative_passed ? "" : " FAILED") << "\n";
+    }
+
+    std::cout << "  finite differences " << 1e9 * time_differences / double(count) << " ns/query for " << N
+              << " derivatives (" << time_differences / time_derivatives << "x the derivative walk)\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_derivatives alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    Queries reflected, both;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        reflected.wi.push_back(lambertDir(sampler));
+        reflected.wo.push_back(lambertDir(sampler));
+        both.wi.push_back(reflected.wi.back());
+        both.wo.push_back((i % 2) ? -reflected.wo.back() : reflected.wo.back());
+    }
+
+    MaterialParameters parameters;
+    parameters.roughness_x = alpha;
+    parameters.roughness_y = 1.5 * alpha;
+    parameters.gamma = 3.0;
+    parameters.eta = Spectrum(0.2);
+    parameters.k = Spectrum(3.0);
+    parameters.kd = 0.8;
+
+    bool passed = true;
+
+    // anisotropic GGX conductor, with and without the derivatives of the ior
+    const auto conductor = [](const auto &p, auto &material) {
+        typedef typename std::decay<decltype(p.kd)>::type Float;
+        material.facet.reset(new ConductorBRDFT<Float>(p.eta, p.k));
+        material.ndf.reset(new GGXNDFT<Float>(material.facet.get(), p.roughness_x, p.roughness_y));
+        material.microsurface.reset(new MicrosurfaceT<Float>(material.ndf.get()));
+    };
+    passed &= compare("GGX conductor", conductor, parameters, 1.0, {DERIVATIVE_ROUGHNESS_X, DERIVATIVE_ROUGHNESS_Y}, reflected);
+    passed &= compare("GGX conductor, eta and k", conductor, parameters, 1.0,
+                      {DERIVATIVE_ROUGHNESS_X, DERIVATIVE_ROUGHNESS_Y, DERIVATIVE_ETA, DERIVATIVE_K}, reflected);
+
+    // anisotropic GGX dielectric
+    passed &= compare("GGX dielectric", [](const auto &p, auto &material) {
+        typedef typename std::decay<decltype(p.kd)>::type Float;
+        material.facet.reset(new DielectricBSDFT<Float>());
+        material.ndf.reset(new GGXNDFT<Float>(material.facet.get(), p.roughness_x, p.roughness_y));
+        material.microsurface.reset(new MicrosurfaceT<Float>(material.ndf.get()));
+    }, parameters, 1.5, {DERIVATIVE_ROUGHNESS_X, DERIVATIVE_ROUGHNESS_Y, DERIVATIVE_IOR}, both);
+
+    // Student-T Lambert
+    passed &= compare("Student-T Lambert", [](const auto &p, auto &material) {
+        typedef typename std::decay<decltype(p.kd)>::type Float;
+        material.facet.reset(new LambertBRDFT<Float>(p.kd));
+        material.ndf.reset(new StudentTNDFT<Float>(material.facet.get(), p.roughness_x, p.roughness_y, p.gamma));
+        material.microsurface.reset(new MicrosurfaceT<Float>(material.ndf.get()));
+    }, parameters, 1.0, {DERIVATIVE_ROUGHNESS_X, DERIVATIVE_ROUGHNESS_Y, DERIVATIVE_GAMMA}, reflected);
+
+    return passed ? 0 : 1;
+}
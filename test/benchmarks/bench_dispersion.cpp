@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark dispersive walks (Microsurface::evalDispersive() and sampleDispersive(): one hero-wavelength walk for all
+// the wavelengths of a rough dielectric) against one scalar walk per wavelength
+// the walks differ, so each channel is compared statistically with its scalar walks: means of eval, and of the
+// reflected and transmitted sample weights, over the same queries
+// returns a nonzero exit code if a mean is off by more than Z_BOUND standard errors
+// build: g++ -I include test/benchmarks/bench_dispersion.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_dispersion
+
+// four wavelengths per walk
+#define SPECTRUM_CHANNELS 4
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/dielectric.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#define Z_BOUND 4.0
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Queries
+{
+    std::vector<Vector3> wi, wo;
+};
+
+// mean and variance of a sum of values
+struct Moments
+{
+    double sum = 0.0, sum2 = 0.0;
+
+    void add(const double value)
+    {
+        sum += value;
+        sum2 += value * value;
+    }
+
+    double mean(const size_t count) const
+    {
+        return sum / double(count);
+    }
+
+    double variance(const size_t count) const
+    {
+        return std::max(sum2 / double(count) - mean(count) * mean(count), 0.0);
+    }
+};
+
+// moments of eval, and of the reflected and transmitted sample weights
+struct Estimates
+{
+    Moments eval, reflected, transmitted;
+};
+
+double zScore(const Moments &a, const Moments &b, const size_t count)
+{
+    const double error = sqrt((a.variance(count) + b.variance(count)) / double(count));
+    return (error > 0.0) ? (a.mean(count) - b.mean(count)) / error : 0.0;
+}
+
+// compare a dispersive walk with the scalar walks of its wavelengths, returns false on a mismatch
+bool compare(const char *name, const Microsurface &microsurface, const Spectrum &iors_t, const Queries &queries)
+{
+    const size_t count = queries.wi.size();
+    PhiloxSampler sampler(1);
+
+    // dispersive walks
+    Estimates dispersive[SPECTRUM_CHANNELS];
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        const Spectrum value = microsurface.evalDispersive(1.0, iors_t, queries.wi[i], queries.wo[i], sampler);
+
+        sampler.startQuery(count + i);
+        Spectrum weight(1.0);
+        const Vector3 wo = microsurface.sampleDispersive(1.0, iors_t, queries.wi[i], weight, sampler);
+
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+        {
+            dispersive[c].eval.add(value[c]);
+            dispersive[c].reflected.add((wo.z >= 0.0) ? weight[c] : 0.0);
+            dispersive[c].transmitted.add((wo.z < 0.0) ? weight[c] : 0.0);
+        }
+    }
+    const double time_dispersive = seconds(start);
+
+    // one scalar walk per wavelength
+    Estimates scalar[SPECTRUM_CHANNELS];
+    start = std::chrono::steady_clock::now();
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            sampler.startQuery(2 * count * (c + 1) + i);
+            scalar[c].eval.add(microsurface.eval(1.0, iors_t[c], queries.wi[i], queries.wo[i], sampler));
+
+            sampler.startQuery(2 * count * (c + 1) + count + i);
+            double weight = 1.0;
+            const Vector3 wo = microsurface.sample(1.0, iors_t[c], queries.wi[i], weight, sampler);
+            scalar[c].reflected.add((wo.z >= 0.0) ? weight : 0.0);
+            scalar[c].transmitted.add((wo.z < 0.0) ? weight : 0.0);
+        }
+    }
+    const double time_scalar = seconds(start);
+
+    // efficiency: time * variance of eval, summed over the channels
+    double variance_dispersive = 0.0, variance_scalar = 0.0;
+    double z_max = 0.0;
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+    {
+        variance_dispersive += dispersive[c].eval.variance(count);
+        variance_scalar += scalar[c].eval.variance(count);
+        z_max = std::max(z_max, std::abs(zScore(dispersive[c].eval, scalar[c].eval, count)));
+        z_max = std::max(z_max, std::abs(zScore(dispersive[c].reflected, scalar[c].reflected, count)));
+        z_max = std::max(z_max, std::abs(zScore(dispersive[c].transmitted, scalar[c].transmitted, count)));
+    }
+
+    const bool passed = (z_max <= Z_BOUND);
+
+    // (eval is zero in the smooth limit)
+    const double efficiency = (variance_dispersive > 0.0) ? (time_scalar * variance_scalar) / (time_dispersive * variance_dispersive)
+                                                          : time_scalar / time_dispersive;
+
+    const double queries_count = double(2 * count);
+    std::cout << name << ": " << SPECTRUM_CHANNELS << " scalar walks " << 1e9 * time_scalar / queries_count << " ns/query, 1 dispersive walk "
+              << 1e9 * time_dispersive / queries_count << " ns/query (" << time_scalar / time_dispersive << "x); eval variance "
+              << variance_scalar << " vs " << variance_dispersive << ", efficiency " << efficiency << "x; max |z| " << z_max
+              << (passed ? "" : " FAILED") << "\n";
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+        std::cout << "  ior " << iors_t[c] << ": eval " << scalar[c].eval.mean(count) << " vs " << dispersive[c].eval.mean(count)
+                  << ", reflected " << scalar[c].reflected.mean(count) << " vs " << dispersive[c].reflected.mean(count)
+                  << ", transmitted " << scalar[c].transmitted.mean(count) << " vs " << dispersive[c].transmitted.mean(count) << "\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_dispersion alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    // reflected and transmitted directions
+    MTSampler sampler(1);
+    Queries queries;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        queries.wi.push_back(lambertDir(sampler));
+        const Vector3 wo = lambertDir(sampler);
+        queries.wo.push_back((i % 2) ? -wo : wo);
+    }
+
+    DielectricBSDF dielectric;
+    GGXNDF ndf(&dielectric, alpha, alpha);
+    const Microsurface microsurface(&ndf);
+
+    bool passed = true;
+
+    // crown glass (Cauchy fit) at 400, 480, 560 and 640 nm
+    const double crown[SPECTRUM_CHANNELS] = {1.5309, 1.5228, 1.5180, 1.5149};
+    passed &= compare("GGX crown glass", microsurface, Spectrum(crown), queries);
+
+    // exaggerated dispersion: the refracted directions of the wavelengths diverge
+    const double strong[SPECTRUM_CHANNELS] = {1.3, 1.5, 1.7, 1.9};
+    passed &= compare("GGX strong dispersion", microsurface, Spectrum(strong), queries);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark gamma variate generation: std::gamma_distribution constructed per call vs GammaSampler
+// build: clang++ -I include test/benchmarks/bench_gamma.cpp src/random.cpp -O3 -o test/benchmarks/bench_gamma
+
+#include <random.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <chrono>
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char *name, const double time, const double sum, const double sum2, const size_t n)
+{
+    const double mean = sum / double(n);
+    std::cout << name << ": " << 1e9 * time / double(n) << " ns/variate, mean " << mean << ", variance " << sum2 / double(n) - mean * mean << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_gamma gamma numsamples \n";
+        exit(-1);
+    }
+
+    const double gamma = StringToNumber<double>(std::string(argv[1]));
+    const size_t numsamples = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    const double shapes[2] = {gamma - 1.0, gamma - 1.5};
+
+    for (int s = 0; s < 2; ++s)
+    {
+        const double shape = shapes[s];
+        std::cout << "shape " << shape << " (expected mean and variance " << shape << ")\n";
+
+        // previous path: a std::gamma_distribution per variate
+        {
+            double sum = 0.0, sum2 = 0.0;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < numsamples; ++i)
+            {
+                D_gamma r(shape, 1.0);
+                SamplerURBG urbg{sampler};
+                const double x = r(urbg);
+                sum += x;
+                sum2 += x * x;
+            }
+            report("  std::gamma_distribution", seconds(start), sum, sum2, numsamples);
+        }
+
+        // precomputed Marsaglia-Tsang constants
+        {
+            const GammaSampler gs(shape);
+            double sum = 0.0, sum2 = 0.0;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < numsamples; ++i)
+            {
+                const double x = gs.sample(sampler);
+                sum += x;
+                sum2 += x * x;
+            }
+            report("  GammaSampler          ", seconds(start), sum, sum2, numsamples);
+        }
+
+        // batch variant
+        {
+            const GammaSampler gs(shape);
+            std::vector<double> batch(1024);
+            double sum = 0.0, sum2 = 0.0;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < numsamples; i += batch.size())
+            {
+                gs.sample(batch.data(), batch.size(), sampler);
+                for (size_t j = 0; j < batch.size(); ++j)
+                {
+                    sum += batch[j];
+                    sum2 += batch[j] * batch[j];
+                }
+            }
+            const size_t n = ((numsamples + batch.size() - 1) / batch.size()) * batch.size();
+            report("  GammaSampler (batch)  ", seconds(start), sum, sum2, n);
+        }
+    }
+
+    // end-to-end Student-T vNDF sampling
+    StudentTNDF ndf(0, 1.0, 1.0, gamma);
+    const Vector3 wi(sqrt(1.0 - 0.25), 0.0, 0.5);
+    Vector3 sum(0, 0, 0);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numsamples; ++i)
+    {
+        sum += ndf.sampleD_wi(wi, sampler);
+    }
+    std::cout << "Student-T sampleD_wi: " << 1e9 * seconds(start) / double(numsamples) << " ns/sample (mean z " << sum.z / double(numsamples) << ")\n";
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark the packet random walk (PacketMicrosurface) against the scalar walk (Microsurface) on the same batch
+// the means of the two must agree up to Monte Carlo noise (z is the difference in standard errors)
+// build: g++ -I include test/benchmarks/bench_packet.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_packet
+
+#include <bsdfs/microsurface_packet.h>
+#include <chrono>
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void meanAndError(const std::vector<double> &values, double &mean, double &error)
+{
+    double sum = 0.0, sum2 = 0.0;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        sum += values[i];
+        sum2 += values[i] * values[i];
+    }
+    mean = sum / double(values.size());
+    error = sqrt(std::max(0.0, sum2 / double(values.size()) - mean * mean) / double(values.size()));
+}
+
+void report(const char *name, const double time_scalar, const double time_packet,
+            const std::vector<double> &scalar, const std::vector<double> &packet)
+{
+    double mean_scalar, error_scalar, mean_packet, error_packet;
+    meanAndError(scalar, mean_scalar, error_scalar);
+    meanAndError(packet, mean_packet, error_packet);
+    const double z = (mean_packet - mean_scalar) / sqrt(error_scalar * error_scalar + error_packet * error_packet + 1e-300);
+
+    std::cout << "  " << name << ": scalar " << 1e9 * time_scalar / double(scalar.size()) << " ns/query, packet "
+              << 1e9 * time_packet / double(packet.size()) << " ns/query (" << time_scalar / time_packet << "x), mean "
+              << mean_scalar << " vs " << mean_packet << " (z " << z << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        std::cout << "usage: bench_packet alpha ior numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const double ior = StringToNumber<double>(std::string(argv[2]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[3]));
+
+    std::cout << "PACKET_WIDTH " << PACKET_WIDTH << "\n";
+
+    // random directions, wo on both sides for the dielectric
+    MTSampler sampler(1);
+    std::vector<double> wi_x(numqueries), wi_y(numqueries), wi_z(numqueries), wo_x(numqueries), wo_y(numqueries), wo_z(numqueries);
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        const Vector3 wi = lambertDir(sampler);
+        const Vector3 wo = isotropicDir(sampler);
+        wi_x[i] = wi.x, wi_y[i] = wi.y, wi_z[i] = wi.z;
+        wo_x[i] = wo.x, wo_y[i] = wo.y, wo_z[i] = wo.z;
+    }
+
+    MicrosurfaceBatch batch;
+    batch.count = numqueries;
+    batch.wi = Vector3Arrays<const double>(wi_x.data(), wi_y.data(), wi_z.data());
+    batch.wo = Vector3Arrays<const double>(wo_x.data(), wo_y.data(), wo_z.data());
+
+    ConductorBRDF conductor(0.2, 3.0);
+    DielectricBSDF dielectric;
+    MirrorBRDF mirror;
+    const BSDF *facets[3] = {&conductor, &dielectric, &mirror};
+    const char *facet_names[3] = {"conductor", "dielectric", "mirror"};
+
+    std::vector<double> scalar(numqueries), packet(numqueries);
+    std::vector<double> out_x(numqueries), out_y(numqueries), out_z(numqueries);
+    const Vector3Arrays<double> out_wo(out_x.data(), out_y.data(), out_z.data());
+
+    for (int n = 0; n < 2; ++n)
+    {
+        for (int f = 0; f < 3; ++f)
+        {
+            GGXNDF ggx(facets[f], alpha, alpha);
+            BeckmannNDF beckmann(facets[f], alpha, alpha);
+            NDF *ndf = (n == 0) ? (NDF *)&ggx : (NDF *)&beckmann;
+            batch.ior_t = (f == 1) ? ior : 1.0;
+
+            const Microsurface scalar_microsurface(ndf);
+            const PacketMicrosurface packet_microsurface(scalar_microsurface);
+            std::cout << ((n == 0) ? "GGX" : "Beckmann") << " " << facet_names[f] << "\n";
+
+            // eval
+            PhiloxSampler scalar_sampler(1);
+            auto start = std::chrono::steady_clock::now();
+            scalar_microsurface.evalBatch(batch, scalar.data(), scalar_sampler);
+            const double time_scalar_eval = seconds(start);
+
+            start = std::chrono::steady_clock::now();
+            packet_microsurface.evalBatch(batch, packet.data(), 2);
+            report("eval  ", time_scalar_eval, seconds(start), scalar, packet);
+
+            // sample: compare the mean of weight * wo.z
+            start = std::chrono::steady_clock::now();
+            scalar_microsurface.sampleBatch(batch, out_wo, scalar.data(), scalar_sampler);
+            const double time_scalar_sample = seconds(start);
+            for (size_t i = 0; i < numqueries; ++i)
+                scalar[i] *= out_z[i];
+
+            start = std::chrono::steady_clock::now();
+            packet_microsurface.sampleBatch(batch, out_wo, packet.data(), 2);
+            const double time_packet_sample = seconds(start);
+            for (size_t i = 0; i < numqueries; ++i)
+                packet[i] *= out_z[i];
+            report("sample", time_scalar_sample, time_packet_sample, scalar, packet);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark batches of spatially varying materials (Microsurface::evalBatch()/sampleBatch() with a
+// MicrosurfacePalette of texels) against constructing the facet BSDF, NDF and Microsurface of each query
+// both run the same walks with the same random numbers, so the results must be identical
+// build: g++ -I include test/benchmarks/bench_palette.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_palette
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// texels of the material (structure of arrays)
+struct Texels
+{
+    std::vector<double> roughness_x, roughness_y, gamma, eta, k, kd;
+};
+
+// queries: directions as arrays, and the texel of each query
+struct Queries
+{
+    std::vector<double> wi_x, wi_y, wi_z, wo_x, wo_y, wo_z;
+    std::vector<uint32_t> texels;
+};
+
+size_t countMismatches(const std::vector<double> &a, const std::vector<double> &b)
+{
+    size_t mismatched = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        if (!(a[i] == b[i]) && !(a[i] != a[i] && b[i] != b[i]))
+            mismatched++;
+    }
+    return mismatched;
+}
+
+// eval and sample (weight * wo.z) of every query, constructing the objects of each query with make(texel, ...)
+template <class Make>
+double runConstructed(const Queries &queries, const Make &make, std::vector<double> &out_results)
+{
+    PhiloxSampler sampler(1);
+    const size_t count = queries.texels.size();
+    out_results.resize(2 * count);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Vector3 wi(queries.wi_x[i], queries.wi_y[i], queries.wi_z[i]);
+        const Vector3 wo(queries.wo_x[i], queries.wo_y[i], queries.wo_z[i]);
+        out_results[i] = make(queries.texels[i], [&](const Microsurface &microsurface) {
+            sampler.startQuery(i);
+            return microsurface.eval(1.0, 1.0, wi, wo, sampler);
+        });
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Vector3 wi(queries.wi_x[i], queries.wi_y[i], queries.wi_z[i]);
+        out_results[count + i] = make(queries.texels[i], [&](const Microsurface &microsurface) {
+            sampler.startQuery(count + i);
+            double weight = 1.0;
+            const Vector3 wo = microsurface.sample(1.0, 1.0, wi, weight, sampler);
+            return weight * wo.z;
+        });
+    }
+    return seconds(start);
+}
+
+// the same queries as two palette batches on one microsurface
+double runPalette(const Queries &queries, const MicrosurfacePalette &palette, NDF &ndf, BSDF &facet, std::vector<double> &out_results)
+{
+    PhiloxSampler sampler(1);
+    const size_t count = queries.texels.size();
+    out_results.resize(2 * count);
+    std::vector<double> wo_x(count), wo_y(count), wo_z(count);
+
+    const Microsurface microsurface(&ndf);
+    MicrosurfaceBatch batch;
+    batch.count = count;
+    batch.wi = Vector3Arrays<const double>(queries.wi_x.data(), queries.wi_y.data(), queries.wi_z.data());
+    batch.wo = Vector3Arrays<const double>(queries.wo_x.data(), queries.wo_y.data(), queries.wo_z.data());
+    batch.materials = queries.texels.data();
+
+    const auto start = std::chrono::steady_clock::now();
+    microsurface.evalBatch(batch, palette, ndf, facet, out_results.data(), sampler);
+    batch.first_query = count;
+    microsurface.sampleBatch(batch, palette, ndf, facet, Vector3Arrays<double>(wo_x.data(), wo_y.data(), wo_z.data()),
+                             out_results.data() + count, sampler);
+    const double time = seconds(start);
+
+    for (size_t i = 0; i < count; ++i)
+        out_results[count + i] *= wo_z[i];
+    return time;
+}
+
+void report(const char *name, const double time_constructed, const double time_palette, const std::vector<double> &constructed,
+            const std::vector<double> &palette)
+{
+    const double queries_count = double(constructed.size());
+    std::cout << name << ": constructed " << 1e9 * time_constructed / queries_count << " ns/query, palette "
+              << 1e9 * time_palette / queries_count << " ns/query (" << time_constructed / time_palette << "x), mismatched results: "
+              << countMismatches(constructed, palette) << "\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_palette numtexels numqueries \n";
+        exit(-1);
+    }
+
+    const size_t numtexels = StringToNumber<size_t>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    Texels texels;
+    for (size_t t = 0; t < numtexels; ++t)
+    {
+        texels.roughness_x.push_back(RandomReal(0.1, 1.0, sampler));
+        texels.roughness_y.push_back(RandomReal(0.1, 1.0, sampler));
+        texels.gamma.push_back(RandomReal(2.5, 6.0, sampler));
+        texels.eta.push_back(RandomReal(0.1, 2.0, sampler));
+        texels.k.push_back(RandomReal(1.0, 4.0, sampler));
+        texels.kd.push_back(RandomReal(0.1, 0.9, sampler));
+    }
+
+    // queries in texel order (e.g. the shading points of a tile) would set each texel once, random texels set one per query
+    Queries queries;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        const Vector3 wi = lambertDir(sampler);
+        const Vector3 wo = lambertDir(sampler);
+        queries.wi_x.push_back(wi.x);
+        queries.wi_y.push_back(wi.y);
+        queries.wi_z.push_back(wi.z);
+        queries.wo_x.push_back(wo.x);
+        queries.wo_y.push_back(wo.y);
+        queries.wo_z.push_back(wo.z);
+        queries.texels.push_back(uint32_t(std::min(size_t(RandomReal(sampler) * numtexels), numtexels - 1)));
+    }
+
+    std::vector<double> constructed, palette_results;
+
+    // GGX conductor, textured anisotropic roughness and ior
+    {
+        const double time_constructed = runConstructed(queries, [&](const uint32_t t, const auto &query) {
+            const ConductorBRDF conductor(texels.eta[t], texels.k[t]);
+            GGXNDF ndf(&conductor, texels.roughness_x[t], texels.roughness_y[t]);
+            const Microsurface microsurface(&ndf);
+            return query(microsurface);
+        }, constructed);
+
+        MicrosurfacePalette palette;
+        palette.roughnesses_x = texels.roughness_x.data();
+        palette.roughnesses_y = texels.roughness_y.data();
+        palette.etas = texels.eta.data();
+        palette.ks = texels.k.data();
+        ConductorBRDF conductor(1.0, 0.0);
+        GGXNDF ndf(&conductor, 1.0, 1.0);
+        const double time_palette = runPalette(queries, palette, ndf, conductor, palette_results);
+
+        report("GGX conductor", time_constructed, time_palette, constructed, palette_results);
+    }
+
+    // GGX colored conductor (gold), textured anisotropic roughness, shared per-channel ior
+    {
+        const Spectrum eta(0.143, 0.374, 1.442), k(3.983, 2.385, 1.603);
+        const double time_constructed = runConstructed(queries, [&](const uint32_t t, const auto &query) {
+            const ConductorBRDF conductor(eta, k);
+            GGXNDF ndf(&conductor, texels.roughness_x[t], texels.roughness_y[t]);
+            const Microsurface microsurface(&ndf);
+            return query(microsurface);
+        }, constructed);
+
+        MicrosurfacePalette palette;
+        palette.roughnesses_x = texels.roughness_x.data();
+        palette.roughnesses_y = texels.roughness_y.data();
+        palette.shared.eta = eta;
+        palette.shared.k = k;
+        ConductorBRDF conductor(1.0, 0.0);
+        GGXNDF ndf(&conductor, 1.0, 1.0);
+        const double time_palette = runPalette(queries, palette, ndf, conductor, palette_results);
+
+        report("GGX colored conductor", time_constructed, time_palette, constructed, palette_results);
+    }
+
+    // Student-T Lambert, textured isotropic roughness, gamma and albedo
+    {
+        const double time_constructed = runConstructed(queries, [&](const uint32_t t, const auto &query) {
+            const LambertBRDF lambert(texels.kd[t]);
+            StudentTNDF ndf(&lambert, texels.roughness_x[t], texels.roughness_x[t], texels.gamma[t]);
+            const Microsurface microsurface(&ndf);
+            return query(microsurface);
+        }, constructed);
+
+        MicrosurfacePalette palette;
+        palette.roughnesses_x = texels.roughness_x.data();
+        palette.roughnesses_y = texels.roughness_x.data();
+        palette.gammas = texels.gamma.data();
+        palette.kds = texels.kd.data();
+        LambertBRDF lambert(1.0);
+        StudentTNDF ndf(&lambert, 1.0, 1.0, 3.0);
+        const double time_palette = runPalette(queries, palette, ndf, lambert, palette_results);
+
+        report("Student-T Lambert", time_constructed, time_palette, constructed, palette_results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark the float precision tier (MicrosurfaceT<float>) against the double tier (Microsurface), and bound its error
+// for each NDF: sigma, D and G_1 on the same (float) directions, and the means of eval and sample over the same queries
+// with the same random numbers
+// returns a nonzero exit code if an error exceeds its bound
+// build: g++ -I include test/benchmarks/bench_precision.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_precision
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/beckmann.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/NDFs/NullStudentT.h>
+#include <bsdfs/NDFs/NullvMF.h>
+#include <bsdfs/NDFs/BlendedNDF.h>
+#include <bsdfs/conductor.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// bounds of the relative error of the float tier
+#define NDF_ERROR_BOUND 1e-4  // sigma, D and G_1
+#define MEAN_ERROR_BOUND 1e-3 // means of eval and sample
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double relativeError(const double value, const double reference)
+{
+    const double difference = std::abs(value - reference);
+    return (difference == 0.0) ? 0.0 : difference / std::max(std::abs(reference), 1e-6);
+}
+
+// directions representable in float, so that both tiers see the same inputs
+struct Queries
+{
+    std::vector<Vector3T<float>> wi, wo;
+};
+
+// mean of eval and of sample (weight * wo.z) over the queries; returns the time
+template <class Float>
+double run(const MicrosurfaceT<Float> &microsurface, const Queries &queries, double &out_eval, double &out_sample)
+{
+    typedef Vector3T<Float> Vector3;
+
+    PhiloxSampler sampler(1);
+    const size_t count = queries.wi.size();
+    out_eval = 0.0;
+    out_sample = 0.0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        out_eval += microsurface.eval(1.0, 1.0, Vector3(queries.wi[i]), Vector3(queries.wo[i]), sampler);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(count + i);
+        Float weight = 1.0;
+        const Vector3 wo = microsurface.sample(1.0, 1.0, Vector3(queries.wi[i]), weight, sampler);
+        out_sample += weight * wo.z;
+    }
+    const double time = seconds(start);
+
+    out_eval /= double(count);
+    out_sample /= double(count);
+    return time;
+}
+
+// compare the two tiers of an NDF, returns false if an error exceeds its bound
+bool compare(const char *name, NDFT<double> &ndf_double, NDFT<float> &ndf_float, const Queries &queries)
+{
+    // NDF functions, on the first queries
+    double error_sigma = 0.0, error_D = 0.0, error_G1 = 0.0;
+    const size_t ndf_count = std::min(queries.wi.size(), size_t(1000));
+    for (size_t i = 0; i < ndf_count; ++i)
+    {
+        const Vector3T<float> &w_float = queries.wo[i];
+        const Vector3 w_double(w_float);
+        error_sigma = std::max(error_sigma, relativeError(ndf_float.sigma(w_float), ndf_double.sigma(w_double)));
+        error_D = std::max(error_D, relativeError(ndf_float.D(w_float), ndf_double.D(w_double)));
+        error_G1 = std::max(error_G1, relativeError(ndf_float.G_1(w_float, -0.5f), ndf_double.G_1(w_double, -0.5)));
+    }
+
+    // walks
+    const Microsurface microsurface_double(&ndf_double);
+    const MicrosurfaceT<float> microsurface_float(&ndf_float);
+
+    double eval_double, sample_double, eval_float, sample_float;
+    const double time_double = run(microsurface_double, queries, eval_double, sample_double);
+    const double time_float = run(microsurface_float, queries, eval_float, sample_float);
+    const double error_eval = relativeError(eval_float, eval_double);
+    const double error_sample = relativeError(sample_float, sample_double);
+
+    const bool passed = (error_sigma <= NDF_ERROR_BOUND) && (error_D <= NDF_ERROR_BOUND) && (error_G1 <= NDF_ERROR_BOUND) &&
+                        (error_eval <= MEAN_ERROR_BOUND) && (error_sample <= MEAN_ERROR_BOUND);
+
+    const double queries_count = double(2 * queries.wi.size());
+    std::cout << name << ": relative error sigma " << error_sigma << ", D " << error_D << ", G_1 " << error_G1
+              << ", eval mean " << error_eval << ", sample mean " << error_sample << "; double "
+              << 1e9 * time_double / queries_count << " ns/query, float " << 1e9 * time_float / queries_count << " ns/query ("
+              << time_double / time_float << "x)" << (passed ? "" : " FAILED") << "\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_precision alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    Queries queries;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        queries.wi.push_back(Vector3T<float>(lambertDir(sampler)));
+        queries.wo.push_back(Vector3T<float>(lambertDir(sampler)));
+    }
+
+    // the null-collision NDFs walk much longer
+    Queries null_queries = queries;
+    null_queries.wi.resize(std::max(numqueries / 20, size_t(1)));
+    null_queries.wo.resize(null_queries.wi.size());
+
+    ConductorBRDF conductor_double(0.2, 3.0);
+    ConductorBRDFT<float> conductor_float(0.2f, 3.0f);
+
+    bool passed = true;
+
+    GGXNDF ggx_double(&conductor_double, alpha, alpha);
+    GGXNDFT<float> ggx_float(&conductor_float, alpha, alpha);
+    passed &= compare("GGX", ggx_double, ggx_float, queries);
+
+    BeckmannNDF beckmann_double(&conductor_double, alpha, alpha);
+    BeckmannNDFT<float> beckmann_float(&conductor_float, alpha, alpha);
+    passed &= compare("Beckmann", beckmann_double, beckmann_float, queries);
+
+    StudentTNDF studentT_double(&conductor_double, alpha, alpha, 3.0);
+    StudentTNDFT<float> studentT_float(&conductor_float, alpha, alpha, 3.0f);
+    passed &= compare("Student-T", studentT_double, studentT_float, queries);
+
+    BlendedNDF blended_double(&ggx_double, &beckmann_double, 0.3);
+    BlendedNDFT<float> blended_float(&ggx_float, &beckmann_float, 0.3f);
+    passed &= compare("Blended GGX/Beckmann", blended_double, blended_float, queries);
+
+    NullStudentTNDF null_studentT_double(&conductor_double, alpha, 3.0, 1.0 / (M_PI * alpha * alpha));
+    NullStudentTNDFT<float> null_studentT_float(&conductor_float, alpha, 3.0f, 1.0 / (M_PI * alpha * alpha));
+    passed &= compare("null Student-T", null_studentT_double, null_studentT_float, null_queries);
+
+    NullvMFNDF null_vMF_double(&conductor_double, alpha);
+    NullvMFNDFT<float> null_vMF_float(&conductor_float, alpha);
+    passed &= compare("null vMF", null_vMF_double, null_vMF_float, null_queries);
+
+    return passed ? 0 : 1;
+}
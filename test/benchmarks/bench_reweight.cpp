@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark parameter sweeps by reweighting recorded walks (Microsurface::evalRecord() once at a reference parameter,
+// then Microsurface::evalRecorded() at each parameter of the sweep) against new eval() walks at each parameter
+// at the reference parameter, the recorded walks must reproduce the values of their recording; elsewhere the two are
+// compared statistically (mean of the differences per query), where the effective sample size is at least ESS_BOUND
+// returns a nonzero exit code on a mismatch
+// build: g++ -I include test/benchmarks/bench_reweight.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_reweight
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#define Z_BOUND 4.0
+#define ESS_BOUND 0.1 // fraction of the walks
+#define REPLAY_ERROR_BOUND 1e-12
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Queries
+{
+    std::vector<Vector3> wi, wo;
+};
+
+// mean and variance of a sum of values
+struct Moments
+{
+    double sum = 0.0, sum2 = 0.0;
+
+    void add(const double value)
+    {
+        sum += value;
+        sum2 += value * value;
+    }
+
+    double mean(const size_t count) const
+    {
+        return sum / double(count);
+    }
+
+    double variance(const size_t count) const
+    {
+        return std::max(sum2 / double(count) - mean(count) * mean(count), 0.0);
+    }
+};
+
+// sweep the parameter of ndf over values (set(ndf, value)), from walks recorded at reference, returns false on a mismatch
+template <class Set>
+bool sweep(const char *name, NDF &ndf, const Set &set, const double reference, const std::vector<double> &values, const Queries &queries)
+{
+    const size_t count = queries.wi.size();
+    PhiloxSampler sampler(1);
+    const Microsurface microsurface(&ndf);
+
+    // record
+    set(ndf, reference);
+    MicrosurfaceRecording recording;
+    std::vector<double> recorded(count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        recorded[i] = microsurface.evalRecord(1.0, 1.5, queries.wi[i], queries.wo[i], recording, sampler);
+    }
+    const double time_record = seconds(start);
+
+    bool passed = true;
+    std::vector<double> ratios(count);
+    double time_new = 0.0, time_reweighted = 0.0;
+    std::cout << name << ": " << recording.collisions.size() / double(count) << " collisions/walk\n";
+    for (const double value : values)
+    {
+        set(ndf, value);
+
+        // new walks
+        std::vector<double> fresh(count);
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            sampler.startQuery(count * 2 + i);
+            fresh[i] = microsurface.eval(1.0, 1.5, queries.wi[i], queries.wo[i], sampler);
+        }
+        time_new += seconds(start);
+
+        // recorded walks
+        std::vector<double> reweighted(count);
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            reweighted[i] = microsurface.evalRecorded(recording, i, sampler, &ratios[i]);
+        time_reweighted += seconds(start);
+
+        Moments mean_fresh, mean_reweighted, difference;
+        double replay_error = 0.0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            mean_fresh.add(fresh[i]);
+            mean_reweighted.add(reweighted[i]);
+            difference.add(reweighted[i] - fresh[i]);
+            if (value == reference)
+                replay_error = std::max(replay_error, std::abs(reweighted[i] - recorded[i]) / std::max(std::abs(recorded[i]), 1e-6));
+        }
+
+        const double ess = effectiveSampleSize(ratios.data(), count) / double(count);
+        const double error = sqrt(difference.variance(count) / double(count));
+        const double z = (error > 0.0) ? difference.mean(count) / error : 0.0;
+        const bool checked = (ess >= ESS_BOUND);
+        const bool point_passed = (replay_error <= REPLAY_ERROR_BOUND) && (!checked || std::abs(z) <= Z_BOUND);
+        passed &= point_passed;
+
+        std::cout << "  " << value << ": eval " << mean_fresh.mean(count) << " vs reweighted " << mean_reweighted.mean(count) << " (z " << z
+                  << (checked ? "" : ", not checked") << "), ESS " << 100.0 * ess << "%";
+        if (value == reference)
+            std::cout << ", max relative replay error " << replay_error;
+        std::cout << (point_passed ? "" : " FAILED") << "\n";
+    }
+
+    const double queries_count = double(count * values.size());
+    std::cout << "  new walks " << 1e9 * time_new / queries_count << " ns/query, reweighted " << 1e9 * time_reweighted / queries_count
+              << " ns/query (" << time_new / time_reweighted << "x), recording " << 1e9 * time_record / double(count) << " ns/query\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_reweight alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    Queries reflected, both;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        reflected.wi.push_back(lambertDir(sampler));
+        reflected.wo.push_back(lambertDir(sampler));
+        both.wi.push_back(reflected.wi.back());
+        both.wo.push_back((i % 2) ? -reflected.wo.back() : reflected.wo.back());
+    }
+
+    const auto setRoughness = [](NDF &ndf, const double roughness) {
+        MaterialParameters parameters;
+        parameters.roughness_x = roughness;
+        parameters.roughness_y = roughness;
+        ndf.setParameters(parameters);
+    };
+    std::vector<double> roughnesses;
+    for (const double scale : {0.6, 0.8, 0.9, 1.0, 1.1, 1.25, 1.5})
+        roughnesses.push_back(scale * alpha);
+
+    bool passed = true;
+
+    // GGX conductor, roughness
+    {
+        ConductorBRDF conductor(0.2, 3.0);
+        GGXNDF ndf(&conductor, alpha, alpha);
+        passed &= sweep("GGX conductor, roughness", ndf, setRoughness, alpha, roughnesses, reflected);
+    }
+
+    // GGX dielectric, roughness
+    {
+        DielectricBSDF dielectric;
+        GGXNDF ndf(&dielectric, alpha, alpha);
+        passed &= sweep("GGX dielectric, roughness", ndf, setRoughness, alpha, roughnesses, both);
+    }
+
+    // Student-T Lambert, shape
+    {
+        LambertBRDF lambert(0.8);
+        StudentTNDF ndf(&lambert, alpha, alpha, 3.0);
+        const auto setGamma = [&](NDF &ndf, const double gamma) {
+            MaterialParameters parameters;
+            parameters.roughness_x = alpha;
+            parameters.roughness_y = alpha;
+            parameters.gamma = gamma;
+            ndf.setParameters(parameters);
+        };
+        passed &= sweep("Student-T Lambert, gamma", ndf, setGamma, 3.0, {2.2, 2.5, 3.0, 4.0, 6.0, 10.0}, reflected);
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark spectral walks (Microsurface::evalSpectrum() and sampleSpectrum(): one walk for all the channels of a
+// colored facet BSDF) against one scalar walk per channel, on gray facet BSDFs with the values of each channel
+// without roulette, both run the same walks with the same random numbers, so each channel must match its scalar walk
+// returns a nonzero exit code on a mismatch
+// build: g++ -I include test/benchmarks/bench_spectral.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_spectral
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// bound of the relative difference between a channel of a spectral walk and its scalar walk
+#define CHANNEL_ERROR_BOUND 1e-12
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double relativeError(const double value, const double reference)
+{
+    const double difference = std::abs(value - reference);
+    return (difference == 0.0) ? 0.0 : difference / std::max(std::abs(reference), 1e-6);
+}
+
+struct Queries
+{
+    std::vector<Vector3> wi, wo;
+};
+
+// compare a spectral walk on a colored facet BSDF with the scalar walks on the gray facet BSDFs of its channels,
+// returns false on a mismatch
+bool compare(const char *name, const Microsurface &spectral, const Microsurface *const *channels, const Queries &queries)
+{
+    const size_t count = queries.wi.size();
+    PhiloxSampler sampler(1);
+
+    // spectral walks
+    std::vector<Spectrum> eval_spectral(count), sample_spectral(count);
+    std::vector<Vector3> wo_spectral(count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        eval_spectral[i] = spectral.evalSpectrum(1.0, 1.0, queries.wi[i], queries.wo[i], sampler);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(count + i);
+        sample_spectral[i] = Spectrum(1.0);
+        wo_spectral[i] = spectral.sampleSpectrum(1.0, 1.0, queries.wi[i], sample_spectral[i], sampler);
+    }
+    const double time_spectral = seconds(start);
+
+    // one scalar walk per channel
+    double error = 0.0;
+    size_t mismatched_directions = 0;
+    double time_scalar = 0.0;
+    for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+    {
+        std::vector<double> eval_scalar(count), sample_scalar(count);
+        std::vector<Vector3> wo_scalar(count);
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+        {
+            sampler.startQuery(i);
+            eval_scalar[i] = channels[c]->eval(1.0, 1.0, queries.wi[i], queries.wo[i], sampler);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            sampler.startQuery(count + i);
+            sample_scalar[i] = 1.0;
+            wo_scalar[i] = channels[c]->sample(1.0, 1.0, queries.wi[i], sample_scalar[i], sampler);
+        }
+        time_scalar += seconds(start);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            error = std::max(error, relativeError(eval_spectral[i][c], eval_scalar[i]));
+            error = std::max(error, relativeError(sample_spectral[i][c], sample_scalar[i]));
+            if ((sample_scalar[i] != 0.0) && (wo_scalar[i].x != wo_spectral[i].x || wo_scalar[i].y != wo_spectral[i].y || wo_scalar[i].z != wo_spectral[i].z))
+                mismatched_directions++;
+        }
+    }
+
+    const bool passed = (error <= CHANNEL_ERROR_BOUND) && (mismatched_directions == 0);
+
+    const double queries_count = double(2 * count);
+    std::cout << name << ": " << SPECTRUM_CHANNELS << " scalar walks " << 1e9 * time_scalar / queries_count << " ns/query, 1 spectral walk "
+              << 1e9 * time_spectral / queries_count << " ns/query (" << time_scalar / time_spectral << "x); max relative channel error "
+              << error << ", mismatched directions " << mismatched_directions << (passed ? "" : " FAILED") << "\n";
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_spectral alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    MTSampler sampler(1);
+    Queries queries;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        queries.wi.push_back(lambertDir(sampler));
+        queries.wo.push_back(lambertDir(sampler));
+    }
+
+    // the walks must consume the same random numbers
+    const NoRoulette no_roulette;
+    bool passed = true;
+
+    // gold-like conductor
+    {
+        const Spectrum eta(0.18, 0.42, 1.37);
+        const Spectrum k(3.42, 2.35, 1.77);
+        ConductorBRDF colored(eta, k);
+        GGXNDF ndf(&colored, alpha, alpha);
+        const Microsurface spectral(&ndf, MAX_WALK_LENGTH, &no_roulette);
+
+        std::vector<std::unique_ptr<ConductorBRDF>> bsdfs;
+        std::vector<std::unique_ptr<GGXNDF>> ndfs;
+        std::vector<std::unique_ptr<Microsurface>> microsurfaces;
+        const Microsurface *channels[SPECTRUM_CHANNELS];
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+        {
+            bsdfs.emplace_back(new ConductorBRDF(eta[c], k[c]));
+            ndfs.emplace_back(new GGXNDF(bsdfs.back().get(), alpha, alpha));
+            microsurfaces.emplace_back(new Microsurface(ndfs.back().get(), MAX_WALK_LENGTH, &no_roulette));
+            channels[c] = microsurfaces.back().get();
+        }
+        passed &= compare("GGX colored conductor", spectral, channels, queries);
+    }
+
+    // colored diffuse
+    {
+        const Spectrum kd(0.8, 0.5, 0.2);
+        LambertBRDF colored(kd);
+        GGXNDF ndf(&colored, alpha, alpha);
+        const Microsurface spectral(&ndf, MAX_WALK_LENGTH, &no_roulette);
+
+        std::vector<std::unique_ptr<LambertBRDF>> bsdfs;
+        std::vector<std::unique_ptr<GGXNDF>> ndfs;
+        std::vector<std::unique_ptr<Microsurface>> microsurfaces;
+        const Microsurface *channels[SPECTRUM_CHANNELS];
+        for (int c = 0; c < SPECTRUM_CHANNELS; ++c)
+        {
+            bsdfs.emplace_back(new LambertBRDF(kd[c]));
+            ndfs.emplace_back(new GGXNDF(bsdfs.back().get(), alpha, alpha));
+            microsurfaces.emplace_back(new Microsurface(ndfs.back().get(), MAX_WALK_LENGTH, &no_roulette));
+            channels[c] = microsurfaces.back().get();
+        }
+        passed &= compare("GGX colored Lambert", spectral, channels, queries);
+    }
+
+    return passed ? 0 : 1;
+}
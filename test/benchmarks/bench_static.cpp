@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark the compile-time specialized walk (MicrosurfaceOperator<NDF type, facet type>) against the
+// runtime-polymorphic walk (Microsurface) on the same queries
+// both run the same walk with the same random numbers: results must match up to rounding (MATCH_TOLERANCE), and are
+// bit-identical without contraction of floating point operations (the two walks inline differently, and may fuse
+// different mul+add into FMAs, e.g. with -march=native; -ffp-contract=off keeps them bit-identical)
+// timings: the two walks run alternately, repetitions times each, and each keeps its fastest run
+// build: g++ -I include test/benchmarks/bench_static.cpp src/random.cpp -O3 -march=native -o test/benchmarks/bench_static
+
+#include <bsdfs/microsurface.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/beckmann.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/lambert.h>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#define MATCH_TOLERANCE 1e-9 // relative
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Queries
+{
+    std::vector<Vector3> wi, wo;
+    double ior_t;
+};
+
+// eval and sample of all queries; returns the time and fills the results
+template <class MicrosurfaceType>
+double run(const MicrosurfaceType &microsurface, const Queries &queries, std::vector<double> &out_results)
+{
+    PhiloxSampler sampler(1);
+    const size_t count = queries.wi.size();
+    out_results.resize(2 * count);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(i);
+        out_results[i] = microsurface.eval(1.0, queries.ior_t, queries.wi[i], queries.wo[i], sampler);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        sampler.startQuery(count + i);
+        double weight = 1.0;
+        const Vector3 wo = microsurface.sample(1.0, queries.ior_t, queries.wi[i], weight, sampler);
+        out_results[count + i] = weight * wo.z;
+    }
+    return seconds(start);
+}
+
+// results of the same walk: equal up to rounding (or both NaN); counts the results that are not bit-identical in
+// io_inexact
+bool matches(const double a, const double b, size_t &io_inexact)
+{
+    if ((a == b) || ((a != a) && (b != b)))
+        return true;
+    io_inexact++;
+    return std::abs(a - b) <= MATCH_TOLERANCE * std::max(std::abs(a), std::abs(b));
+}
+
+template <class NDFType, class FacetBSDF>
+void compare(const char *name, NDFType *ndf, const Queries &queries, const int repetitions)
+{
+    const Microsurface dynamic_microsurface(ndf);
+    const MicrosurfaceOperator<NDFType, FacetBSDF> static_microsurface(ndf);
+
+    std::vector<double> dynamic_results, static_results;
+    double time_dynamic = std::numeric_limits<double>::infinity();
+    double time_static = std::numeric_limits<double>::infinity();
+    for (int r = 0; r < repetitions; ++r)
+    {
+        time_dynamic = std::min(time_dynamic, run(dynamic_microsurface, queries, dynamic_results));
+        time_static = std::min(time_static, run(static_microsurface, queries, static_results));
+    }
+
+    size_t mismatched = 0, inexact = 0;
+    for (size_t i = 0; i < dynamic_results.size(); ++i)
+    {
+        if (!matches(dynamic_results[i], static_results[i], inexact))
+            mismatched++;
+    }
+
+    const double queries_count = double(dynamic_results.size());
+    std::cout << name << ": dynamic " << 1e9 * time_dynamic / queries_count << " ns/query, static "
+              << 1e9 * time_static / queries_count << " ns/query (" << time_dynamic / time_static << "x), mismatched results: "
+              << mismatched << " (results not bit-identical: " << inexact << ")\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        std::cout << "usage: bench_static alpha numqueries repetitions \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+    const int repetitions = StringToNumber<int>(std::string(argv[3]));
+
+    // random directions, wo on both sides for the dielectric
+    MTSampler sampler(1);
+    Queries reflection, transmission;
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        const Vector3 wi = lambertDir(sampler);
+        reflection.wi.push_back(wi);
+        reflection.wo.push_back(lambertDir(sampler));
+        transmission.wi.push_back(wi);
+        transmission.wo.push_back(isotropicDir(sampler));
+    }
+    reflection.ior_t = 1.0;
+    transmission.ior_t = 1.5;
+
+    ConductorBRDF conductor(0.2, 3.0);
+    DielectricBSDF dielectric;
+    LambertBRDF lambert(0.8);
+
+    GGXNDF ggx_conductor(&conductor, alpha, alpha);
+    compare<GGXNDF, ConductorBRDF>("GGX conductor", &ggx_conductor, reflection, repetitions);
+
+    BeckmannNDF beckmann_conductor(&conductor, alpha, alpha);
+    compare<BeckmannNDF, ConductorBRDF>("Beckmann conductor", &beckmann_conductor, reflection, repetitions);
+
+    StudentTNDF studentT_conductor(&conductor, alpha, alpha, 3.0);
+    compare<StudentTNDF, ConductorBRDF>("Student-T conductor", &studentT_conductor, reflection, repetitions);
+
+    GGXNDF ggx_dielectric(&dielectric, alpha, alpha);
+    compare<GGXNDF, DielectricBSDF>("GGX dielectric", &ggx_dielectric, transmission, repetitions);
+
+    GGXNDF ggx_lambert(&lambert, alpha, alpha);
+    compare<GGXNDF, LambertBRDF>("GGX Lambert", &ggx_lambert, reflection, repetitions);
+
+    return 0;
+}
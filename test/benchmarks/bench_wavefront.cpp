@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) <2023> NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// benchmark the wavefront scheduler (WalkScheduler) against per-query walks (Microsurface::evalBatch/sampleBatch)
+// on a mix of materials, including a biscale microsurface; both use Philox streams keyed by query, so they run the same
+// walks: results must match up to rounding (MATCH_TOLERANCE), and are bit-identical without contraction of floating
+// point operations (e.g. with -march=native, the two paths inline differently and fuse different mul+add into FMAs;
+// -ffp-contract=off keeps them bit-identical)
+// build: clang++ -I include test/benchmarks/bench_wavefront.cpp src/random.cpp -O3 -o test/benchmarks/bench_wavefront
+
+#include <bsdfs/walk_scheduler.h>
+#include <bsdfs/NDFs/GGX.h>
+#include <bsdfs/NDFs/beckmann.h>
+#include <bsdfs/NDFs/studentT.h>
+#include <bsdfs/conductor.h>
+#include <bsdfs/dielectric.h>
+#include <bsdfs/mirror.h>
+#include <chrono>
+
+#define MATCH_TOLERANCE 1e-9 // relative
+
+
+double seconds(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// results of the same walk: equal up to rounding; counts the results that are not bit-identical in io_inexact
+bool matches(const double a, const double b, size_t &io_inexact)
+{
+    if (a == b)
+        return true;
+    io_inexact++;
+    return std::abs(a - b) <= MATCH_TOLERANCE * std::max(std::abs(a), std::abs(b));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cout << "usage: bench_wavefront alpha numqueries \n";
+        exit(-1);
+    }
+
+    const double alpha = StringToNumber<double>(std::string(argv[1]));
+    const size_t numqueries = StringToNumber<size_t>(std::string(argv[2]));
+
+    // materials
+    ConductorBRDF conductor(0.2, 3.0);
+    DielectricBSDF dielectric;
+    MirrorBRDF mirror;
+    GGXNDF ggx(&conductor, alpha, alpha);
+    BeckmannNDF beckmann(&dielectric, alpha, alpha);
+    StudentTNDF student_t(&conductor, alpha, alpha, 3.0);
+    BeckmannNDF biscale_inner_ndf(&mirror, alpha, alpha);
+    const Microsurface biscale_inner(&biscale_inner_ndf);
+    BeckmannNDF biscale_ndf(&biscale_inner, alpha, alpha);
+
+    const Microsurface materials[4] = {Microsurface(&ggx), Microsurface(&beckmann), Microsurface(&student_t), Microsurface(&biscale_ndf)};
+    const char *names[4] = {"GGX conductor", "Beckmann dielectric", "Student-T conductor", "biscale Beckmann mirror"};
+
+    // queries: each material gets a contiguous range of queries, shuffled directions
+    MTSampler sampler(1);
+    std::vector<double> wi_x(numqueries), wi_y(numqueries), wi_z(numqueries), wo_x(numqueries), wo_y(numqueries), wo_z(numqueries);
+    for (size_t i = 0; i < numqueries; ++i)
+    {
+        const Vector3 wi = lambertDir(sampler);
+        const Vector3 wo = isotropicDir(sampler);
+        wi_x[i] = wi.x, wi_y[i] = wi.y, wi_z[i] = wi.z;
+        wo_x[i] = wo.x, wo_y[i] = wo.y, wo_z[i] = wo.z;
+    }
+
+    MicrosurfaceBatch batches[4];
+    const size_t per_material = numqueries / 4;
+    for (int m = 0; m < 4; ++m)
+    {
+        const size_t first = m * per_material;
+        batches[m].count = per_material;
+        batches[m].wi = Vector3Arrays<const double>(wi_x.data() + first, wi_y.data() + first, wi_z.data() + first);
+        batches[m].wo = Vector3Arrays<const double>(wo_x.data() + first, wo_y.data() + first, wo_z.data() + first);
+        batches[m].ior_t = (m == 1) ? 1.5 : 1.0;
+        batches[m].first_query = first;
+    }
+
+    const uint64_t seed = 7;
+    std::vector<double> values(per_material * 4), weights(per_material * 4);
+    std::vector<double> out_x(per_material * 4), out_y(per_material * 4), out_z(per_material * 4);
+
+    // per-query walks
+    PhiloxSampler philox(seed);
+    auto start = std::chrono::steady_clock::now();
+    for (int m = 0; m < 4; ++m)
+        materials[m].evalBatch(batches[m], values.data() + m * per_material, philox);
+    const double time_eval = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int m = 0; m < 4; ++m)
+    {
+        const size_t first = m * per_material;
+        materials[m].sampleBatch(batches[m], Vector3Arrays<double>(out_x.data() + first, out_y.data() + first, out_z.data() + first), weights.data() + first, philox);
+    }
+    const double time_sample = seconds(start);
+
+    // wavefront
+    WalkScheduler scheduler(seed);
+    start = std::chrono::steady_clock::now();
+    size_t first_result[4];
+    for (int m = 0; m < 4; ++m)
+        first_result[m] = scheduler.addEvalBatch(&materials[m], batches[m]);
+    scheduler.run();
+    const double time_eval_wavefront = seconds(start);
+
+    size_t mismatches = 0, inexact = 0;
+    for (int m = 0; m < 4; ++m)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < per_material; ++i)
+        {
+            const double value = scheduler.value(first_result[m] + i);
+            mismatches += !matches(value, values[m * per_material + i], inexact);
+            sum += value;
+        }
+        std::cout << names[m] << ": mean eval " << sum / double(per_material) << "\n";
+    }
+
+    scheduler.clear();
+    start = std::chrono::steady_clock::now();
+    for (int m = 0; m < 4; ++m)
+        first_result[m] = scheduler.addSampleBatch(&materials[m], batches[m]);
+    scheduler.run();
+    const double time_sample_wavefront = seconds(start);
+
+    for (int m = 0; m < 4; ++m)
+    {
+        for (size_t i = 0; i < per_material; ++i)
+        {
+            const size_t j = m * per_material + i;
+            const Vector3 wo = scheduler.direction(first_result[m] + i);
+            mismatches += !matches(scheduler.value(first_result[m] + i), weights[j], inexact) || !matches(wo.x, out_x[j], inexact) ||
+                          !matches(wo.y, out_y[j], inexact) || !matches(wo.z, out_z[j], inexact);
+        }
+    }
+
+    std::cout << "eval:   per query " << 1e9 * time_eval / double(4 * per_material) << " ns, wavefront " << 1e9 * time_eval_wavefront / double(4 * per_material) << " ns\n";
+    std::cout << "sample: per query " << 1e9 * time_sample / double(4 * per_material) << " ns, wavefront " << 1e9 * time_sample_wavefront / double(4 * per_material) << " ns\n";
+    std::cout << "mismatched results: " << mismatches << " (results not bit-identical: " << inexact << ")\n";
+
+    return mismatches != 0;
+}